@@ -0,0 +1,107 @@
+// ==========================================================================
+// Arena Allocator Support Code
+// ==========================================================================
+
+#include "Arena.h"
+
+#include <algorithm>
+#include <new>
+#include <cstdint>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+Arena::Arena(size_t blockSize)
+    : m_block(0), m_offset(0), m_used(0), m_peak(0), m_blockSize(blockSize)
+{
+}
+
+Arena::~Arena()
+{
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        ::operator delete(m_blocks[i].data);
+}
+
+void *Arena::Allocate(size_t bytes, size_t alignment)
+{
+    for (;;)
+    {
+        if (m_block < m_blocks.size())
+        {
+            const Block &block = m_blocks[m_block];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+            uintptr_t aligned = (base + m_offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            size_t start = aligned - base;
+            if (start + bytes <= block.size)
+            {
+                m_used += start + bytes - m_offset;
+                m_peak = max(m_peak, m_used);
+                m_offset = start + bytes;
+                return block.data + start;
+            }
+
+            // the rest of this block is left unused until the next rewind
+            m_block++;
+            m_offset = 0;
+            continue;
+        }
+
+        Block block;
+        block.size = max(m_blockSize, bytes + alignment);
+        block.data = static_cast<char *>(::operator new(block.size));
+        m_blocks.push_back(block);
+    }
+}
+
+Arena::Marker Arena::Mark() const
+{
+    Marker marker = { m_block, m_offset, m_used };
+    return marker;
+}
+
+void Arena::Rewind(const Marker &marker)
+{
+    m_block = marker.block;
+    m_offset = marker.offset;
+    m_used = marker.used;
+}
+
+void Arena::Reset()
+{
+    if (m_blocks.size() > 1)
+    {
+        // one block with some headroom for alignment padding
+        size_t size = max(m_blockSize, m_peak + m_peak / 4);
+        for (size_t i = 0; i < m_blocks.size(); ++i)
+            ::operator delete(m_blocks[i].data);
+        m_blocks.clear();
+
+        Block block;
+        block.size = size;
+        block.data = static_cast<char *>(::operator new(size));
+        m_blocks.push_back(block);
+    }
+
+    m_block = 0;
+    m_offset = 0;
+    m_used = 0;
+}
+
+size_t Arena::Capacity() const
+{
+    size_t capacity = 0;
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+        capacity += m_blocks[i].size;
+    return capacity;
+}
+
+// --------------------------------------------------------------------------
+
+Arena &ThreadArena()
+{
+    thread_local Arena arena;
+    return arena;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,86 @@
+// ==========================================================================
+// Arena Allocator Support Code
+//  - bump allocation of per-frame scratch memory out of large blocks
+//  - markers to give back everything allocated since a point in time
+//  - one arena per thread, so workers never contend for scratch memory
+//
+// Blocks are kept when an arena is rewound or reset, so once the arenas
+// have grown to what a frame needs, later frames allocate nothing.
+// ==========================================================================
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <cstddef>
+
+class Arena
+{
+    struct Block
+    {
+        char   *data;
+        size_t  size;
+    };
+
+    std::vector<Block> m_blocks;
+    size_t m_block;         // block currently bumped from
+    size_t m_offset;        // first free byte in that block
+    size_t m_used;          // bytes handed out since the last reset
+    size_t m_peak;          // most bytes handed out between two resets
+    size_t m_blockSize;
+
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+public:
+    // position in the arena that can be rewound to later
+    struct Marker
+    {
+        size_t block;
+        size_t offset;
+        size_t used;
+    };
+
+    explicit Arena(size_t blockSize = 1 << 16);
+    ~Arena();
+
+    // returns uninitialized memory that stays valid until the arena is
+    // rewound past it or reset; never returns null
+    void *Allocate(size_t bytes, size_t alignment = 16);
+
+    // array of count default-initialized elements, for types that need no
+    // destructor call
+    template <class T> T *Allocate(size_t count)
+    {
+        return static_cast<T *>(Allocate(count * sizeof(T), alignof(T)));
+    }
+
+    Marker Mark() const;
+    void Rewind(const Marker &marker);
+
+    // gives back everything; if the last cycle spilled over into more than
+    // one block, the blocks are replaced by a single one big enough for it
+    void Reset();
+
+    size_t Capacity() const;
+    size_t Peak() const { return m_peak; }
+};
+
+// rewinds an arena to where it was when the scope was entered
+class ArenaScope
+{
+    Arena        &m_arena;
+    Arena::Marker m_marker;
+
+    ArenaScope(const ArenaScope &);
+    ArenaScope &operator=(const ArenaScope &);
+
+public:
+    explicit ArenaScope(Arena &arena) : m_arena(arena), m_marker(arena.Mark()) {}
+    ~ArenaScope() { m_arena.Rewind(m_marker); }
+};
+
+// the calling thread's own arena, created on first use
+Arena &ThreadArena();
+
+// --------------------------------------------------------------------------
+#endif // ARENA_H
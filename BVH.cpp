@@ -0,0 +1,1008 @@
+// ==========================================================================
+// Bounding Volume Hierarchy Support Code
+//
+// The binary hierarchy is built top-down: at every node the primitive
+// centres are dropped into a fixed number of bins along the widest axis and
+// the bin boundary with the lowest surface area cost becomes the split.
+//
+// Compress() collapses the binary tree into 8-wide nodes by repeatedly
+// opening the child with the largest surface area, then stores each child
+// box as 8-bit offsets on a power of two grid anchored at the parent's
+// lower corner. Rounding is always outwards, so a quantized box can only
+// report extra candidates, never miss one.
+// ==========================================================================
+
+#include "BVH.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <atomic>
+#include <glm/common.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // number of bins the SAH builder evaluates per node
+    const int BinCount = 16;
+
+    // nodes with at least this many primitives are binned in parallel, and
+    // this is the chunk size for the parallel loops of the builder
+    const int ParallelGrain = 1 << 16;
+
+    // subtrees with at least this many primitives become separate tasks
+    const int TaskGrain = 1 << 12;
+
+    // past this depth the builder falls back to median splits, which keeps
+    // the traversal stacks below bounded even for degenerate input
+    const int MaxSAHDepth = 64;
+    const int BinaryStackSize = 128;
+    const int WideStackSize = 1024;
+
+    // smallest and largest grid exponent a compressed node may use
+    const int MinExponent = -100;
+    const int MaxExponent = 100;
+
+    // reciprocal of a direction, with zero components replaced by a tiny
+    // value so that slab distances stay finite
+    vec3 SafeReciprocal(const vec3 &d)
+    {
+        vec3 r;
+        for (int k = 0; k < 3; ++k)
+        {
+            float v = d[k];
+            if (fabs(v) < 1e-20f)
+                v = (v < 0.f) ? -1e-20f : 1e-20f;
+            r[k] = 1.f / v;
+        }
+        return r;
+    }
+
+    // union of boxOf(i) over [begin, end), reduced in parallel chunks
+    template <class BoxOf>
+    AABB ParallelBounds(ThreadPool *pool, int begin, int end, BoxOf boxOf)
+    {
+        int chunkCount = pool ? std::max(1, (end - begin) / ParallelGrain) : 1;
+        vector<AABB> partial(chunkCount);
+        ThreadPool::ParallelFor(pool, 0, chunkCount, 1, [&](int c0, int c1) {
+            for (int c = c0; c < c1; ++c)
+            {
+                int i = begin + (int)((long long)(end - begin) * c / chunkCount);
+                int iEnd = begin + (int)((long long)(end - begin) * (c + 1) / chunkCount);
+                for (; i < iEnd; ++i)
+                    partial[c].Grow(boxOf(i));
+            }
+        });
+        for (int c = 1; c < chunkCount; ++c)
+            partial[0].Grow(partial[c]);
+        return partial[0];
+    }
+
+    // spreads the low 10 bits of v out to every third bit
+    uint32_t ExpandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // 30-bit Z-order code of a point already scaled to [0, 1023]^3
+    uint32_t MortonCode(const vec3 &q)
+    {
+        uint32_t x = (uint32_t)std::min(std::max(q.x, 0.f), 1023.f);
+        uint32_t y = (uint32_t)std::min(std::max(q.y, 0.f), 1023.f);
+        uint32_t z = (uint32_t)std::min(std::max(q.z, 0.f), 1023.f);
+        return (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+    }
+
+    int HighestBit(uint32_t v)
+    {
+        int bit = 0;
+        while (v >>= 1)
+            ++bit;
+        return bit;
+    }
+
+    // stable least significant digit radix sort on the upper 32 bits of the
+    // keys; every pass histograms and scatters chunks of keys in parallel
+    void RadixSortUpper(vector<uint64_t> &keys, ThreadPool *pool)
+    {
+        int count = (int)keys.size();
+        int chunkCount = pool ? std::max(1, count / ParallelGrain) : 1;
+        vector<uint64_t> scratch(count);
+        vector<int> offsets(chunkCount * 256);
+
+        for (int shift = 32; shift < 64; shift += 8)
+        {
+            std::fill(offsets.begin(), offsets.end(), 0);
+            auto chunkBegin = [&](int c) { return (int)((long long)count * c / chunkCount); };
+
+            ThreadPool::ParallelFor(pool, 0, chunkCount, 1, [&](int c0, int c1) {
+                for (int c = c0; c < c1; ++c)
+                    for (int i = chunkBegin(c); i < chunkBegin(c + 1); ++i)
+                        offsets[c * 256 + (int)((keys[i] >> shift) & 0xff)]++;
+            });
+
+            // digit-major prefix sum keeps equal digits in chunk order
+            int running = 0;
+            for (int d = 0; d < 256; ++d)
+                for (int c = 0; c < chunkCount; ++c)
+                {
+                    int n = offsets[c * 256 + d];
+                    offsets[c * 256 + d] = running;
+                    running += n;
+                }
+
+            ThreadPool::ParallelFor(pool, 0, chunkCount, 1, [&](int c0, int c1) {
+                for (int c = c0; c < c1; ++c)
+                    for (int i = chunkBegin(c); i < chunkBegin(c + 1); ++i)
+                        scratch[offsets[c * 256 + (int)((keys[i] >> shift) & 0xff)]++] = keys[i];
+            });
+            keys.swap(scratch);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+
+AABB::AABB()
+    : lower(FLT_MAX), upper(-FLT_MAX)
+{
+}
+
+void AABB::Grow(const vec3 &p)
+{
+    lower = glm::min(lower, p);
+    upper = glm::max(upper, p);
+}
+
+void AABB::Grow(const AABB &box)
+{
+    lower = glm::min(lower, box.lower);
+    upper = glm::max(upper, box.upper);
+}
+
+float AABB::SurfaceArea() const
+{
+    vec3 e = glm::max(upper - lower, vec3(0.f));
+    return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+// --------------------------------------------------------------------------
+
+BVH::BVH()
+    : m_primCount(0), m_compressed(false), m_referenceCost(0.f)
+{
+}
+
+// --------------------------------------------------------------------------
+
+// state shared by every task of one build
+struct BVH::BuildContext
+{
+    const vector<AABB> &boxes;
+    vector<vec3>        centres;
+    ThreadPool         *pool;
+    atomic<int>         nodeCount;
+
+    BuildContext(const vector<AABB> &b, ThreadPool *p)
+        : boxes(b), pool(p), nodeCount(1)
+    {}
+};
+
+void BVH::Build(const vector<AABB> &boxes, ThreadPool *pool, BVHBuildMethod method)
+{
+    m_primCount = (int)boxes.size();
+    m_compressed = false;
+    m_wideNodes.clear();
+    m_wideLinks.clear();
+    m_widePrimIndices.clear();
+
+    m_nodes.clear();
+    m_primIndices.resize(m_primCount);
+    m_referenceCost = 0.f;
+    if (m_primCount == 0)
+        return;
+
+    // a binary tree with single-primitive leaves never needs more nodes
+    // than this, so tasks can claim node slots without locking
+    BuildContext context(boxes, pool);
+    context.centres.resize(m_primCount);
+    m_nodes.resize(2 * m_primCount - 1);
+    m_nodes[0].leftOrFirst = 0;
+    m_nodes[0].count = m_primCount;
+
+    ThreadPool::ParallelFor(pool, 0, m_primCount, ParallelGrain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            m_primIndices[i] = i;
+            context.centres[i] = boxes[i].Centre();
+        }
+    });
+
+    if (method == BuildMorton)
+        EmitMorton(context, MortonSort(context), 0);
+    else
+    {
+        AABB bounds = ParallelBounds(pool, 0, m_primCount,
+                                     [&](int i) { return boxes[i]; });
+        m_nodes[0].lower = bounds.lower;
+        m_nodes[0].upper = bounds.upper;
+        Subdivide(context, 0, 0);
+    }
+
+    m_nodes.resize(context.nodeCount);
+    m_nodes.shrink_to_fit();
+    m_referenceCost = SAHCost();
+}
+
+int BVH::AllocateChildren(BuildContext &context)
+{
+    return context.nodeCount.fetch_add(2);
+}
+
+void BVH::UpdateBounds(int nodeIndex, const vector<AABB> &boxes)
+{
+    BVHNode &node = m_nodes[nodeIndex];
+    AABB bounds;
+    for (int i = 0; i < node.count; ++i)
+        bounds.Grow(boxes[m_primIndices[node.leftOrFirst + i]]);
+    node.lower = bounds.lower;
+    node.upper = bounds.upper;
+}
+
+// --------------------------------------------------------------------------
+
+void BVH::Subdivide(BuildContext &context, int nodeIndex, int depth)
+{
+    const vector<AABB> &boxes = context.boxes;
+    const vector<vec3> &centres = context.centres;
+    int first = m_nodes[nodeIndex].leftOrFirst;
+    int count = m_nodes[nodeIndex].count;
+    if (count <= MaxLeafSize)
+        return;
+
+    // large nodes near the root are binned in parallel; further down the
+    // subtrees themselves provide the parallelism
+    ThreadPool *pool = (count >= ParallelGrain) ? context.pool : 0;
+
+    // bounds of the primitive centres decide the split axis and bin layout
+    AABB centreBounds = ParallelBounds(pool, first, first + count,
+                                       [&](int i) { return centres[m_primIndices[i]]; });
+    vec3 extent = centreBounds.upper - centreBounds.lower;
+    int axis = 0;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    int *begin = &m_primIndices[first];
+    int *end = begin + count;
+    int *middle = begin;
+    AABB leftBounds, rightBounds;
+
+    if (extent[axis] > 0.f && depth < MaxSAHDepth)
+    {
+        float binScale = BinCount / extent[axis];
+        float binOrigin = centreBounds.lower[axis];
+        auto binOf = [&](int prim) {
+            int b = (int)((centres[prim][axis] - binOrigin) * binScale);
+            return std::min(std::max(b, 0), BinCount - 1);
+        };
+
+        // each chunk fills its own bins, which are merged afterwards
+        struct Bins
+        {
+            AABB bounds[BinCount];
+            int  counts[BinCount];
+        };
+        int chunkCount = pool ? (count + ParallelGrain - 1) / ParallelGrain : 1;
+        vector<Bins> chunkBins(chunkCount);
+        ThreadPool::ParallelFor(pool, 0, chunkCount, 1, [&](int c0, int c1) {
+            for (int c = c0; c < c1; ++c)
+            {
+                Bins &bins = chunkBins[c];
+                std::fill(bins.counts, bins.counts + BinCount, 0);
+                int *p = begin + (long long)count * c / chunkCount;
+                int *pEnd = begin + (long long)count * (c + 1) / chunkCount;
+                for (; p != pEnd; ++p)
+                {
+                    int b = binOf(*p);
+                    bins.counts[b]++;
+                    bins.bounds[b].Grow(boxes[*p]);
+                }
+            }
+        });
+        Bins &bins = chunkBins[0];
+        for (int c = 1; c < chunkCount; ++c)
+            for (int b = 0; b < BinCount; ++b)
+            {
+                bins.counts[b] += chunkBins[c].counts[b];
+                bins.bounds[b].Grow(chunkBins[c].bounds[b]);
+            }
+
+        // sweep from the right to get the cost of everything above a plane
+        float rightCost[BinCount];
+        AABB sweep;
+        int sweepCount = 0;
+        for (int b = BinCount - 1; b > 0; --b)
+        {
+            sweep.Grow(bins.bounds[b]);
+            sweepCount += bins.counts[b];
+            rightCost[b] = sweepCount ? sweep.SurfaceArea() * sweepCount : 0.f;
+        }
+
+        // then from the left, keeping the cheapest plane
+        int bestPlane = 1;
+        float bestCost = FLT_MAX;
+        sweep = AABB();
+        sweepCount = 0;
+        for (int b = 1; b < BinCount; ++b)
+        {
+            sweep.Grow(bins.bounds[b - 1]);
+            sweepCount += bins.counts[b - 1];
+            if (sweepCount == 0 || sweepCount == count)
+                continue;
+            float cost = sweep.SurfaceArea() * sweepCount + rightCost[b];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestPlane = b;
+            }
+        }
+
+        middle = std::partition(begin, end,
+                                [&](int prim) { return binOf(prim) < bestPlane; });
+
+        // the child bounds fall straight out of the bins
+        for (int b = 0; b < BinCount; ++b)
+            (b < bestPlane ? leftBounds : rightBounds).Grow(bins.bounds[b]);
+    }
+
+    // fall back to an object median when the bins could not separate anything
+    bool median = (middle == begin || middle == end);
+    if (median)
+    {
+        middle = begin + count / 2;
+        std::nth_element(begin, middle, end, [&](int a, int b) {
+            return centres[a][axis] < centres[b][axis];
+        });
+    }
+
+    int leftCount = (int)(middle - begin);
+    int left = AllocateChildren(context);
+    m_nodes[left].leftOrFirst = first;
+    m_nodes[left].count = leftCount;
+    m_nodes[left + 1].leftOrFirst = first + leftCount;
+    m_nodes[left + 1].count = count - leftCount;
+    m_nodes[nodeIndex].leftOrFirst = left;
+    m_nodes[nodeIndex].count = 0;
+
+    if (median)
+    {
+        UpdateBounds(left, boxes);
+        UpdateBounds(left + 1, boxes);
+    }
+    else
+    {
+        m_nodes[left].lower = leftBounds.lower;
+        m_nodes[left].upper = leftBounds.upper;
+        m_nodes[left + 1].lower = rightBounds.lower;
+        m_nodes[left + 1].upper = rightBounds.upper;
+    }
+
+    // hand the left subtree to another thread if it is worth the overhead
+    if (context.pool && count >= TaskGrain)
+    {
+        ThreadPool::TaskGroup group(context.pool);
+        group.Run([&context, this, left, depth] { Subdivide(context, left, depth + 1); });
+        Subdivide(context, left + 1, depth + 1);
+        group.Wait();
+    }
+    else
+    {
+        Subdivide(context, left, depth + 1);
+        Subdivide(context, left + 1, depth + 1);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+vector<uint32_t> BVH::MortonSort(BuildContext &context)
+{
+    ThreadPool *pool = context.pool;
+    const vector<vec3> &centres = context.centres;
+    AABB centreBounds = ParallelBounds(pool, 0, m_primCount,
+                                       [&](int i) { return centres[i]; });
+    vec3 scale = 1023.f / glm::max(centreBounds.upper - centreBounds.lower, vec3(1e-20f));
+
+    // code in the upper half, primitive index in the lower
+    vector<uint64_t> keys(m_primCount);
+    ThreadPool::ParallelFor(pool, 0, m_primCount, ParallelGrain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            vec3 q = (centres[i] - centreBounds.lower) * scale;
+            uint64_t code = MortonCode(q);
+            keys[i] = (code << 32) | (uint32_t)i;
+        }
+    });
+
+    RadixSortUpper(keys, pool);
+
+    vector<uint32_t> codes(m_primCount);
+    ThreadPool::ParallelFor(pool, 0, m_primCount, ParallelGrain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+        {
+            codes[i] = (uint32_t)(keys[i] >> 32);
+            m_primIndices[i] = (int)(keys[i] & 0xffffffffu);
+        }
+    });
+    return codes;
+}
+
+void BVH::EmitMorton(BuildContext &context, const vector<uint32_t> &codes, int nodeIndex)
+{
+    int first = m_nodes[nodeIndex].leftOrFirst;
+    int count = m_nodes[nodeIndex].count;
+    if (count <= MaxLeafSize)
+    {
+        UpdateBounds(nodeIndex, context.boxes);
+        return;
+    }
+
+    // split where the highest differing code bit changes; identical codes
+    // are simply halved
+    int last = first + count - 1;
+    int split = first + count / 2;
+    uint32_t differing = codes[first] ^ codes[last];
+    if (differing)
+    {
+        uint32_t bit = 1u << HighestBit(differing);
+        uint32_t prefix = codes[first] & ~(bit - 1) & ~bit;
+        int lo = first, hi = last;      // codes[lo] lacks the bit, codes[hi] has it
+        while (hi - lo > 1)
+        {
+            int mid = lo + (hi - lo) / 2;
+            if ((codes[mid] & ~(bit - 1)) == prefix)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        split = hi;
+    }
+
+    int left = AllocateChildren(context);
+    m_nodes[left].leftOrFirst = first;
+    m_nodes[left].count = split - first;
+    m_nodes[left + 1].leftOrFirst = split;
+    m_nodes[left + 1].count = first + count - split;
+    m_nodes[nodeIndex].leftOrFirst = left;
+    m_nodes[nodeIndex].count = 0;
+
+    if (context.pool && count >= TaskGrain)
+    {
+        ThreadPool::TaskGroup group(context.pool);
+        group.Run([&context, &codes, this, left] { EmitMorton(context, codes, left); });
+        EmitMorton(context, codes, left + 1);
+        group.Wait();
+    }
+    else
+    {
+        EmitMorton(context, codes, left);
+        EmitMorton(context, codes, left + 1);
+    }
+
+    // internal bounds are only known once both subtrees are finished
+    AABB bounds(m_nodes[left].lower, m_nodes[left].upper);
+    bounds.Grow(AABB(m_nodes[left + 1].lower, m_nodes[left + 1].upper));
+    m_nodes[nodeIndex].lower = bounds.lower;
+    m_nodes[nodeIndex].upper = bounds.upper;
+}
+
+// --------------------------------------------------------------------------
+
+void BVH::Compress()
+{
+    if (m_compressed)
+        return;
+
+    m_wideNodes.clear();
+    m_wideLinks.clear();
+    m_widePrimIndices.clear();
+    if (!m_nodes.empty())
+    {
+        m_wideNodes.reserve(m_nodes.size() / 4 + 1);
+        m_wideLinks.reserve(m_nodes.size() / 4 + 1);
+        m_widePrimIndices.reserve(m_primIndices.size());
+        m_wideNodes.resize(1);
+        m_wideLinks.resize(1);
+        CollapseNode(0, 0);
+    }
+
+    // the binary layout is no longer needed; release its memory
+    vector<BVHNode>().swap(m_nodes);
+    vector<int>().swap(m_primIndices);
+    m_compressed = true;
+    m_referenceCost = SAHCost();
+}
+
+void BVH::QuantizeNode(WideNode &node, const AABB *childBoxes, int childCount)
+{
+    AABB bounds;
+    for (int i = 0; i < childCount; ++i)
+        bounds.Grow(childBoxes[i]);
+
+    // choose a power of two grid per axis that spans the node in 255 steps
+    float scale[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        node.origin[k] = bounds.lower[k];
+        float extent = bounds.upper[k] - bounds.lower[k];
+        int e = 0;
+        if (extent > 0.f)
+        {
+            e = (int)std::ceil(std::log2(extent / 255.f));
+            e = std::min(std::max(e, MinExponent), MaxExponent);
+            while (e < MaxExponent && extent / std::ldexp(1.f, e) > 255.f)
+                ++e;
+        }
+        node.exponent[k] = (int8_t)e;
+        scale[k] = std::ldexp(1.f, e);
+    }
+
+    uint8_t *lowerQ[3] = { node.lowerX, node.lowerY, node.lowerZ };
+    uint8_t *upperQ[3] = { node.upperX, node.upperY, node.upperZ };
+    for (int i = 0; i < 8; ++i)
+        for (int k = 0; k < 3; ++k)
+        {
+            if (i >= childCount)
+            {
+                lowerQ[k][i] = 255;
+                upperQ[k][i] = 0;
+                continue;
+            }
+
+            // round outwards, then nudge in case the float maths did not
+            const AABB &c = childBoxes[i];
+            float lo = floor((c.lower[k] - node.origin[k]) / scale[k]);
+            float hi = ceil((c.upper[k] - node.origin[k]) / scale[k]);
+            lo = std::min(std::max(lo, 0.f), 255.f);
+            hi = std::min(std::max(hi, 0.f), 255.f);
+            while (lo > 0.f && node.origin[k] + lo * scale[k] > c.lower[k])
+                lo -= 1.f;
+            while (hi < 255.f && node.origin[k] + hi * scale[k] < c.upper[k])
+                hi += 1.f;
+            lowerQ[k][i] = (uint8_t)lo;
+            upperQ[k][i] = (uint8_t)hi;
+        }
+}
+
+void BVH::CollapseNode(int binaryIndex, int wideIndex)
+{
+    // gather up to eight children by opening the largest internal child
+    int children[8];
+    int childCount = 0;
+    if (m_nodes[binaryIndex].IsLeaf())
+        children[childCount++] = binaryIndex;
+    else
+    {
+        children[childCount++] = m_nodes[binaryIndex].leftOrFirst;
+        children[childCount++] = m_nodes[binaryIndex].leftOrFirst + 1;
+    }
+    while (childCount < 8)
+    {
+        int largest = -1;
+        float largestArea = -1.f;
+        for (int i = 0; i < childCount; ++i)
+        {
+            const BVHNode &c = m_nodes[children[i]];
+            if (c.IsLeaf())
+                continue;
+            float area = AABB(c.lower, c.upper).SurfaceArea();
+            if (area > largestArea)
+            {
+                largestArea = area;
+                largest = i;
+            }
+        }
+        if (largest < 0)
+            break;
+        int opened = m_nodes[children[largest]].leftOrFirst;
+        children[largest] = opened;
+        children[childCount++] = opened + 1;
+    }
+
+    // reserve contiguous slots for the internal children
+    int internalCount = 0;
+    AABB childBoxes[8];
+    for (int i = 0; i < childCount; ++i)
+    {
+        const BVHNode &c = m_nodes[children[i]];
+        childBoxes[i] = AABB(c.lower, c.upper);
+        if (!c.IsLeaf())
+            internalCount++;
+    }
+    uint32_t childBase = (uint32_t)m_wideNodes.size();
+    m_wideNodes.resize(m_wideNodes.size() + internalCount);
+    m_wideLinks.resize(m_wideLinks.size() + internalCount);
+
+    WideNode &node = m_wideNodes[wideIndex];
+    WideNodeLinks &links = m_wideLinks[wideIndex];
+    links.childBase = childBase;
+    links.primBase = (uint32_t)m_widePrimIndices.size();
+    node.internalMask = 0;
+    QuantizeNode(node, childBoxes, childCount);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        links.primOffset[i] = 0;
+        links.primCount[i] = 0;
+    }
+    for (int i = 0; i < childCount; ++i)
+    {
+        const BVHNode &c = m_nodes[children[i]];
+        if (c.IsLeaf())
+        {
+            links.primOffset[i] = (uint8_t)(m_widePrimIndices.size() - links.primBase);
+            links.primCount[i] = (uint8_t)c.count;
+            for (int p = 0; p < c.count; ++p)
+                m_widePrimIndices.push_back(m_primIndices[c.leftOrFirst + p]);
+        }
+        else
+            node.internalMask |= (uint8_t)(1u << i);
+    }
+
+    // recurse only after this node is complete, the vectors may reallocate
+    int rank = 0;
+    for (int i = 0; i < childCount; ++i)
+        if (!m_nodes[children[i]].IsLeaf())
+            CollapseNode(children[i], childBase + rank++);
+}
+
+// --------------------------------------------------------------------------
+
+void BVH::Refit(const vector<AABB> &boxes, ThreadPool *pool)
+{
+    if (m_compressed)
+    {
+        if (!m_wideNodes.empty())
+            RefitWideNode(boxes, 0);
+        return;
+    }
+    if (m_nodes.empty())
+        return;
+
+    // leaves are independent of each other and are done in parallel first
+    int nodeCount = (int)m_nodes.size();
+    ThreadPool::ParallelFor(pool, 0, nodeCount, ParallelGrain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            if (m_nodes[i].IsLeaf())
+                UpdateBounds(i, boxes);
+    });
+
+    // children are always allocated after their parent, so a reverse sweep
+    // sees both children of a node before the node itself
+    for (int i = nodeCount - 1; i >= 0; --i)
+    {
+        BVHNode &node = m_nodes[i];
+        if (node.IsLeaf())
+            continue;
+        const BVHNode &left = m_nodes[node.leftOrFirst];
+        const BVHNode &right = m_nodes[node.leftOrFirst + 1];
+        node.lower = glm::min(left.lower, right.lower);
+        node.upper = glm::max(left.upper, right.upper);
+    }
+}
+
+AABB BVH::RefitWideNode(const vector<AABB> &boxes, int wideIndex)
+{
+    const WideNodeLinks &links = m_wideLinks[wideIndex];
+    uint8_t internalMask = m_wideNodes[wideIndex].internalMask;
+
+    AABB childBoxes[8];
+    int childCount = 0;
+    int rank = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        if ((internalMask >> i) & 1u)
+            childBoxes[childCount++] = RefitWideNode(boxes, links.childBase + rank++);
+        else if (links.primCount[i] > 0)
+        {
+            const int *prims = &m_widePrimIndices[links.primBase + links.primOffset[i]];
+            AABB box;
+            for (int p = 0; p < links.primCount[i]; ++p)
+                box.Grow(boxes[prims[p]]);
+            childBoxes[childCount++] = box;
+        }
+    }
+
+    QuantizeNode(m_wideNodes[wideIndex], childBoxes, childCount);
+
+    AABB bounds;
+    for (int i = 0; i < childCount; ++i)
+        bounds.Grow(childBoxes[i]);
+    return bounds;
+}
+
+bool BVH::Update(const vector<AABB> &boxes, float rebuildThreshold,
+                 ThreadPool *pool, BVHBuildMethod method)
+{
+    if ((int)boxes.size() == m_primCount && m_referenceCost > 0.f)
+    {
+        Refit(boxes, pool);
+        if (SAHCost() <= rebuildThreshold * m_referenceCost)
+            return false;
+    }
+
+    bool compressed = m_compressed;
+    Build(boxes, pool, method);
+    if (compressed)
+        Compress();
+    return true;
+}
+
+float BVH::SAHCost() const
+{
+    // traversal steps and primitive tests weighted by the probability of a
+    // random ray hitting each box, relative to the root
+    const float traversalCost = 1.f;
+    const float intersectionCost = 1.f;
+    float cost = 0.f;
+    float rootArea = 0.f;
+
+    if (!m_compressed)
+    {
+        if (m_nodes.empty())
+            return 0.f;
+        rootArea = AABB(m_nodes[0].lower, m_nodes[0].upper).SurfaceArea();
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+        {
+            const BVHNode &node = m_nodes[i];
+            float area = AABB(node.lower, node.upper).SurfaceArea();
+            cost += area * (node.IsLeaf() ? intersectionCost * node.count : traversalCost);
+        }
+    }
+    else
+    {
+        if (m_wideNodes.empty())
+            return 0.f;
+        for (size_t n = 0; n < m_wideNodes.size(); ++n)
+        {
+            // the decoded child boxes are what traversal actually tests
+            const WideNode &node = m_wideNodes[n];
+            const WideNodeLinks &links = m_wideLinks[n];
+            const uint8_t *lowerQ[3] = { node.lowerX, node.lowerY, node.lowerZ };
+            const uint8_t *upperQ[3] = { node.upperX, node.upperY, node.upperZ };
+            AABB bounds;
+            for (int i = 0; i < 8; ++i)
+            {
+                bool internal = (node.internalMask >> i) & 1u;
+                if (!internal && links.primCount[i] == 0)
+                    continue;
+                AABB child;
+                for (int k = 0; k < 3; ++k)
+                {
+                    float scale = std::ldexp(1.f, (int)node.exponent[k]);
+                    child.lower[k] = node.origin[k] + lowerQ[k][i] * scale;
+                    child.upper[k] = node.origin[k] + upperQ[k][i] * scale;
+                }
+                bounds.Grow(child);
+                if (!internal)
+                    cost += child.SurfaceArea() * intersectionCost * links.primCount[i];
+            }
+            float area = bounds.SurfaceArea();
+            cost += area * traversalCost;
+            if (n == 0)
+                rootArea = area;
+        }
+    }
+    return rootArea > 0.f ? cost / rootArea : cost;
+}
+
+// --------------------------------------------------------------------------
+
+bool IntersectBox(const vec3 &lower, const vec3 &upper, const vec3 &origin,
+                  const vec3 &invDir, float tmin, float tmax)
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        float t0 = (lower[k] - origin[k]) * invDir[k];
+        float t1 = (upper[k] - origin[k]) * invDir[k];
+        if (invDir[k] < 0.f)
+            std::swap(t0, t1);
+        tmin = std::max(tmin, t0);
+        tmax = std::min(tmax, t1);
+    }
+    return tmin <= tmax;
+}
+
+uint32_t IntersectWideNodeScalar(const WideNode &node, const vec3 &origin,
+                                 const vec3 &invDir, float tmin, float tmax)
+{
+    const uint8_t *lowerQ[3] = { node.lowerX, node.lowerY, node.lowerZ };
+    const uint8_t *upperQ[3] = { node.upperX, node.upperY, node.upperZ };
+
+    // child plane k of slot i is at t = a[k] + q * b[k]
+    float a[3], b[3];
+    const uint8_t *nearQ[3], *farQ[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        a[k] = (node.origin[k] - origin[k]) * invDir[k];
+        b[k] = std::ldexp(1.f, (int)node.exponent[k]) * invDir[k];
+        nearQ[k] = (invDir[k] < 0.f) ? upperQ[k] : lowerQ[k];
+        farQ[k] = (invDir[k] < 0.f) ? lowerQ[k] : upperQ[k];
+    }
+
+    uint32_t mask = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        float tnear = tmin, tfar = tmax;
+        for (int k = 0; k < 3; ++k)
+        {
+            tnear = std::max(tnear, a[k] + nearQ[k][i] * b[k]);
+            tfar = std::min(tfar, a[k] + farQ[k][i] * b[k]);
+        }
+        if (tnear <= tfar)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE2__)
+uint32_t IntersectWideNodeSSE(const WideNode &node, const vec3 &origin,
+                              const vec3 &invDir, float tmin, float tmax)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const uint8_t *lowerQ[3] = { node.lowerX, node.lowerY, node.lowerZ };
+    const uint8_t *upperQ[3] = { node.upperX, node.upperY, node.upperZ };
+
+    // slots 0-3 and 4-7 are processed side by side in two registers
+    __m128 tnear0 = _mm_set1_ps(tmin), tnear1 = tnear0;
+    __m128 tfar0 = _mm_set1_ps(tmax), tfar1 = tfar0;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        __m128 a = _mm_set1_ps((node.origin[k] - origin[k]) * invDir[k]);
+        __m128 b = _mm_set1_ps(std::ldexp(1.f, (int)node.exponent[k]) * invDir[k]);
+        const uint8_t *nearQ = (invDir[k] < 0.f) ? upperQ[k] : lowerQ[k];
+        const uint8_t *farQ = (invDir[k] < 0.f) ? lowerQ[k] : upperQ[k];
+
+        // widen eight bytes to two vectors of four floats
+        __m128i n = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)nearQ), zero);
+        __m128i f = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)farQ), zero);
+        __m128 n0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(n, zero));
+        __m128 n1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(n, zero));
+        __m128 f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(f, zero));
+        __m128 f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(f, zero));
+
+        tnear0 = _mm_max_ps(tnear0, _mm_add_ps(a, _mm_mul_ps(n0, b)));
+        tnear1 = _mm_max_ps(tnear1, _mm_add_ps(a, _mm_mul_ps(n1, b)));
+        tfar0 = _mm_min_ps(tfar0, _mm_add_ps(a, _mm_mul_ps(f0, b)));
+        tfar1 = _mm_min_ps(tfar1, _mm_add_ps(a, _mm_mul_ps(f1, b)));
+    }
+
+    uint32_t mask0 = (uint32_t)_mm_movemask_ps(_mm_cmple_ps(tnear0, tfar0));
+    uint32_t mask1 = (uint32_t)_mm_movemask_ps(_mm_cmple_ps(tnear1, tfar1));
+    return mask0 | (mask1 << 4);
+}
+#endif
+
+// --------------------------------------------------------------------------
+
+void BVH::Candidates(const vec3 &origin, const vec3 &direction,
+                     float tmin, float tmax, vector<int> &candidates) const
+{
+    // room for every primitive, then trim to what was actually found
+    size_t first = candidates.size();
+    candidates.resize(first + m_primCount);
+    int count = Candidates(origin, direction, tmin, tmax, candidates.data() + first);
+    candidates.resize(first + count);
+}
+
+int BVH::Candidates(const vec3 &origin, const vec3 &direction,
+                    float tmin, float tmax, int *candidates, int *nodeVisits) const
+{
+    int count = 0;
+    int visits = 0;
+    vec3 invDir = SafeReciprocal(direction);
+    if (nodeVisits)
+        *nodeVisits = 0;
+
+    if (!m_compressed)
+    {
+        if (m_nodes.empty())
+            return 0;
+
+        int stack[BinaryStackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const BVHNode &node = m_nodes[stack[--top]];
+            visits++;
+            if (!IntersectBox(node.lower, node.upper, origin, invDir, tmin, tmax))
+                continue;
+            if (node.IsLeaf())
+            {
+                for (int i = 0; i < node.count; ++i)
+                    candidates[count++] = m_primIndices[node.leftOrFirst + i];
+            }
+            else
+            {
+                stack[top++] = node.leftOrFirst;
+                stack[top++] = node.leftOrFirst + 1;
+            }
+        }
+        if (nodeVisits)
+            *nodeVisits = visits;
+        return count;
+    }
+
+    if (m_wideNodes.empty())
+        return 0;
+
+    int stack[WideStackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        int index = stack[--top];
+        const WideNode &node = m_wideNodes[index];
+        visits++;
+#if defined(__SSE2__)
+        uint32_t hits = IntersectWideNodeSSE(node, origin, invDir, tmin, tmax);
+#else
+        uint32_t hits = IntersectWideNodeScalar(node, origin, invDir, tmin, tmax);
+#endif
+        if (!hits)
+            continue;
+
+        const WideNodeLinks &links = m_wideLinks[index];
+        int rank = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            bool internal = (node.internalMask >> i) & 1u;
+            if ((hits >> i) & 1u)
+            {
+                if (internal)
+                    stack[top++] = links.childBase + rank;
+                else
+                {
+                    const int *prims = &m_widePrimIndices[links.primBase + links.primOffset[i]];
+                    for (int p = 0; p < links.primCount[i]; ++p)
+                        candidates[count++] = prims[p];
+                }
+            }
+            if (internal)
+                rank++;
+        }
+    }
+    if (nodeVisits)
+        *nodeVisits = visits;
+    return count;
+}
+
+int BVH::NodeCount() const
+{
+    return m_compressed ? (int)m_wideNodes.size() : (int)m_nodes.size();
+}
+
+size_t BVH::MemoryUsage() const
+{
+    if (m_compressed)
+        return m_wideNodes.size() * sizeof(WideNode)
+             + m_wideLinks.size() * sizeof(WideNodeLinks)
+             + m_widePrimIndices.size() * sizeof(int);
+    return m_nodes.size() * sizeof(BVHNode) + m_primIndices.size() * sizeof(int);
+}
+
+// --------------------------------------------------------------------------
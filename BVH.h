@@ -0,0 +1,229 @@
+// ==========================================================================
+// Bounding Volume Hierarchy Support Code
+//  - binary hierarchy built over primitive bounding boxes with a binned
+//    surface area heuristic (SAH)
+//  - optional compressed 8-wide layout whose child bounds are quantized to
+//    8 bits relative to the parent, one 64-byte cache line per node
+//
+// The hierarchy only knows about boxes; the caller owns the primitives and
+// runs the exact intersection test on the candidates a query returns.
+// ==========================================================================
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <glm/vec3.hpp>
+
+// --------------------------------------------------------------------------
+// Minimal allocator for over-aligned element types: std::allocator only
+// honours alignas() beyond the default from C++17 onwards.
+
+template <class T, size_t Alignment>
+struct AlignedAllocator
+{
+    typedef T value_type;
+    template <class U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() {}
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t n)
+    {
+        void *p = 0;
+#ifdef _WIN32
+        p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+        if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+            p = 0;
+#endif
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+
+    template <class U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <class U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+// --------------------------------------------------------------------------
+// Axis aligned bounding box
+
+struct AABB
+{
+    glm::vec3 lower;
+    glm::vec3 upper;
+
+    AABB();
+    AABB(const glm::vec3 &lo, const glm::vec3 &hi) : lower(lo), upper(hi) {}
+
+    void Grow(const glm::vec3 &p);
+    void Grow(const AABB &box);
+    float SurfaceArea() const;
+    glm::vec3 Centre() const { return 0.5f * (lower + upper); }
+};
+
+// --------------------------------------------------------------------------
+// Node layouts
+
+// binary node: an internal node stores the index of its left child (the
+// right child immediately follows it), a leaf stores its primitive range
+struct BVHNode
+{
+    glm::vec3 lower;
+    int32_t   leftOrFirst;
+    glm::vec3 upper;
+    int32_t   count;        // 0 for internal nodes
+
+    bool IsLeaf() const { return count > 0; }
+};
+
+// compressed 8-wide node: the child boxes are stored as 8-bit offsets from
+// origin on a per-axis power of two grid, so every child box decodes to
+// origin + q * 2^exponent and always encloses the exact box it came from.
+// Empty slots hold an inverted box (lower 255, upper 0) that never hits.
+struct alignas(64) WideNode
+{
+    float   origin[3];
+    int8_t  exponent[3];
+    uint8_t internalMask;   // bit i set when child i is another WideNode
+
+    uint8_t lowerX[8], lowerY[8], lowerZ[8];
+    uint8_t upperX[8], upperY[8], upperZ[8];
+};
+
+// cold data for a WideNode, only touched once a child is known to be hit:
+// internal children are stored contiguously from childBase in slot order,
+// leaf child i owns primCount[i] entries starting at primBase + primOffset[i]
+struct WideNodeLinks
+{
+    uint32_t childBase;
+    uint32_t primBase;
+    uint8_t  primOffset[8];
+    uint8_t  primCount[8];
+};
+
+// --------------------------------------------------------------------------
+// Ways of building the binary hierarchy:
+//  - binned SAH gives the best trees, binning and subtrees run in parallel
+//  - Morton sorts primitive centres along a Z-order curve and splits on the
+//    code bits (an LBVH); much faster to build, somewhat slower to traverse
+
+enum BVHBuildMethod
+{
+    BuildBinnedSAH,
+    BuildMorton
+};
+
+class ThreadPool;
+
+// --------------------------------------------------------------------------
+// This class builds a hierarchy over a set of primitive boxes and answers
+// "which primitives might this ray cross" queries.
+
+class BVH
+{
+    // binary layout, used for building and for traversal until compressed
+    std::vector<BVHNode> m_nodes;
+    std::vector<int>     m_primIndices;
+
+    // compressed layout, filled by Compress()
+    std::vector<WideNode, AlignedAllocator<WideNode, 64> > m_wideNodes;
+    std::vector<WideNodeLinks> m_wideLinks;
+    std::vector<int> m_widePrimIndices;
+
+    int   m_primCount;
+    bool  m_compressed;
+    float m_referenceCost;  // SAH cost right after the last full build
+
+    struct BuildContext;
+    void Subdivide(BuildContext &context, int nodeIndex, int depth);
+    std::vector<uint32_t> MortonSort(BuildContext &context);
+    void EmitMorton(BuildContext &context, const std::vector<uint32_t> &codes,
+                    int nodeIndex);
+    int  AllocateChildren(BuildContext &context);
+    void UpdateBounds(int nodeIndex, const std::vector<AABB> &boxes);
+    void CollapseNode(int binaryIndex, int wideIndex);
+    void QuantizeNode(WideNode &node, const AABB *childBoxes, int childCount);
+    AABB RefitWideNode(const std::vector<AABB> &boxes, int wideIndex);
+
+public:
+    // primitives per leaf the builder aims for
+    static const int MaxLeafSize = 4;
+
+    BVH();
+
+    // builds the binary hierarchy over the given primitive boxes, discarding
+    // any previous contents (including a compressed layout); with a pool the
+    // work is spread over its threads, otherwise it runs on the caller's
+    void Build(const std::vector<AABB> &boxes, ThreadPool *pool = 0,
+               BVHBuildMethod method = BuildBinnedSAH);
+
+    // converts the binary hierarchy into the 8-wide quantized layout and
+    // releases the binary nodes
+    void Compress();
+    bool IsCompressed() const { return m_compressed; }
+
+    // recomputes every node box bottom-up from moved primitive boxes while
+    // keeping the tree topology; boxes must describe the same primitives
+    void Refit(const std::vector<AABB> &boxes, ThreadPool *pool = 0);
+
+    // refits when the primitive count is unchanged and falls back to a full
+    // rebuild (in the current layout) when that is not possible or when the
+    // SAH cost grew past rebuildThreshold times its value after the last
+    // build; returns true if the hierarchy was rebuilt
+    bool Update(const std::vector<AABB> &boxes, float rebuildThreshold,
+                ThreadPool *pool = 0, BVHBuildMethod method = BuildBinnedSAH);
+
+    // expected cost of tracing a random ray, normalized by the root area
+    float SAHCost() const;
+
+    // appends to candidates the index of every primitive whose box the
+    // ray origin + t*direction crosses for some t in [tmin, tmax]; each
+    // index is reported at most once, in no particular order
+    void Candidates(const glm::vec3 &origin, const glm::vec3 &direction,
+                    float tmin, float tmax, std::vector<int> &candidates) const;
+
+    // same query into a caller-owned buffer with room for PrimitiveCount()
+    // indices; returns how many were written. If nodeVisits is given it
+    // receives the number of nodes whose boxes were tested.
+    int Candidates(const glm::vec3 &origin, const glm::vec3 &direction,
+                   float tmin, float tmax, int *candidates, int *nodeVisits = 0) const;
+
+    int    PrimitiveCount() const { return m_primCount; }
+    int    NodeCount() const;
+    size_t MemoryUsage() const;
+};
+
+// --------------------------------------------------------------------------
+// Box tests, exposed so the individual kernels can be exercised on their
+// own. The ray has reciprocal direction invDir and spans [tmin, tmax].
+
+// slab test of a single box, as the binary traversal runs it
+bool IntersectBox(const glm::vec3 &lower, const glm::vec3 &upper, const glm::vec3 &origin,
+                  const glm::vec3 &invDir, float tmin, float tmax);
+
+// child boxes of a compressed node; each returns a bit mask of the
+// children hit
+
+uint32_t IntersectWideNodeScalar(const WideNode &node, const glm::vec3 &origin,
+                                 const glm::vec3 &invDir, float tmin, float tmax);
+#if defined(__SSE2__)
+uint32_t IntersectWideNodeSSE(const WideNode &node, const glm::vec3 &origin,
+                              const glm::vec3 &invDir, float tmin, float tmax);
+#endif
+
+// --------------------------------------------------------------------------
+#endif // BVH_H
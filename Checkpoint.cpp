@@ -0,0 +1,170 @@
+// ==========================================================================
+// Render Checkpoint Support Code
+// ==========================================================================
+
+#include "Checkpoint.h"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    const char CheckpointMagic[8] = { 'R', 'T', 'C', 'H', 'E', 'C', 'K', 0 };
+    const uint32_t CheckpointVersion = 1;
+    const uint32_t MaxRecordFloats = 1u << 28;
+
+    struct CheckpointHeader
+    {
+        char     magic[8];          // "RTCHECK" and a zero
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t signature;         // of the scene and render settings
+    };
+
+    struct TileRecord
+    {
+        uint32_t tile;
+        uint32_t count;             // floats that follow
+        uint64_t checksum;          // of the tile number, count and floats
+    };
+
+    uint64_t RecordChecksum(uint32_t tile, uint32_t count, const float *values)
+    {
+        uint64_t hash = HashBytes(&tile, sizeof(tile));
+        hash = HashBytes(&count, sizeof(count), hash);
+        return HashBytes(values, count * sizeof(float), hash);
+    }
+
+    // passes the valid records of an existing checkpoint to restore and
+    // returns the length of the file they take up, or 0 if the file is
+    // missing or for another render
+    long ReadRecords(FILE *file, uint64_t signature, const TileCheckpoint::RestoreTile &restore,
+                     int &restored)
+    {
+        CheckpointHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1
+            || memcmp(header.magic, CheckpointMagic, sizeof(header.magic)) != 0
+            || header.version != CheckpointVersion || header.signature != signature)
+            return 0;
+
+        long end = ftell(file);
+        TileRecord record;
+        vector<float> values;
+        while (fread(&record, sizeof(record), 1, file) == 1 && record.count <= MaxRecordFloats)
+        {
+            values.resize(record.count);
+            if (fread(values.data(), sizeof(float), record.count, file) != record.count
+                || RecordChecksum(record.tile, record.count, values.data()) != record.checksum
+                || !restore((int)record.tile, values.data(), record.count))
+                break;
+            end = ftell(file);
+            restored++;
+        }
+        return end;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+TileCheckpoint::TileCheckpoint()
+    : m_file(0)
+{
+}
+
+TileCheckpoint::~TileCheckpoint()
+{
+    if (m_file)
+        fclose(m_file);
+}
+
+bool TileCheckpoint::Open(const string &fileName, uint64_t signature, bool resume,
+                          const RestoreTile &restore)
+{
+    if (m_file)
+        fclose(m_file);
+    m_fileName = fileName;
+
+    // a resumed checkpoint is cut back to its last good record and
+    // continued from there
+    m_file = resume ? fopen(fileName.c_str(), "r+b") : 0;
+    if (m_file)
+    {
+        int restored = 0;
+        long end = ReadRecords(m_file, signature, restore, restored);
+#ifndef _WIN32
+        if (end > 0 && ftruncate(fileno(m_file), end) != 0)
+            end = 0;
+#endif
+        if (end > 0 && fseek(m_file, end, SEEK_SET) == 0)
+        {
+            cout << "resuming from " << fileName << ": " << restored << " tiles already done" << endl;
+            return true;
+        }
+        cout << fileName << " belongs to another render, starting over" << endl;
+        fclose(m_file);
+    }
+
+    m_file = fopen(fileName.c_str(), "wb");
+    if (!m_file)
+    {
+        cout << "ERROR: Could not write checkpoint " << fileName << endl;
+        return false;
+    }
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CheckpointMagic, sizeof(header.magic));
+    header.version = CheckpointVersion;
+    header.signature = signature;
+    return fwrite(&header, sizeof(header), 1, m_file) == 1 && Sync();
+}
+
+bool TileCheckpoint::Append(int tile, const float *values, size_t count)
+{
+    if (!m_file)
+        return false;
+    TileRecord record;
+    record.tile = (uint32_t)tile;
+    record.count = (uint32_t)count;
+    record.checksum = RecordChecksum(record.tile, record.count, values);
+    return fwrite(&record, sizeof(record), 1, m_file) == 1
+        && fwrite(values, sizeof(float), count, m_file) == count;
+}
+
+bool TileCheckpoint::Sync()
+{
+    if (!m_file || fflush(m_file) != 0)
+        return false;
+#ifndef _WIN32
+    return fsync(fileno(m_file)) == 0;
+#else
+    return true;
+#endif
+}
+
+void TileCheckpoint::Remove()
+{
+    if (!m_file)
+        return;
+    fclose(m_file);
+    m_file = 0;
+    remove(m_fileName.c_str());
+}
+
+// --------------------------------------------------------------------------
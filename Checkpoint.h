@@ -0,0 +1,66 @@
+// ==========================================================================
+// Render Checkpoint Support Code
+//  - keeps the finished tiles of a render on disk, so one that was
+//    preempted or crashed can continue where it stopped
+//  - the file is a header followed by one record per finished tile; new
+//    tiles are only ever appended, so saving costs what the new tiles take
+//    and never rewrites the ones already saved
+//  - every record carries a checksum; a record cut short or damaged by a
+//    crash while it was written is dropped on resume, with all after it
+//  - the header holds a signature of the scene and settings, and a render
+//    resumed with anything different starts over instead of mixing images
+//
+// The farm coordinator saves the colours of its tiles, raytrace the colour,
+// AOVs and costs of each framebuffer tile (see Framebuffer::SaveTile). Both
+// are all the state a finished tile has: the fixed shading uses no random
+// numbers, and the path tracer seeds each pixel from its position, so its
+// sample count, which is in the signature, says the rest. Records are in
+// the host's byte order.
+// ==========================================================================
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <functional>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a of size bytes, continuing from hash
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+class TileCheckpoint
+{
+    std::FILE  *m_file;
+    std::string m_fileName;
+
+    TileCheckpoint(const TileCheckpoint &);
+    TileCheckpoint &operator=(const TileCheckpoint &);
+
+public:
+    // receives a saved tile: its number and its values; returns false if
+    // the tile does not fit the render, which stops the loading there
+    typedef std::function<bool(int tile, const float *values, size_t count)> RestoreTile;
+
+    TileCheckpoint();
+    ~TileCheckpoint();
+
+    // opens fileName for the render identified by signature. If resume is
+    // set and the file belongs to the same render, every tile saved in it
+    // is passed to restore and later tiles are added after them; otherwise
+    // the file is started afresh. Returns false if it cannot be written.
+    bool Open(const std::string &fileName, uint64_t signature, bool resume,
+              const RestoreTile &restore);
+
+    // adds a finished tile; it is buffered until the next Sync
+    bool Append(int tile, const float *values, size_t count);
+
+    // makes sure everything appended so far is on disk
+    bool Sync();
+
+    // closes and deletes the file, once the render it belongs to is saved
+    void Remove();
+};
+
+// --------------------------------------------------------------------------
+#endif // CHECKPOINT_H
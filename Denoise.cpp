@@ -0,0 +1,307 @@
+// ==========================================================================
+// Denoising Support Code
+// ==========================================================================
+
+#include "Denoise.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    enum Plane
+    {
+        ColourR, ColourG, ColourB,          // two sets, read and written in turn
+        OtherR, OtherG, OtherB,
+        DepthPlane,
+        NormalX, NormalY, NormalZ,
+        AlbedoR, AlbedoG, AlbedoB,
+        MaskPlane,                          // 1 inside the image, 0 in the padding
+        PlaneCount
+    };
+
+    const float B3Spline[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+
+    // albedo channels darker than this are not divided out, so black
+    // surfaces and the background keep their colour as it is
+    const float MinAlbedo = 0.01f;
+    const float MinDepth = 0.001f;
+    const float MinWeight = 1e-30f;
+
+    float AlbedoDivisor(float albedo)
+    {
+        return albedo > MinAlbedo ? albedo : 1.0f;
+    }
+
+    // e^-x for x >= 0 as 2^t, the integer part of t going straight into the
+    // exponent bits and the fraction through a cubic; within 1e-4 of the
+    // real thing, which is plenty for a weight. The SSE version does the
+    // same operations in the same order, so both give the same bits.
+    const float Log2E = 1.44269504f;
+
+    float FastExpNeg(float x)
+    {
+        float t = max(x * -Log2E, -126.0f);
+        int i = (int)t;
+        if ((float)i > t)
+            i--;
+        float f = t - (float)i;
+        float p = 1.0f + f * (0.69583354f + f * (0.22606716f + f * 0.078024523f));
+        uint32_t bits = (uint32_t)(i + 127) << 23;
+        float scale;
+        memcpy(&scale, &bits, sizeof(scale));
+        return p * scale;
+    }
+
+    // one pass of the filter; all pointers are to pixel (0, 0) of a plane
+    struct FilterPass
+    {
+        const float *colour[3];
+        float       *output[3];
+        const float *depth;
+        const float *normal[3];
+        const float *albedo[3];
+        const float *mask;
+        int          width;
+        int          height;
+        int          stride;
+        int          step;          // between taps, in pixels
+        float        invColour;     // 1 / sigma^2 for this pass
+        float        invNormal;
+        float        invDepth;      // 1 / (sigma * step), still to be divided by the depth
+        float        invAlbedo;
+    };
+
+    void FilterPixel(const FilterPass &p, int x, int y)
+    {
+        size_t c = (size_t)y * p.stride + x;
+        float cr = p.colour[0][c], cg = p.colour[1][c], cb = p.colour[2][c];
+        float nx = p.normal[0][c], ny = p.normal[1][c], nz = p.normal[2][c];
+        float ar = p.albedo[0][c], ag = p.albedo[1][c], ab = p.albedo[2][c];
+        float z = p.depth[c];
+        float depthScale = p.invDepth / max(z, MinDepth);
+
+        float sumR = 0.0f, sumG = 0.0f, sumB = 0.0f, sumW = 0.0f;
+        for (int ky = 0; ky < 5; ky++)
+        {
+            int yy = y + (ky - 2) * p.step;
+            if (yy < 0 || yy >= p.height)
+                continue;
+            for (int kx = 0; kx < 5; kx++)
+            {
+                ptrdiff_t q = (ptrdiff_t)yy * p.stride + x + (kx - 2) * p.step;
+                float dr = p.colour[0][q] - cr, dg = p.colour[1][q] - cg, db = p.colour[2][q] - cb;
+                float dnx = p.normal[0][q] - nx, dny = p.normal[1][q] - ny, dnz = p.normal[2][q] - nz;
+                float dar = p.albedo[0][q] - ar, dag = p.albedo[1][q] - ag, dab = p.albedo[2][q] - ab;
+                float dz = p.depth[q] - z;
+                dz = dz < 0.0f ? -dz : dz;
+
+                float d = (dr * dr + dg * dg + db * db) * p.invColour
+                        + (dnx * dnx + dny * dny + dnz * dnz) * p.invNormal
+                        + dz * depthScale
+                        + (dar * dar + dag * dag + dab * dab) * p.invAlbedo;
+                float w = B3Spline[ky] * B3Spline[kx] * p.mask[q] * FastExpNeg(d);
+                sumR += w * p.colour[0][q];
+                sumG += w * p.colour[1][q];
+                sumB += w * p.colour[2][q];
+                sumW += w;
+            }
+        }
+        sumW = max(sumW, MinWeight);
+        p.output[0][c] = sumR / sumW;
+        p.output[1][c] = sumG / sumW;
+        p.output[2][c] = sumB / sumW;
+    }
+
+#if defined(__SSE2__)
+    __m128 FastExpNeg4(__m128 x)
+    {
+        __m128 t = _mm_max_ps(_mm_mul_ps(x, _mm_set1_ps(-Log2E)), _mm_set1_ps(-126.0f));
+        __m128i i = _mm_cvttps_epi32(t);
+        // truncation rounds the negative t up; step back where it did
+        __m128 above = _mm_cmpgt_ps(_mm_cvtepi32_ps(i), t);
+        i = _mm_add_epi32(i, _mm_castps_si128(above));
+        __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+        __m128 p = _mm_add_ps(_mm_set1_ps(0.22606716f), _mm_mul_ps(f, _mm_set1_ps(0.078024523f)));
+        p = _mm_add_ps(_mm_set1_ps(0.69583354f), _mm_mul_ps(f, p));
+        p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(f, p));
+        __m128i bits = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+        return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+    }
+
+    __m128 Square(__m128 a)
+    {
+        return _mm_mul_ps(a, a);
+    }
+
+    // pixels x to x + 3 of row y; those past the width land in the padding
+    void FilterPixels4(const FilterPass &p, int x, int y)
+    {
+        size_t c = (size_t)y * p.stride + x;
+        __m128 cr = _mm_loadu_ps(p.colour[0] + c), cg = _mm_loadu_ps(p.colour[1] + c);
+        __m128 cb = _mm_loadu_ps(p.colour[2] + c);
+        __m128 nx = _mm_loadu_ps(p.normal[0] + c), ny = _mm_loadu_ps(p.normal[1] + c);
+        __m128 nz = _mm_loadu_ps(p.normal[2] + c);
+        __m128 ar = _mm_loadu_ps(p.albedo[0] + c), ag = _mm_loadu_ps(p.albedo[1] + c);
+        __m128 ab = _mm_loadu_ps(p.albedo[2] + c);
+        __m128 z = _mm_loadu_ps(p.depth + c);
+        __m128 depthScale = _mm_div_ps(_mm_set1_ps(p.invDepth), _mm_max_ps(z, _mm_set1_ps(MinDepth)));
+        __m128 invColour = _mm_set1_ps(p.invColour), invNormal = _mm_set1_ps(p.invNormal);
+        __m128 invAlbedo = _mm_set1_ps(p.invAlbedo);
+        __m128 signBit = _mm_set1_ps(-0.0f);
+
+        __m128 sumR = _mm_setzero_ps(), sumG = _mm_setzero_ps(), sumB = _mm_setzero_ps();
+        __m128 sumW = _mm_setzero_ps();
+        for (int ky = 0; ky < 5; ky++)
+        {
+            int yy = y + (ky - 2) * p.step;
+            if (yy < 0 || yy >= p.height)
+                continue;
+            for (int kx = 0; kx < 5; kx++)
+            {
+                ptrdiff_t q = (ptrdiff_t)yy * p.stride + x + (kx - 2) * p.step;
+                __m128 qr = _mm_loadu_ps(p.colour[0] + q), qg = _mm_loadu_ps(p.colour[1] + q);
+                __m128 qb = _mm_loadu_ps(p.colour[2] + q);
+                __m128 colour = _mm_add_ps(_mm_add_ps(Square(_mm_sub_ps(qr, cr)), Square(_mm_sub_ps(qg, cg))),
+                                           Square(_mm_sub_ps(qb, cb)));
+                __m128 normal = _mm_add_ps(_mm_add_ps(Square(_mm_sub_ps(_mm_loadu_ps(p.normal[0] + q), nx)),
+                                                      Square(_mm_sub_ps(_mm_loadu_ps(p.normal[1] + q), ny))),
+                                           Square(_mm_sub_ps(_mm_loadu_ps(p.normal[2] + q), nz)));
+                __m128 albedo = _mm_add_ps(_mm_add_ps(Square(_mm_sub_ps(_mm_loadu_ps(p.albedo[0] + q), ar)),
+                                                      Square(_mm_sub_ps(_mm_loadu_ps(p.albedo[1] + q), ag))),
+                                           Square(_mm_sub_ps(_mm_loadu_ps(p.albedo[2] + q), ab)));
+                __m128 dz = _mm_andnot_ps(signBit, _mm_sub_ps(_mm_loadu_ps(p.depth + q), z));
+
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(colour, invColour),
+                                                            _mm_mul_ps(normal, invNormal)),
+                                                 _mm_mul_ps(dz, depthScale)),
+                                      _mm_mul_ps(albedo, invAlbedo));
+                __m128 w = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(B3Spline[ky] * B3Spline[kx]),
+                                                 _mm_loadu_ps(p.mask + q)),
+                                      FastExpNeg4(d));
+                sumR = _mm_add_ps(sumR, _mm_mul_ps(w, qr));
+                sumG = _mm_add_ps(sumG, _mm_mul_ps(w, qg));
+                sumB = _mm_add_ps(sumB, _mm_mul_ps(w, qb));
+                sumW = _mm_add_ps(sumW, w);
+            }
+        }
+        sumW = _mm_max_ps(sumW, _mm_set1_ps(MinWeight));
+        _mm_storeu_ps(p.output[0] + c, _mm_div_ps(sumR, sumW));
+        _mm_storeu_ps(p.output[1] + c, _mm_div_ps(sumG, sumW));
+        _mm_storeu_ps(p.output[2] + c, _mm_div_ps(sumB, sumW));
+    }
+#endif
+}
+
+// --------------------------------------------------------------------------
+
+void Denoiser::Run(int width, int height, const glm::vec3 *colour, const float *guides,
+                   const DenoiseSettings &settings, glm::vec3 *output, ThreadPool *pool)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    // the widest pass reaches 2^iterations pixels to either side, and the
+    // last group of four may start three pixels before the width
+    int iterations = max(settings.iterations, 1);
+    int pad = ((1 << iterations) + 3 + 3) & ~3;
+    int stride = ((width + 3) & ~3) + 2 * pad;
+    size_t planeSize = (size_t)stride * height;
+    if (m_stride != stride || m_planes.size() != planeSize * PlaneCount)
+    {
+        // the padding keeps a zero mask, only the pixels are written below
+        m_stride = stride;
+        m_planes.assign(planeSize * PlaneCount, 0.0f);
+    }
+    float *planes[PlaneCount];
+    for (int n = 0; n < PlaneCount; n++)
+        planes[n] = &m_planes[n * planeSize] + pad;
+
+    // into planes, with the albedo divided out of the colour
+    ThreadPool::ParallelFor(pool, 0, height, 8, [&](int first, int last) {
+        for (int y = first; y < last; y++)
+            for (int x = 0; x < width; x++)
+            {
+                size_t i = (size_t)y * width + x;
+                size_t c = (size_t)y * stride + x;
+                const float *g = guides + i * DenoiseGuideChannels;
+                planes[DepthPlane][c] = g[0];
+                planes[NormalX][c] = g[1];
+                planes[NormalY][c] = g[2];
+                planes[NormalZ][c] = g[3];
+                planes[AlbedoR][c] = g[4];
+                planes[AlbedoG][c] = g[5];
+                planes[AlbedoB][c] = g[6];
+                planes[MaskPlane][c] = 1.0f;
+                planes[ColourR][c] = colour[i].x / AlbedoDivisor(g[4]);
+                planes[ColourG][c] = colour[i].y / AlbedoDivisor(g[5]);
+                planes[ColourB][c] = colour[i].z / AlbedoDivisor(g[6]);
+            }
+    });
+
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        int from = iteration % 2 == 0 ? ColourR : OtherR;
+        int to = iteration % 2 == 0 ? OtherR : ColourR;
+        FilterPass pass;
+        for (int k = 0; k < 3; k++)
+        {
+            pass.colour[k] = planes[from + k];
+            pass.output[k] = planes[to + k];
+            pass.normal[k] = planes[NormalX + k];
+            pass.albedo[k] = planes[AlbedoR + k];
+        }
+        pass.depth = planes[DepthPlane];
+        pass.mask = planes[MaskPlane];
+        pass.width = width;
+        pass.height = height;
+        pass.stride = stride;
+        pass.step = 1 << iteration;
+        float colourSigma = settings.colourSigma / (float)pass.step;
+        pass.invColour = 1.0f / (colourSigma * colourSigma);
+        pass.invNormal = 1.0f / (settings.normalSigma * settings.normalSigma);
+        pass.invDepth = 1.0f / (settings.depthSigma * (float)pass.step);
+        pass.invAlbedo = 1.0f / (settings.albedoSigma * settings.albedoSigma);
+
+        ThreadPool::ParallelFor(pool, 0, height, 4, [&](int first, int last) {
+            for (int y = first; y < last; y++)
+            {
+                int x = 0;
+#if defined(__SSE2__)
+                for (; x < width; x += 4)
+                    FilterPixels4(pass, x, y);
+#endif
+                for (; x < width; x++)
+                    FilterPixel(pass, x, y);
+            }
+        });
+    }
+
+    // and back, with the albedo multiplied in again
+    int result = iterations % 2 == 0 ? ColourR : OtherR;
+    ThreadPool::ParallelFor(pool, 0, height, 8, [&](int first, int last) {
+        for (int y = first; y < last; y++)
+            for (int x = 0; x < width; x++)
+            {
+                size_t i = (size_t)y * width + x;
+                size_t c = (size_t)y * stride + x;
+                const float *g = guides + i * DenoiseGuideChannels;
+                output[i] = glm::vec3(planes[result][c] * AlbedoDivisor(g[4]),
+                                      planes[result + 1][c] * AlbedoDivisor(g[5]),
+                                      planes[result + 2][c] * AlbedoDivisor(g[6]));
+            }
+    });
+}
+
+// --------------------------------------------------------------------------
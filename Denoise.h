@@ -0,0 +1,64 @@
+// ==========================================================================
+// Denoising Support Code
+//  - an edge-aware a-trous wavelet filter (Dammertz et al., "Edge-Avoiding
+//    A-Trous Wavelet Transform for fast Global Illumination Filtering"):
+//    a 5x5 B3-spline kernel applied a few times with its taps spread
+//    1, 2, 4, ... pixels apart, so a wide blur costs 25 taps per pass
+//  - each tap is weighted down by how much it differs from the centre in
+//    colour, depth, normal and albedo, so edges and texture survive while
+//    noise on flat surfaces is averaged away
+//  - colours are divided by the albedo before filtering and multiplied by
+//    it again afterwards, so only lighting is blurred
+//  - rows are spread over the pool, and four pixels of a row are filtered
+//    at a time with SSE where available
+//
+// The guides are the AOVs of the same render, packed the way
+// Framebuffer::CopyAovsRowMajor packs DenoiseAovs.
+// ==========================================================================
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <vector>
+#include <glm/vec3.hpp>
+#include "Raytracer.h"
+
+class ThreadPool;
+
+// the AOVs the filter is guided by: per pixel Z, N.X, N.Y, N.Z, A.R, A.G, A.B
+const int DenoiseAovs = AovDepth | AovNormal | AovAlbedo;
+const int DenoiseGuideChannels = 7;
+
+struct DenoiseSettings
+{
+    int   iterations;       // passes, each reaching twice as far
+    float colourSigma;      // of the albedo-divided colour, halved each pass
+    float normalSigma;      // of the distance between unit normals
+    float depthSigma;       // relative to the centre's depth, per pixel of reach
+    float albedoSigma;
+
+    DenoiseSettings()
+        : iterations(5), colourSigma(1.0f), normalSigma(0.3f), depthSigma(0.02f),
+          albedoSigma(0.1f) {}
+};
+
+class Denoiser
+{
+    // planes of one channel each, rows padded on both sides so taps past
+    // the left and right edges need no checks; kept between frames
+    std::vector<float> m_planes;
+    int m_stride;
+
+    Denoiser(const Denoiser &);
+    Denoiser &operator=(const Denoiser &);
+
+public:
+    Denoiser() : m_stride(0) {}
+
+    // filters colour (row-major, width x height) guided by guides and
+    // writes the result to output, which may be colour itself
+    void Run(int width, int height, const glm::vec3 *colour, const float *guides,
+             const DenoiseSettings &settings, glm::vec3 *output, ThreadPool *pool);
+};
+
+// --------------------------------------------------------------------------
+#endif // DENOISE_H
@@ -0,0 +1,189 @@
+// ==========================================================================
+// Environment Light Support Code
+// ==========================================================================
+
+#include "Environment.h"
+#include "ImageFile.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    const float Pi = 3.14159265f;
+
+    // directions this close to a pole have next to no solid angle and are
+    // never drawn
+    const float MinCosLatitude = 1e-6f;
+}
+
+// --------------------------------------------------------------------------
+
+Environment::Environment()
+    : m_width(0), m_height(0)
+{
+}
+
+// Vose's method: slots below the mean are topped up from one above it,
+// which keeps every slot to at most two outcomes
+void Environment::BuildAliasTable(const double *weights, int count, AliasSlot *table)
+{
+    double total = 0.0;
+    for (int i = 0; i < count; i++)
+        total += weights[i];
+
+    vector<double> scaled(count);
+    vector<int> small, large;
+    for (int i = 0; i < count; i++)
+    {
+        scaled[i] = total > 0.0 ? weights[i] * count / total : 1.0;
+        if (scaled[i] < 1.0)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+    while (!small.empty() && !large.empty())
+    {
+        int less = small.back();
+        int more = large.back();
+        small.pop_back();
+        table[less].probability = (float)scaled[less];
+        table[less].alias = more;
+        scaled[more] -= 1.0 - scaled[less];
+        if (scaled[more] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+    // what is left is full, up to rounding
+    large.insert(large.end(), small.begin(), small.end());
+    for (size_t i = 0; i < large.size(); i++)
+    {
+        table[large[i]].probability = 1.0f;
+        table[large[i]].alias = large[i];
+    }
+}
+
+// the whole part of u * count picks the slot and the fraction decides
+// between it and its alias
+int Environment::SampleAliasTable(const AliasSlot *table, int count, float u)
+{
+    float scaled = u * count;
+    int slot = min((int)scaled, count - 1);
+    return scaled - slot < table[slot].probability ? slot : table[slot].alias;
+}
+
+bool Environment::Load(const string &fileName)
+{
+    if (fileName == m_fileName && (Loaded() || fileName.empty()))
+        return true;
+    m_fileName = fileName;
+    m_radiance.clear();
+    m_probability.clear();
+    m_rows.clear();
+    m_columns.clear();
+    if (fileName.empty())
+        return true;
+    if (!ReadImageFloat(fileName, m_width, m_height, m_radiance))
+    {
+        m_radiance.clear();
+        return false;
+    }
+
+    // each texel weighs its luminance times the solid angle it covers,
+    // which shrinks with the cosine of its latitude
+    vector<double> weights((size_t)m_width * m_height);
+    vector<double> rowWeights(m_height);
+    double total = 0.0;
+    for (int y = 0; y < m_height; y++)
+    {
+        double cosLatitude = cos(((y + 0.5) / m_height - 0.5) * Pi);
+        rowWeights[y] = 0.0;
+        for (int x = 0; x < m_width; x++)
+        {
+            const float *rgb = &m_radiance[((size_t)y * m_width + x) * 3];
+            double luminance = 0.2126 * rgb[0] + 0.7152 * rgb[1] + 0.0722 * rgb[2];
+            double &weight = weights[(size_t)y * m_width + x];
+            weight = max(luminance, 0.0) * cosLatitude;
+            rowWeights[y] += weight;
+        }
+        total += rowWeights[y];
+    }
+    cout << "environment " << fileName << " (" << m_width << "x" << m_height << ")" << endl;
+    if (total <= 0.0)
+        return true;    // black, shown but never sampled
+
+    m_probability.resize(weights.size());
+    for (size_t i = 0; i < weights.size(); i++)
+        m_probability[i] = (float)(weights[i] / total);
+    m_rows.resize(m_height);
+    BuildAliasTable(rowWeights.data(), m_height, m_rows.data());
+    m_columns.resize(weights.size());
+    for (int y = 0; y < m_height; y++)
+        BuildAliasTable(&weights[(size_t)y * m_width], m_width, &m_columns[(size_t)y * m_width]);
+    return true;
+}
+
+int Environment::Texel(const glm::vec3 &direction, float &cosLatitude) const
+{
+    float sinLatitude = min(max(direction.y, -1.0f), 1.0f);
+    cosLatitude = sqrt(max(1.0f - sinLatitude * sinLatitude, 0.0f));
+    float u = atan2(direction.x, -direction.z) / (2.0f * Pi) + 0.5f;
+    float v = asin(sinLatitude) / Pi + 0.5f;
+    int x = min(max((int)(u * m_width), 0), m_width - 1);
+    int y = min(max((int)(v * m_height), 0), m_height - 1);
+    return y * m_width + x;
+}
+
+glm::vec3 Environment::Radiance(const glm::vec3 &direction) const
+{
+    if (!Loaded())
+        return glm::vec3(0.0f);
+    float cosLatitude;
+    const float *rgb = &m_radiance[(size_t)Texel(direction, cosLatitude) * 3];
+    return glm::vec3(rgb[0], rgb[1], rgb[2]);
+}
+
+// a texel spans 2 pi / width of longitude and pi / height of latitude, so
+// one drawn with probability p is spread over a solid angle of
+// 2 pi^2 cos(latitude) / (width * height)
+float Environment::Pdf(const glm::vec3 &direction) const
+{
+    if (m_probability.empty())
+        return 0.0f;
+    float cosLatitude;
+    int texel = Texel(direction, cosLatitude);
+    if (cosLatitude < MinCosLatitude)
+        return 0.0f;
+    return m_probability[texel] * m_width * m_height / (2.0f * Pi * Pi * cosLatitude);
+}
+
+glm::vec3 Environment::Sample(float u1, float u2, float u3, float u4, glm::vec3 &direction, float &pdf) const
+{
+    pdf = 0.0f;
+    if (m_probability.empty())
+        return glm::vec3(0.0f);
+    int y = SampleAliasTable(m_rows.data(), m_height, u1);
+    int x = SampleAliasTable(&m_columns[(size_t)y * m_width], m_width, u2);
+
+    // anywhere in the texel, evenly in longitude and latitude
+    float longitude = ((x + u3) / m_width - 0.5f) * 2.0f * Pi;
+    float latitude = ((y + u4) / m_height - 0.5f) * Pi;
+    float cosLatitude = cos(latitude);
+    if (cosLatitude < MinCosLatitude)
+        return glm::vec3(0.0f);
+    direction = glm::vec3(cosLatitude * sin(longitude), sin(latitude), -cosLatitude * cos(longitude));
+    int texel = y * m_width + x;
+    pdf = m_probability[texel] * m_width * m_height / (2.0f * Pi * Pi * cosLatitude);
+    const float *rgb = &m_radiance[(size_t)texel * 3];
+    return glm::vec3(rgb[0], rgb[1], rgb[2]);
+}
+
+// --------------------------------------------------------------------------
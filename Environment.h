@@ -0,0 +1,72 @@
+// ==========================================================================
+// Environment Light Support Code
+//  - an image of the light arriving from far away in every direction,
+//    read as floating-point RGB (HDR files keep their full range) and
+//    mapped by longitude and latitude: the middle of the image straight
+//    ahead along -z, its top row straight up
+//  - the path tracer shows it where rays leave the scene and samples it
+//    as a light at every bounce
+//  - directions are drawn in proportion to the light of each texel times
+//    the solid angle it covers, through a two-level alias table (Walker,
+//    built with Vose's method): one table picks a row, then that row's own
+//    table picks a column, so a sample costs the same whatever the size of
+//    the image
+//
+// Radiance is constant across each texel, the same function the samples
+// follow, so the density of any direction is known exactly and light the
+// path tracer reaches both ways can be weighted between them.
+// ==========================================================================
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <vector>
+#include <string>
+#include <glm/vec3.hpp>
+
+// --------------------------------------------------------------------------
+
+class Environment
+{
+    // keep the slot with this probability, otherwise take its alias
+    struct AliasSlot
+    {
+        float probability;
+        int   alias;
+    };
+
+    std::string            m_fileName;
+    int                    m_width;
+    int                    m_height;
+    std::vector<float>     m_radiance;      // RGB, bottom row first
+    std::vector<float>     m_probability;   // of drawing each texel
+    std::vector<AliasSlot> m_rows;
+    std::vector<AliasSlot> m_columns;       // a table per row, one after another
+
+    static void BuildAliasTable(const double *weights, int count, AliasSlot *table);
+    static int SampleAliasTable(const AliasSlot *table, int count, float u);
+
+    int Texel(const glm::vec3 &direction, float &cosLatitude) const;
+
+public:
+    Environment();
+
+    // reads fileName and builds its tables, unless it is the file already
+    // loaded; an empty name leaves no environment. False (after saying why)
+    // if the file cannot be read, leaving no environment as well.
+    bool Load(const std::string &fileName);
+
+    bool Loaded() const { return !m_radiance.empty(); }
+
+    // light arriving from the unit direction
+    glm::vec3 Radiance(const glm::vec3 &direction) const;
+
+    // density, per unit solid angle, with which Sample picks the direction
+    float Pdf(const glm::vec3 &direction) const;
+
+    // picks a direction for four numbers uniform in [0, 1), returning the
+    // light from it and its density, which is 0 if nothing was picked
+    glm::vec3 Sample(float u1, float u2, float u3, float u4, glm::vec3 &direction, float &pdf) const;
+};
+
+// --------------------------------------------------------------------------
+#endif // ENVIRONMENT_H
@@ -0,0 +1,306 @@
+// ==========================================================================
+// Float Image Support Code
+// ==========================================================================
+
+#include "FloatImage.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    const char TiledFloatMagic[8] = { 'R', 'T', 'F', 'L', 'O', 'A', 'T', 0 };
+    const uint32_t TiledFloatVersion = 1;
+    const uint64_t TiledFloatDataOffset = 4096;
+    const uint32_t TiledFloatMaxSide = 65536;     // of an image and of a tile
+
+    bool LittleEndianHost()
+    {
+        const uint32_t one = 1;
+        return *reinterpret_cast<const unsigned char *>(&one) == 1;
+    }
+
+    void SwapBytes(float &value)
+    {
+        unsigned char *b = reinterpret_cast<unsigned char *>(&value);
+        swap(b[0], b[3]);
+        swap(b[1], b[2]);
+    }
+
+    size_t TileFloats(const TiledFloatHeader &header)
+    {
+        return (size_t)header.tileSize * header.tileSize * header.channels;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+bool WritePfm(const string &fileName, int width, int height,
+              const vector<glm::vec3> &pixels)
+{
+    FILE *file = fopen(fileName.c_str(), "wb");
+    if (!file)
+    {
+        cout << "ERROR: Could not write float image " << fileName << endl;
+        return false;
+    }
+
+    // a negative scale marks little-endian data; rows go bottom to top
+    fprintf(file, "PF\n%d %d\n%s\n", width, height, LittleEndianHost() ? "-1.0" : "1.0");
+    size_t count = (size_t)width * height;
+    bool written = fwrite(&pixels[0], sizeof(glm::vec3), count, file) == count;
+    return fclose(file) == 0 && written;
+}
+
+bool ReadPfm(const string &fileName, int &width, int &height,
+             vector<glm::vec3> &pixels)
+{
+    ifstream file(fileName.c_str(), ios::binary);
+    string type;
+    float scale = 0.f;
+    file >> type >> width >> height >> scale;
+    if (!file || (type != "PF" && type != "Pf") || width <= 0 || height <= 0)
+    {
+        cout << "ERROR: " << fileName << " is not a PFM file" << endl;
+        return false;
+    }
+    file.get();     // the single whitespace character ending the header
+
+    int channels = (type == "PF") ? 3 : 1;
+    size_t count = (size_t)width * height;
+    vector<float> values(count * channels);
+    file.read(reinterpret_cast<char *>(&values[0]), values.size() * sizeof(float));
+    if (!file)
+    {
+        cout << "ERROR: " << fileName << " is truncated" << endl;
+        return false;
+    }
+
+    if ((scale < 0.f) != LittleEndianHost())
+        for (size_t i = 0; i < values.size(); ++i)
+            SwapBytes(values[i]);
+
+    pixels.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        pixels[i] = channels == 3 ? glm::vec3(values[3*i], values[3*i+1], values[3*i+2])
+                                  : glm::vec3(values[i]);
+    return true;
+}
+
+// --------------------------------------------------------------------------
+
+bool WriteTiledFloat(const string &fileName, int width, int height,
+                     const vector<string> &channelNames, const float *pixels)
+{
+    int channels = (int)channelNames.size();
+    if (channels < 1 || channels > TiledFloatMaxChannels)
+    {
+        cout << "ERROR: Tiled float images hold 1 to " << TiledFloatMaxChannels
+             << " channels" << endl;
+        return false;
+    }
+
+    TiledFloatHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TiledFloatMagic, sizeof(header.magic));
+    header.version = TiledFloatVersion;
+    header.width = width;
+    header.height = height;
+    header.channels = channels;
+    header.tileSize = TiledFloatTileSize;
+    header.tilesX = (width + TiledFloatTileSize - 1) / TiledFloatTileSize;
+    header.tilesY = (height + TiledFloatTileSize - 1) / TiledFloatTileSize;
+    header.dataOffset = TiledFloatDataOffset;
+    for (int c = 0; c < channels; ++c)
+        strncpy(header.channelNames[c], channelNames[c].c_str(), TiledFloatNameLength - 1);
+
+    FILE *file = fopen(fileName.c_str(), "wb");
+    if (!file)
+    {
+        cout << "ERROR: Could not write float image " << fileName << endl;
+        return false;
+    }
+
+    vector<char> headerBlock(TiledFloatDataOffset, 0);
+    memcpy(&headerBlock[0], &header, sizeof(header));
+    bool written = fwrite(&headerBlock[0], 1, headerBlock.size(), file) == headerBlock.size();
+
+    int tileSize = TiledFloatTileSize;
+    vector<float> tile(TileFloats(header));
+    for (uint32_t ty = 0; ty < header.tilesY && written; ++ty)
+        for (uint32_t tx = 0; tx < header.tilesX && written; ++tx)
+        {
+            fill(tile.begin(), tile.end(), 0.f);
+            for (int y = 0; y < tileSize; ++y)
+            {
+                int py = ty * tileSize + y;
+                int rowLength = min(tileSize, width - (int)tx * tileSize);
+                if (py >= height)
+                    break;
+                const float *source = pixels + ((size_t)py * width + tx * tileSize) * channels;
+                copy(source, source + (size_t)rowLength * channels, &tile[(size_t)y * tileSize * channels]);
+            }
+            written = fwrite(&tile[0], sizeof(float), tile.size(), file) == tile.size();
+        }
+
+    return fclose(file) == 0 && written;
+}
+
+bool WriteTiledFloat(const string &fileName, int width, int height,
+                     const vector<glm::vec3> &pixels)
+{
+    vector<string> names;
+    names.push_back("R");
+    names.push_back("G");
+    names.push_back("B");
+    return WriteTiledFloat(fileName, width, height, names, &pixels[0].x);
+}
+
+// --------------------------------------------------------------------------
+
+TiledFloatImage::TiledFloatImage()
+    : m_data(0), m_size(0), m_mapped(false)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+TiledFloatImage::~TiledFloatImage()
+{
+    Close();
+}
+
+bool TiledFloatImage::Open(const string &fileName)
+{
+    Close();
+
+#ifndef _WIN32
+    int fd = open(fileName.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void *data = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            m_data = static_cast<const char *>(data);
+            m_size = info.st_size;
+            m_mapped = true;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+#endif
+
+    if (!m_mapped)
+    {
+        ifstream file(fileName.c_str(), ios::binary);
+        m_copy.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        m_data = m_copy.empty() ? 0 : &m_copy[0];
+        m_size = m_copy.size();
+    }
+
+    if (m_size < sizeof(TiledFloatHeader))
+    {
+        cout << "ERROR: Could not read float image " << fileName << endl;
+        Close();
+        return false;
+    }
+    memcpy(&m_header, m_data, sizeof(m_header));
+
+    // the tile grid must be the one the image size gives, and all of it in
+    // the file; with the sizes bounded none of this can overflow. A file
+    // written in the other byte order fails on the version.
+    const TiledFloatHeader &h = m_header;
+    bool valid = memcmp(h.magic, TiledFloatMagic, sizeof(h.magic)) == 0
+        && h.version == TiledFloatVersion
+        && h.channels >= 1 && h.channels <= (uint32_t)TiledFloatMaxChannels
+        && h.width >= 1 && h.width <= TiledFloatMaxSide
+        && h.height >= 1 && h.height <= TiledFloatMaxSide
+        && h.tileSize >= 1 && h.tileSize <= TiledFloatMaxSide
+        && h.tilesX == (h.width + h.tileSize - 1) / h.tileSize
+        && h.tilesY == (h.height + h.tileSize - 1) / h.tileSize
+        && h.dataOffset >= sizeof(TiledFloatHeader) && h.dataOffset % sizeof(float) == 0
+        && h.dataOffset <= m_size
+        && (uint64_t)h.tilesX * h.tilesY * TileFloats(h) * sizeof(float) <= m_size - h.dataOffset;
+    if (!valid)
+    {
+        cout << "ERROR: " << fileName << " is not a valid tiled float image" << endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void TiledFloatImage::Close()
+{
+#ifndef _WIN32
+    if (m_mapped)
+        munmap(const_cast<char *>(m_data), m_size);
+#endif
+    vector<char>().swap(m_copy);
+    m_data = 0;
+    m_size = 0;
+    m_mapped = false;
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+string TiledFloatImage::ChannelName(int channel) const
+{
+    const char *name = m_header.channelNames[channel];
+    return string(name, strnlen(name, TiledFloatNameLength));
+}
+
+int TiledFloatImage::FindChannel(const string &name) const
+{
+    for (int c = 0; c < Channels(); ++c)
+        if (ChannelName(c) == name)
+            return c;
+    return -1;
+}
+
+const float *TiledFloatImage::Tile(int tileX, int tileY) const
+{
+    size_t tile = (size_t)tileY * m_header.tilesX + tileX;
+    const char *start = m_data + m_header.dataOffset + tile * TileFloats(m_header) * sizeof(float);
+    return reinterpret_cast<const float *>(start);
+}
+
+float TiledFloatImage::Value(int x, int y, int channel) const
+{
+    int tileSize = TileSize();
+    const float *tile = Tile(x / tileSize, y / tileSize);
+    return tile[((size_t)(y % tileSize) * tileSize + x % tileSize) * Channels() + channel];
+}
+
+void TiledFloatImage::ReadChannels(int firstChannel, int count, vector<float> &pixels) const
+{
+    int width = Width(), height = Height(), tileSize = TileSize(), channels = Channels();
+    pixels.resize((size_t)width * height * count);
+    for (int ty = 0; ty < TilesY(); ++ty)
+        for (int tx = 0; tx < TilesX(); ++tx)
+        {
+            const float *tile = Tile(tx, ty);
+            for (int y = 0; y < tileSize && ty * tileSize + y < height; ++y)
+                for (int x = 0; x < tileSize && tx * tileSize + x < width; ++x)
+                {
+                    const float *source = tile + ((size_t)y * tileSize + x) * channels + firstChannel;
+                    float *target = &pixels[((size_t)(ty * tileSize + y) * width + tx * tileSize + x) * count];
+                    copy(source, source + count, target);
+                }
+        }
+}
+
+// --------------------------------------------------------------------------
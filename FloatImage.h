@@ -0,0 +1,111 @@
+// ==========================================================================
+// Float Image Support Code
+//  - lossless HDR output of rendered frames, before any clamping
+//  - PFM (portable float map) for RGB images other tools can open
+//  - a tiled float container with any number of named channels whose
+//    pixel data starts page aligned, so it can be memory mapped and read
+//    tile by tile without loading the whole file
+//
+// Pixels are passed row-major, bottom row first, channels interleaved,
+// matching the renderer's framebuffer. PFM files say which byte order they
+// are in; tiled float files are in the host's byte order, so that they can
+// be mapped and used as they are, and are only read on machines with the
+// same one.
+// ==========================================================================
+#ifndef FLOATIMAGE_H
+#define FLOATIMAGE_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <glm/vec3.hpp>
+
+// --------------------------------------------------------------------------
+// PFM
+
+bool WritePfm(const std::string &fileName, int width, int height,
+              const std::vector<glm::vec3> &pixels);
+
+// reads a colour ("PF") or greyscale ("Pf") map into RGB pixels
+bool ReadPfm(const std::string &fileName, int &width, int &height,
+             std::vector<glm::vec3> &pixels);
+
+// --------------------------------------------------------------------------
+// Tiled float container
+//
+// A 4096-byte header is followed by the tiles in row-major tile order,
+// bottom row of tiles first. Each tile holds TileSize x TileSize pixels
+// (edge tiles are stored whole) of `channels` floats each.
+
+const int TiledFloatTileSize = 64;
+const int TiledFloatMaxChannels = 32;
+const int TiledFloatNameLength = 16;
+
+struct TiledFloatHeader
+{
+    char     magic[8];          // "RTFLOAT" and a zero
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t tileSize;
+    uint32_t tilesX;
+    uint32_t tilesY;
+    uint32_t reserved;
+    uint64_t dataOffset;        // from the start of the file
+    char     channelNames[TiledFloatMaxChannels][TiledFloatNameLength];
+};
+
+// writes channelNames.size() channels per pixel from pixels
+bool WriteTiledFloat(const std::string &fileName, int width, int height,
+                     const std::vector<std::string> &channelNames,
+                     const float *pixels);
+
+// RGB convenience form of the above
+bool WriteTiledFloat(const std::string &fileName, int width, int height,
+                     const std::vector<glm::vec3> &pixels);
+
+// Read access to a tiled float file, memory mapped where the platform
+// allows it and read into memory otherwise.
+class TiledFloatImage
+{
+    TiledFloatHeader   m_header;
+    const char        *m_data;      // whole file
+    size_t             m_size;
+    std::vector<char>  m_copy;      // file contents when not mapped
+    bool               m_mapped;
+
+    TiledFloatImage(const TiledFloatImage &);
+    TiledFloatImage &operator=(const TiledFloatImage &);
+
+public:
+    TiledFloatImage();
+    ~TiledFloatImage();
+
+    bool Open(const std::string &fileName);
+    void Close();
+
+    int Width() const { return (int)m_header.width; }
+    int Height() const { return (int)m_header.height; }
+    int Channels() const { return (int)m_header.channels; }
+    int TileSize() const { return (int)m_header.tileSize; }
+    int TilesX() const { return (int)m_header.tilesX; }
+    int TilesY() const { return (int)m_header.tilesY; }
+    std::string ChannelName(int channel) const;
+
+    // index of the named channel, or -1
+    int FindChannel(const std::string &name) const;
+
+    // first float of a tile's pixels
+    const float *Tile(int tileX, int tileY) const;
+
+    float Value(int x, int y, int channel) const;
+
+    // copies `count` consecutive channels starting at firstChannel into
+    // pixels, row-major, bottom row first
+    void ReadChannels(int firstChannel, int count, std::vector<float> &pixels) const;
+};
+
+// --------------------------------------------------------------------------
+#endif // FLOATIMAGE_H
@@ -0,0 +1,96 @@
+// ==========================================================================
+// Cost Heatmap Support Code
+// ==========================================================================
+
+#include "Heatmap.h"
+#include "FloatImage.h"
+#include "PngEncoder.h"
+
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    float MetricValue(const PixelCost &cost, CostMetric metric)
+    {
+        if (metric == StepsCost)
+            return cost.steps;
+        if (metric == TimeCost)
+            return cost.nanoseconds;
+        return cost.tests;
+    }
+
+    const char *MetricName(CostMetric metric)
+    {
+        if (metric == StepsCost)
+            return "BVH nodes visited";
+        if (metric == TimeCost)
+            return "nanoseconds";
+        return "intersection tests";
+    }
+
+    // black, blue, cyan, green, yellow, red, white at even steps of x
+    void FalseColour(float x, unsigned char rgb[3])
+    {
+        static const float stops[7][3] = {
+            { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 },
+            { 1, 1, 0 }, { 1, 0, 0 }, { 1, 1, 1 }
+        };
+        x = min(max(x, 0.0f), 1.0f) * 6.0f;
+        int i = min((int)x, 5);
+        float f = x - i;
+        for (int c = 0; c < 3; c++)
+            rgb[c] = (unsigned char)(255.0f * (stops[i][c] + f * (stops[i + 1][c] - stops[i][c])) + 0.5f);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+bool WriteHeatmap(const string &baseName, int width, int height,
+                  const vector<PixelCost> &costs, CostMetric metric)
+{
+    size_t count = (size_t)width * height;
+    if (count == 0 || costs.size() < count)
+        return false;
+
+    // top of the colour scale
+    vector<float> values(count);
+    for (size_t i = 0; i < count; i++)
+        values[i] = MetricValue(costs[i], metric);
+    vector<float> sorted(values);
+    size_t rank = min(count - 1, (size_t)(0.995 * count));
+    nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    float top = max(sorted[rank], 1e-6f);
+    float peak = *max_element(values.begin(), values.end());
+
+    // PNG rows go top first
+    vector<unsigned char> bytes(count * 3);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            FalseColour(values[(size_t)y * width + x] / top,
+                        &bytes[((size_t)(height - 1 - y) * width + x) * 3]);
+
+    string pngName = baseName + "_heat.png";
+    bool written = WritePng(pngName, width, height, &bytes[0], DefaultPngLevel, 0);
+    if (written)
+        cout << "heatmap of " << MetricName(metric) << " per pixel saved to " << pngName
+             << " (white at " << top << ", highest " << peak << ")" << endl;
+
+    // PixelCost is three floats, so the costs are already interleaved
+    vector<string> names;
+    names.push_back("tests");
+    names.push_back("steps");
+    names.push_back("ns");
+    string rawName = baseName + "_heat.rtf";
+    if (WriteTiledFloat(rawName, width, height, names, &costs[0].tests))
+        cout << "raw pixel costs saved to " << rawName << endl;
+    else
+        written = false;
+    return written;
+}
+
+// --------------------------------------------------------------------------
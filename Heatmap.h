@@ -0,0 +1,30 @@
+// ==========================================================================
+// Cost Heatmap Support Code
+//  - turns the per-pixel costs measured while rendering into a false-colour
+//    image of one of them, so expensive geometry stands out at a glance
+//  - also saves the raw costs, all three of them, as a tiled float file
+// ==========================================================================
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <vector>
+#include <string>
+#include "Raytracer.h"
+
+enum CostMetric
+{
+    TestsCost,      // intersection tests of every kind
+    StepsCost,      // BVH nodes visited
+    TimeCost        // nanoseconds
+};
+
+// writes baseName_heat.png, coloured from black through blue, green,
+// yellow and red to white by the chosen cost, and baseName_heat.rtf with
+// the channels tests, steps and ns; costs are row-major, bottom row first.
+// The top of the colour scale is the 99.5th percentile, so a few outliers
+// do not flatten the rest of the image.
+bool WriteHeatmap(const std::string &baseName, int width, int height,
+                  const std::vector<PixelCost> &costs, CostMetric metric);
+
+// --------------------------------------------------------------------------
+#endif // HEATMAP_H
@@ -0,0 +1,56 @@
+// ==========================================================================
+// Image File Support Code
+// ==========================================================================
+
+#include "ImageFile.h"
+
+#include <iostream>
+#include <cstring>
+
+// the one copy of stb_image in the program; tools that link this file
+// call it directly as well
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+bool ReadImageRgb8(const string &fileName, int &width, int &height, vector<unsigned char> &rgb)
+{
+    int components = 0;
+    unsigned char *pixels = stbi_load(fileName.c_str(), &width, &height, &components, 3);
+    if (!pixels)
+    {
+        cout << "ERROR: Could not read image " << fileName << ": " << stbi_failure_reason() << endl;
+        return false;
+    }
+
+    // stb_image starts at the top row
+    size_t rowBytes = (size_t)width * 3;
+    rgb.resize(rowBytes * height);
+    for (int y = 0; y < height; y++)
+        memcpy(&rgb[(size_t)y * rowBytes], pixels + (size_t)(height - 1 - y) * rowBytes, rowBytes);
+    stbi_image_free(pixels);
+    return true;
+}
+
+bool ReadImageFloat(const string &fileName, int &width, int &height, vector<float> &rgb)
+{
+    int components = 0;
+    float *pixels = stbi_loadf(fileName.c_str(), &width, &height, &components, 3);
+    if (!pixels)
+    {
+        cout << "ERROR: Could not read image " << fileName << ": " << stbi_failure_reason() << endl;
+        return false;
+    }
+
+    size_t rowBytes = (size_t)width * 3 * sizeof(float);
+    rgb.resize((size_t)width * height * 3);
+    for (int y = 0; y < height; y++)
+        memcpy(&rgb[(size_t)y * width * 3], (const char *)pixels + (size_t)(height - 1 - y) * rowBytes, rowBytes);
+    stbi_image_free(pixels);
+    return true;
+}
+
+// --------------------------------------------------------------------------
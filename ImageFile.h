@@ -0,0 +1,26 @@
+// ==========================================================================
+// Image File Support Code
+//  - reads PNG, JPEG, TGA, BMP, PSD, GIF, HDR, PIC and PNM files through
+//    the vendored stb_image, for textures and the like
+//
+// Pixels come back row-major, bottom row first, as everywhere else in the
+// renderer.
+// ==========================================================================
+#ifndef IMAGEFILE_H
+#define IMAGEFILE_H
+
+#include <vector>
+#include <string>
+
+// reads fileName as 8-bit RGB, three bytes per pixel, grey and alpha
+// images included; false (after saying why) if it cannot be read
+bool ReadImageRgb8(const std::string &fileName, int &width, int &height,
+                   std::vector<unsigned char> &rgb);
+
+// reads fileName as linear floating-point RGB: HDR files as they are,
+// others through stb_image's 2.2 gamma
+bool ReadImageFloat(const std::string &fileName, int &width, int &height,
+                    std::vector<float> &rgb);
+
+// --------------------------------------------------------------------------
+#endif // IMAGEFILE_H
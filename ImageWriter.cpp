@@ -0,0 +1,191 @@
+// ==========================================================================
+// Image Writer Support Code
+// ==========================================================================
+
+#include "ImageWriter.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include "ToneMap.h"
+#include "FloatImage.h"
+#include "Trace.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+ImageWriter::ImageWriter(int maxPending, ThreadPool *pool, int level)
+    : m_jobs(max(maxPending, 1)), m_head(0), m_count(0), m_pool(pool),
+      m_level(level), m_floatOutput(NoFloatOutput), m_stopping(false), m_failures(0),
+      m_writeTime(0.0)
+{
+    m_thread = thread(&ImageWriter::WriterLoop, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_jobQueued.notify_all();
+    m_thread.join();
+}
+
+void ImageWriter::Submit(const string &fileName, int width, int height,
+                         const vector<glm::vec3> &pixels)
+{
+    static const vector<string> noNames;
+    static const vector<float> noAovs;
+    Submit(fileName, width, height, pixels, noNames, noAovs);
+}
+
+void ImageWriter::Submit(const string &fileName, int width, int height,
+                         const vector<glm::vec3> &pixels,
+                         const vector<string> &aovNames, const vector<float> &aovs)
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_jobDone.wait(lock, [this] { return m_count < (int)m_jobs.size(); });
+
+    // the slot is free, so the writer thread will not look at it until it
+    // has been counted in below
+    Job &job = m_jobs[(m_head + m_count) % m_jobs.size()];
+    job.fileName = fileName;
+    job.width = width;
+    job.height = height;
+    job.pixels.assign(pixels.begin(), pixels.begin() + (size_t)width * height);
+    job.aovNames = aovNames;
+    job.aovs.assign(aovs.begin(), aovs.begin() + (size_t)width * height * aovNames.size());
+    m_count++;
+
+    lock.unlock();
+    m_jobQueued.notify_one();
+}
+
+void ImageWriter::SetFloatOutput(FloatOutput output)
+{
+    // frames already queued may be written either way
+    lock_guard<mutex> lock(m_mutex);
+    m_floatOutput = output;
+}
+
+void ImageWriter::Flush()
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_jobDone.wait(lock, [this] { return m_count == 0; });
+}
+
+int ImageWriter::Failures()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_failures;
+}
+
+double ImageWriter::WriteTime()
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_writeTime;
+}
+
+void ImageWriter::InterleaveChannels(const Job &job)
+{
+    // R, G, B and then the AOVs of each pixel, one pixel after the other
+    size_t count = (size_t)job.width * job.height;
+    size_t aovCount = job.aovNames.size();
+    m_channels.resize(count * (3 + aovCount));
+    float *out = m_channels.data();
+    for (size_t i = 0; i < count; ++i)
+    {
+        *out++ = job.pixels[i].x;
+        *out++ = job.pixels[i].y;
+        *out++ = job.pixels[i].z;
+        out = copy(&job.aovs[i * aovCount], &job.aovs[i * aovCount] + aovCount, out);
+    }
+}
+
+void ImageWriter::WriterLoop()
+{
+    SetTraceThreadName("image writer");
+    for (;;)
+    {
+        Job *job;
+        FloatOutput floatOutput;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_jobQueued.wait(lock, [this] { return m_stopping || m_count > 0; });
+            if (m_count == 0)
+                return;
+            job = &m_jobs[m_head];
+            floatOutput = m_floatOutput;
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        // the head slot stays counted, and so untouched by Submit, until
+        // it has been written; default tone mapping gives the clamped 8-bit
+        // values ImageBuffer::SaveToFile stores
+        m_bytes.resize((size_t)job->width * job->height * 3);
+        {
+            TraceScope toneMapScope("tone map");
+            ToneMapImage(&job->pixels[0].x, job->width, job->height, ToneMapSettings(),
+                         m_bytes.data(), m_pool);
+        }
+        bool written = WritePng(job->fileName, job->width, job->height,
+                                m_bytes.data(), m_level, m_pool);
+        if (written)
+            cout << "ImageWriter saved image to " << job->fileName << endl;
+        else
+            cout << "ImageWriter ERROR: failed to write image " << job->fileName << endl;
+
+        // the unclamped colours, for tone mapping later without rendering,
+        // and the AOVs next to them in the tiled file
+        bool hasAovs = !job->aovNames.empty();
+        int64_t floatStart = TraceClock();
+        if (floatOutput == PfmOutput)
+        {
+            string floatName = job->fileName + ".pfm";
+            bool floatWritten = WritePfm(floatName, job->width, job->height, job->pixels);
+            if (floatWritten)
+                cout << "ImageWriter saved float image to " << floatName << endl;
+            written = written && floatWritten;
+        }
+        if (floatOutput == TiledFloatOutput || hasAovs)
+        {
+            string floatName = job->fileName + ".rtf";
+            bool floatWritten;
+            if (hasAovs)
+            {
+                vector<string> names;
+                names.push_back("R");
+                names.push_back("G");
+                names.push_back("B");
+                names.insert(names.end(), job->aovNames.begin(), job->aovNames.end());
+                InterleaveChannels(*job);
+                floatWritten = WriteTiledFloat(floatName, job->width, job->height, names,
+                                               m_channels.data());
+            }
+            else
+                floatWritten = WriteTiledFloat(floatName, job->width, job->height, job->pixels);
+            if (floatWritten)
+                cout << "ImageWriter saved float image to " << floatName << endl;
+            written = written && floatWritten;
+        }
+
+        if (floatOutput != NoFloatOutput || hasAovs)
+            RecordTraceEvent("float write", -1, floatStart, TraceClock());
+        RecordTraceEvent("write image", -1, TraceTime(start), TraceClock());
+
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if (!written)
+                m_failures++;
+            m_writeTime += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            m_head = (m_head + 1) % m_jobs.size();
+            m_count--;
+        }
+        m_jobDone.notify_all();
+    }
+}
+
+// --------------------------------------------------------------------------
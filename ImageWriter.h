@@ -0,0 +1,109 @@
+// ==========================================================================
+// Image Writer Support Code
+//  - saves rendered frames to disk on a background thread, so the render
+//    loop can start on the next frame while the previous one is encoded
+//  - a fixed number of frame slots bounds the memory held by the queue;
+//    submitting with every slot taken waits for the oldest to be written
+//  - frames are compressed in row bands spread over a thread pool
+//  - optionally the unclamped float colours are saved next to each PNG,
+//    together with any AOV channels rendered with the frame
+// ==========================================================================
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <glm/vec3.hpp>
+#include "PngEncoder.h"
+
+class ThreadPool;
+
+// float copy of each frame written next to its PNG, with the extension
+// .pfm or .rtf (the tiled float container) appended to the file name;
+// frames submitted with AOVs always get the .rtf, which holds them
+enum FloatOutput
+{
+    NoFloatOutput,
+    PfmOutput,
+    TiledFloatOutput
+};
+
+class ImageWriter
+{
+    struct Job
+    {
+        std::string            fileName;
+        int                    width;
+        int                    height;
+        std::vector<glm::vec3> pixels;
+        std::vector<std::string> aovNames;
+        std::vector<float>     aovs;        // aovNames.size() per pixel
+    };
+
+    // slots in submission order starting at m_head; a slot's storage is
+    // kept after it is written so steady-state submits do not allocate
+    std::vector<Job>           m_jobs;
+    int                        m_head;
+    int                        m_count;
+    std::vector<unsigned char> m_bytes;     // used by the writer thread only
+    std::vector<float>         m_channels;  // likewise
+    ThreadPool                *m_pool;
+    int                        m_level;
+    FloatOutput                m_floatOutput;
+
+    std::thread                m_thread;
+    std::mutex                 m_mutex;
+    std::condition_variable    m_jobQueued;
+    std::condition_variable    m_jobDone;
+    bool                       m_stopping;
+    int                        m_failures;
+    double                     m_writeTime;     // milliseconds, all frames
+
+    void WriterLoop();
+
+    // fills m_channels with the colour and AOV channels of job
+    void InterleaveChannels(const Job &job);
+
+    ImageWriter(const ImageWriter &);
+    ImageWriter &operator=(const ImageWriter &);
+
+public:
+    // maxPending is the number of frames that can wait to be written; pool
+    // (which may be null) runs the compression at the given PNG level
+    explicit ImageWriter(int maxPending = 2, ThreadPool *pool = 0,
+                         int level = DefaultPngLevel);
+
+    // writes out everything still queued before returning
+    ~ImageWriter();
+
+    // queues pixels (row-major, bottom row first, RGB in [0,1]) to be saved
+    // as a PNG file; the pixels are copied, so the caller may reuse them
+    void Submit(const std::string &fileName, int width, int height,
+                const std::vector<glm::vec3> &pixels);
+
+    // as above, with AOV channels (aovNames.size() floats per pixel, in the
+    // same order as pixels) to be saved in the frame's .rtf file after R, G
+    // and B
+    void Submit(const std::string &fileName, int width, int height,
+                const std::vector<glm::vec3> &pixels,
+                const std::vector<std::string> &aovNames,
+                const std::vector<float> &aovs);
+
+    void SetFloatOutput(FloatOutput output);
+
+    // waits until every submitted frame has been written
+    void Flush();
+
+    // number of frames that could not be written so far
+    int Failures();
+
+    // milliseconds the writer thread has spent tone mapping, compressing
+    // and writing frames so far
+    double WriteTime();
+};
+
+// --------------------------------------------------------------------------
+#endif // IMAGEWRITER_H
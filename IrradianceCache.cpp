@@ -0,0 +1,202 @@
+// ==========================================================================
+// Irradiance Cache Support Code
+// ==========================================================================
+
+#include "IrradianceCache.h"
+#include "PathTracer.h"
+#include "Raytracer.h"
+#include "ThreadPool.h"
+#include "Arena.h"
+#include "Trace.h"
+#include "RenderStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    const float Pi = 3.14159265f;
+
+    // buckets of the hashed grid; cells that hash alike share one
+    const int CellCount = 1 << 16;
+
+    // records whose plane the point lies this far behind, relative to
+    // their reach, would pass on light from the wrong side of a corner
+    const float MaxBehind = 0.05f;
+}
+
+// --------------------------------------------------------------------------
+
+IrradianceCache::IrradianceCache(const IrradianceCacheSettings &settings)
+    : m_settings(settings), m_records(max(settings.maxRecords, 1)), m_cells(CellCount), m_count(0),
+      m_cellSize(settings.accuracy * settings.maxRadius)
+{
+    Clear();
+}
+
+void IrradianceCache::Clear()
+{
+    m_count = 0;
+    for (int i = 0; i < CellCount; i++)
+        m_cells[i].store(-1, memory_order_relaxed);
+}
+
+int IrradianceCache::RecordCount() const
+{
+    return min(m_count.load(), (int)m_records.size());
+}
+
+int IrradianceCache::CellIndex(int x, int y, int z) const
+{
+    uint32_t hash = ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u) ^ ((uint32_t)z * 83492791u);
+    return (int)(hash & (CellCount - 1));
+}
+
+bool IrradianceCache::Interpolate(const glm::vec3 &position, const glm::vec3 &normal,
+                                  glm::vec3 &irradiance) const
+{
+    int cx = (int)floor(position.x / m_cellSize);
+    int cy = (int)floor(position.y / m_cellSize);
+    int cz = (int)floor(position.z / m_cellSize);
+
+    // a record is only in reach of points within its own cell or the ones
+    // next to it; buckets two of those share are only walked once
+    int visited[27];
+    int visitedCount = 0;
+    glm::vec3 sum(0.0f);
+    float weights = 0.0f;
+    for (int dz = -1; dz <= 1; dz++)
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int cell = CellIndex(cx + dx, cy + dy, cz + dz);
+                if (find(visited, visited + visitedCount, cell) != visited + visitedCount)
+                    continue;
+                visited[visitedCount++] = cell;
+
+                for (int i = m_cells[cell].load(memory_order_acquire); i >= 0; i = m_records[i].next)
+                {
+                    const Record &record = m_records[i];
+                    glm::vec3 offset = position - record.position;
+                    float error = glm::length(offset) / record.radius
+                                + sqrt(max(1.0f - glm::dot(normal, record.normal), 0.0f));
+                    if (error >= m_settings.accuracy
+                        || glm::dot(offset, normal + record.normal) < -2.0f * MaxBehind * record.radius)
+                        continue;
+                    float weight = 1.0f / max(error, 1e-6f);
+                    sum += weight * record.irradiance;
+                    weights += weight;
+                }
+            }
+    if (weights <= 0.0f)
+        return false;
+    irradiance = sum / weights;
+    return true;
+}
+
+void IrradianceCache::Insert(const Record &record)
+{
+    int index = m_count.fetch_add(1);
+    if (index >= (int)m_records.size())
+        return;
+    m_records[index] = record;
+
+    // the record is complete before the swap publishes it
+    atomic<int> &head = m_cells[CellIndex((int)floor(record.position.x / m_cellSize),
+                                          (int)floor(record.position.y / m_cellSize),
+                                          (int)floor(record.position.z / m_cellSize))];
+    int first = head.load(memory_order_relaxed);
+    do
+        m_records[index].next = first;
+    while (!head.compare_exchange_weak(first, index, memory_order_release, memory_order_relaxed));
+}
+
+glm::vec3 IrradianceCache::Irradiance(const Scene &scene, int palette, const PathSettings &settings,
+                                      const glm::vec3 &position, const glm::vec3 &normal,
+                                      PathRandom &random, int *candidates, TraceCounters *counters)
+{
+    glm::vec3 irradiance;
+    if (Interpolate(position, normal, irradiance))
+        return irradiance;
+
+    // the sample paths follow every bounce themselves; with cosine-weighted
+    // directions the irradiance is pi times their mean radiance
+    PathSettings paths = settings;
+    paths.irradianceCache = 0;
+    glm::vec3 sum(0.0f);
+    float inverseDistances = 0.0f;
+    int samples = max(m_settings.samples, 1);
+    for (int s = 0; s < samples; s++)
+    {
+        float u1 = random.Next();
+        float u2 = random.Next();
+        glm::vec3 direction = CosineDirection(normal, u1, u2);
+        SurfaceAovs first;
+        // the environment straight from here is shared with the light
+        // samples of the surfaces that use the record
+        glm::vec3 radiance = TracePath(scene, palette, paths, position, direction, random, candidates,
+                                       &first, counters, DiffuseSpread,
+                                       max(glm::dot(normal, direction), 0.0f) / Pi);
+        // held to the same limit as the bounces of a path without the cache
+        if (settings.maxIndirect > 0.0f)
+            radiance = glm::min(radiance, glm::vec3(settings.maxIndirect));
+        sum += radiance;
+        if (first.objectId > 0.0f)
+            inverseDistances += 1.0f / max(glm::length(first.position - position), 1e-6f);
+    }
+
+    Record record;
+    record.position = position;
+    record.normal = normal;
+    record.irradiance = sum * (Pi / samples);
+    record.radius = inverseDistances > 0.0f ? samples / inverseDistances : m_settings.maxRadius;
+    record.radius = min(max(record.radius, m_settings.minRadius), m_settings.maxRadius);
+    Insert(record);
+    return record.irradiance;
+}
+
+void IrradianceCache::Fill(const Scene &scene, int palette, const Camera &camera,
+                           const PathSettings &settings, ThreadPool *pool, RenderStats *stats)
+{
+    TraceScope fillScope("fill irradiance cache");
+    if (stats)
+        stats->Reset(pool ? pool->ThreadCount() : 0);
+    int stride = max(m_settings.fillStride, 1);
+    int rows = (camera.height + stride - 1) / stride;
+    ThreadPool::ParallelFor(pool, 0, rows, 1, [&](int first, int last) {
+        Arena &arena = ThreadArena();
+        ArenaScope scope(arena);
+        int *candidates = arena.Allocate<int>(max(scene.bvh.PrimitiveCount(), 1));
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        TraceCounters rowCounters;
+        TraceCounters *counters = stats ? &rowCounters : 0;
+        for (int row = first; row < last; row++)
+            for (int x = stride / 2; x < camera.width; x += stride)
+            {
+                // mixed like the pixels' seeds, but from numbers of their own
+                // (the top bit set) so records and pixels draw unrelated paths
+                int y = min(row * stride + stride / 2, camera.height - 1);
+                PathRandom random(MixSeed(((uint64_t)y * camera.width + x) | (1ull << 63)));
+                SurfaceHit hit;
+                Material material;
+                if (!IntersectScene(scene, glm::vec3(0.0f), glm::normalize(camera.PrimaryRay(x, y)),
+                                    FLT_MAX, candidates, hit, counters)
+                    || !SceneMaterial(palette, hit.type, hit.index, material))
+                    continue;
+                // the same point TracePath asks for
+                Irradiance(scene, palette, settings, hit.position + RayOffset * hit.normal, hit.normal,
+                           random, candidates, counters);
+            }
+        if (stats)
+            stats->AddTile(rowCounters, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    });
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,100 @@
+// ==========================================================================
+// Irradiance Cache Support Code
+//  - Ward's irradiance caching for the path tracer: the indirect light
+//    arriving at a surface is worked out with many hemisphere paths at a
+//    few points only, and interpolated between them everywhere else
+//  - a record is valid around its point out to a distance that shrinks
+//    with how close other surfaces are (the harmonic mean of the sample
+//    path lengths) and with how far the normal turns, so records crowd
+//    into corners and spread out over open floors and walls
+//  - records live in a hashed grid of cells as large as the widest reach
+//    of any record, so a lookup only looks at the 27 cells around it
+//  - threads add records without locks: each takes the next free slot,
+//    fills it in and then links it into its cell with a compare-and-swap,
+//    so readers only ever see finished records
+//
+// A sparse fill pass over the image comes before the render so that most
+// records exist before pixels need them; pixels that still find none make
+// their own. Which thread makes a record first can change where records
+// are, so images with the cache may differ slightly between runs.
+// ==========================================================================
+#ifndef IRRADIANCECACHE_H
+#define IRRADIANCECACHE_H
+
+#include <vector>
+#include <atomic>
+#include <glm/vec3.hpp>
+
+struct Scene;
+struct Camera;
+struct PathSettings;
+struct TraceCounters;
+class PathRandom;
+class ThreadPool;
+class RenderStats;
+
+// --------------------------------------------------------------------------
+
+struct IrradianceCacheSettings
+{
+    float accuracy;         // Ward's a: smaller means more records
+    float minRadius;        // limits on a record's reach before accuracy
+    float maxRadius;        // scales it, in scene units
+    int   samples;          // hemisphere paths per record
+    int   fillStride;       // pixels between the points of the fill pass
+    int   maxRecords;       // storage, allocated once; later records are used
+                            // by the pixel that made them but not kept
+
+    IrradianceCacheSettings()
+        : accuracy(0.25f), minRadius(0.05f), maxRadius(2.0f), samples(128), fillStride(8),
+          maxRecords(1 << 18) {}
+};
+
+class IrradianceCache
+{
+    struct Record
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec3 irradiance;
+        float     radius;       // harmonic mean distance, clamped
+        int       next;         // in the same cell, -1 at the end
+    };
+
+    IrradianceCacheSettings m_settings;
+    std::vector<Record> m_records;
+    std::vector<std::atomic<int> > m_cells;   // first record of each, or -1
+    std::atomic<int> m_count;
+    float m_cellSize;
+
+    IrradianceCache(const IrradianceCache &);
+    IrradianceCache &operator=(const IrradianceCache &);
+
+    int CellIndex(int x, int y, int z) const;
+    bool Interpolate(const glm::vec3 &position, const glm::vec3 &normal, glm::vec3 &irradiance) const;
+    void Insert(const Record &record);
+
+public:
+    explicit IrradianceCache(const IrradianceCacheSettings &settings = IrradianceCacheSettings());
+
+    // forgets every record, for a new frame
+    void Clear();
+
+    int RecordCount() const;
+
+    // indirect irradiance arriving at position around the unit normal,
+    // interpolated from the records in reach or, if there are none, from a
+    // new record sampled with paths that settings describe
+    glm::vec3 Irradiance(const Scene &scene, int palette, const PathSettings &settings,
+                         const glm::vec3 &position, const glm::vec3 &normal, PathRandom &random,
+                         int *candidates, TraceCounters *counters = 0);
+
+    // makes the records the surfaces seen at every fillStride-th pixel of
+    // the camera need, with the rows spread over the pool; stats, if given,
+    // is reset and receives the rays and tests this took
+    void Fill(const Scene &scene, int palette, const Camera &camera, const PathSettings &settings,
+              ThreadPool *pool, RenderStats *stats = 0);
+};
+
+// --------------------------------------------------------------------------
+#endif // IRRADIANCECACHE_H
@@ -0,0 +1,400 @@
+// ==========================================================================
+// Path Tracing Support Code
+// ==========================================================================
+
+#include "PathTracer.h"
+#include "IrradianceCache.h"
+#include "TextureCache.h"
+#include "Environment.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    const float Pi = 3.14159265f;
+
+    // the palettes were chosen for display and use pure white and pure
+    // colours, which would reflect all light they receive and never let
+    // a closed room converge; surfaces keep at most this much
+    const float MaxAlbedo = 0.9f;
+
+    // and roulette never keeps a path with more certainty than this
+    const float MaxSurvival = 0.95f;
+
+    bool IntersectSphereRay(const Sphere &sphere, const glm::vec3 &origin,
+                            const glm::vec3 &direction, float &t)
+    {
+        glm::vec3 oc = origin - sphere.centre;
+        float b = glm::dot(oc, direction);
+        float c = glm::dot(oc, oc) - sphere.radius * sphere.radius;
+        float discriminant = b * b - c;
+        if (discriminant < 0.0f)
+            return false;
+        float root = sqrt(discriminant);
+        t = -b - root;
+        if (t <= 0.0f)
+            t = -b + root;
+        return t > 0.0f;
+    }
+
+    // Moller and Trumbore, both faces
+    bool IntersectTriangleRay(const Triangle &tri, const glm::vec3 &origin,
+                              const glm::vec3 &direction, float &t)
+    {
+        glm::vec3 e1 = tri.v[1] - tri.v[0];
+        glm::vec3 e2 = tri.v[2] - tri.v[0];
+        glm::vec3 p = glm::cross(direction, e2);
+        float det = glm::dot(e1, p);
+        if (fabs(det) < 1e-12f)
+            return false;
+        float inverse = 1.0f / det;
+        glm::vec3 s = origin - tri.v[0];
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, e1);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(e2, q) * inverse;
+        return t > 0.0f;
+    }
+
+    bool IntersectPlaneRay(const Plane &plane, const glm::vec3 &origin,
+                           const glm::vec3 &direction, float &t)
+    {
+        float denominator = glm::dot(plane.normal, direction);
+        if (fabs(denominator) < 1e-12f)
+            return false;
+        t = glm::dot(plane.point - origin, plane.normal) / denominator;
+        return t > 0.0f;
+    }
+
+    // object numbers as the AOVs count them: spheres, triangles, planes
+    int ObjectId(const Scene &scene, PrimitiveType type, int index)
+    {
+        if (type == TrianglePrimitive)
+            return 1 + index + (int)scene.spheres.size();
+        if (type == PlanePrimitive)
+            return 1 + index + (int)(scene.spheres.size() + scene.triangles.size());
+        return 1 + index;
+    }
+
+    // an orthonormal basis about a unit normal after Duff et al.
+    void Basis(const glm::vec3 &n, glm::vec3 &tangent, glm::vec3 &bitangent)
+    {
+        float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (sign + n.z);
+        float b = n.x * n.y * a;
+        tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+    }
+
+    // the texture the scene puts on a primitive, if it has one that loaded
+    const SceneTexture *FindTexture(const Scene &scene, PrimitiveType type, int index)
+    {
+        for (size_t i = 0; i < scene.textures.size(); i++)
+            if (scene.textures[i].type == type && scene.textures[i].index == index
+                && scene.textures[i].id >= 0)
+                return &scene.textures[i];
+        return 0;
+    }
+
+    // the texture's colour where a cone this wide meets the primitive
+    glm::vec3 TextureColour(const Scene &scene, TextureCache &cache, const SceneTexture &texture,
+                            const glm::vec3 &position, float coneWidth)
+    {
+        if (texture.type == SpherePrimitive)
+        {
+            // longitude and latitude, the bottom row at the south pole
+            const Sphere &sphere = scene.spheres[texture.index];
+            glm::vec3 d = glm::normalize(position - sphere.centre);
+            float u = atan2(d.z, d.x) / (2.0f * Pi) + 0.5f;
+            float v = asin(min(max(d.y, -1.0f), 1.0f)) / Pi + 0.5f;
+            return cache.Lookup(texture.id, u / texture.scale, v / texture.scale,
+                                coneWidth / (2.0f * Pi * sphere.radius * texture.scale));
+        }
+
+        // both faces alike, so the normal is the primitive's own
+        glm::vec3 normal;
+        if (texture.type == TrianglePrimitive)
+        {
+            const Triangle &tri = scene.triangles[texture.index];
+            normal = glm::normalize(glm::cross(tri.v[1] - tri.v[0], tri.v[2] - tri.v[0]));
+        }
+        else
+            normal = glm::normalize(scene.planes[texture.index].normal);
+        glm::vec3 tangent, bitangent;
+        Basis(normal, tangent, bitangent);
+        return cache.Lookup(texture.id, glm::dot(position, tangent) / texture.scale,
+                            glm::dot(position, bitangent) / texture.scale, coneWidth / texture.scale);
+    }
+
+    // Veach's power heuristic: the share of light found by a strategy with
+    // density pdf that it keeps, when the other one had density other
+    float PowerHeuristic(float pdf, float other)
+    {
+        float a = pdf * pdf;
+        float b = other * other;
+        return a + b > 0.0f ? a / (a + b) : 0.0f;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+uint64_t MixSeed(uint64_t v)
+{
+    v += 0x9e3779b97f4a7c15ull;
+    v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ull;
+    v = (v ^ (v >> 27)) * 0x94d049bb133111ebull;
+    return v ^ (v >> 31);
+}
+
+PathRandom::PathRandom(uint64_t seed)
+    : m_state(0)
+{
+    NextBits();
+    m_state += seed;
+    NextBits();
+}
+
+uint32_t PathRandom::NextBits()
+{
+    uint64_t old = m_state;
+    m_state = old * 6364136223846793005ull + 1442695040888963407ull;
+    uint32_t shifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rotation = (uint32_t)(old >> 59);
+    return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+}
+
+// --------------------------------------------------------------------------
+
+glm::vec3 CosineDirection(const glm::vec3 &n, float u1, float u2)
+{
+    glm::vec3 tangent, bitangent;
+    Basis(n, tangent, bitangent);
+
+    float r = sqrt(u1);
+    float phi = 2.0f * Pi * u2;
+    return r * cos(phi) * tangent + r * sin(phi) * bitangent + sqrt(max(1.0f - u1, 0.0f)) * n;
+}
+
+bool IntersectScene(const Scene &scene, const glm::vec3 &origin, const glm::vec3 &direction,
+                    float tMax, int *candidates, SurfaceHit &hit, TraceCounters *counters)
+{
+    hit.t = tMax;
+    hit.index = -1;
+    float t;
+
+    for (int i = 0; i < (int)scene.spheres.size(); i++)
+        if (IntersectSphereRay(scene.spheres[i], origin, direction, t) && t < hit.t)
+        {
+            hit.t = t;
+            hit.type = SpherePrimitive;
+            hit.index = i;
+        }
+
+    int nodeVisits = 0;
+    int candidateCount = scene.bvh.Candidates(origin, direction, 0.0f, tMax, candidates,
+                                              counters ? &nodeVisits : 0);
+    for (int n = 0; n < candidateCount; n++)
+        if (IntersectTriangleRay(scene.triangles[candidates[n]], origin, direction, t) && t < hit.t)
+        {
+            hit.t = t;
+            hit.type = TrianglePrimitive;
+            hit.index = candidates[n];
+        }
+
+    for (int i = 0; i < (int)scene.planes.size(); i++)
+        if (IntersectPlaneRay(scene.planes[i], origin, direction, t) && t < hit.t)
+        {
+            hit.t = t;
+            hit.type = PlanePrimitive;
+            hit.index = i;
+        }
+
+    if (counters)
+    {
+        counters->rays++;
+        counters->sphereTests += scene.spheres.size();
+        counters->triangleTests += candidateCount;
+        counters->planeTests += scene.planes.size();
+        counters->nodeVisits += nodeVisits;
+    }
+    if (hit.index < 0)
+        return false;
+
+    hit.position = origin + hit.t * direction;
+    if (hit.type == SpherePrimitive)
+        hit.normal = glm::normalize(hit.position - scene.spheres[hit.index].centre);
+    else if (hit.type == TrianglePrimitive)
+    {
+        const Triangle &tri = scene.triangles[hit.index];
+        hit.normal = glm::normalize(glm::cross(tri.v[1] - tri.v[0], tri.v[2] - tri.v[0]));
+    }
+    else
+        hit.normal = glm::normalize(scene.planes[hit.index].normal);
+    if (glm::dot(hit.normal, direction) > 0.0f)
+        hit.normal = -hit.normal;
+    return true;
+}
+
+glm::vec3 TracePath(const Scene &scene, int palette, const PathSettings &settings,
+                    const glm::vec3 &origin, const glm::vec3 &direction, PathRandom &random,
+                    int *candidates, SurfaceAovs *aovs, TraceCounters *counters, float spread,
+                    float directionPdf)
+{
+    glm::vec3 radiance(0.0f);
+    glm::vec3 throughput(1.0f);
+    glm::vec3 rayOrigin = origin;
+    glm::vec3 rayDirection = glm::normalize(direction);
+    float coneWidth = 0.0f;
+    float bouncePdf = directionPdf;     // of the direction the last bounce chose
+    if (aovs)
+        *aovs = SurfaceAovs();
+
+    for (int bounce = 0; bounce < settings.maxBounces; bounce++)
+    {
+        SurfaceHit hit;
+        if (!IntersectScene(scene, rayOrigin, rayDirection, FLT_MAX, candidates, hit, counters))
+        {
+            // the environment, in full where the ray was given and shared
+            // with its light samples where a bounce chose the ray
+            if (settings.environment)
+            {
+                glm::vec3 light = throughput * settings.environment->Radiance(rayDirection);
+                if (bouncePdf > 0.0f)
+                    light *= PowerHeuristic(bouncePdf, settings.environment->Pdf(rayDirection));
+                if (bounce > 1 && settings.maxIndirect > 0.0f)
+                    light = glm::min(light, glm::vec3(settings.maxIndirect));
+                radiance += light;
+            }
+            break;
+        }
+
+        // primitives the palette leaves uncoloured are black, as they are
+        // to TracePixel
+        Material material;
+        bool coloured = SceneMaterial(palette, hit.type, hit.index, material);
+        glm::vec3 colour = coloured ? glm::vec3((float)material.colour[0], (float)material.colour[1],
+                                                (float)material.colour[2]) : glm::vec3(0.0f);
+        coneWidth += hit.t * spread;
+        if (settings.textures && colour != glm::vec3(0.0f))
+        {
+            const SceneTexture *texture = FindTexture(scene, hit.type, hit.index);
+            if (texture)
+                colour *= TextureColour(scene, *settings.textures, *texture, hit.position, coneWidth);
+        }
+        if (bounce == 0 && aovs)
+        {
+            aovs->depth = -hit.position.z;
+            aovs->normal = hit.normal;
+            aovs->objectId = (float)ObjectId(scene, hit.type, hit.index);
+            aovs->position = hit.position;
+            aovs->albedo = colour;
+        }
+        glm::vec3 albedo = glm::min(colour, glm::vec3(MaxAlbedo));
+        if (albedo == glm::vec3(0.0f))
+            break;
+
+        // next-event estimation: each light straight to this point, if
+        // nothing is in between; a Lambertian surface reflects albedo / pi
+        glm::vec3 surface = hit.position + RayOffset * hit.normal;
+        for (size_t l = 0; l < scene.lights.size(); l++)
+        {
+            glm::vec3 toLight = scene.lights[l] - surface;
+            float distance2 = glm::dot(toLight, toLight);
+            float distance = sqrt(distance2);
+            glm::vec3 lightDirection = toLight / distance;
+            float cosine = glm::dot(hit.normal, lightDirection);
+            SurfaceHit blocker;
+            if (cosine <= 0.0f
+                || IntersectScene(scene, surface, lightDirection, distance, candidates, blocker, counters))
+                continue;
+            glm::vec3 light = throughput * albedo * (cosine * settings.lightIntensity / (Pi * distance2));
+            if (bounce > 0 && settings.maxIndirect > 0.0f)
+                light = glm::min(light, glm::vec3(settings.maxIndirect));
+            radiance += light;
+        }
+
+        // one direction towards the environment, drawn by its light
+        if (settings.environment)
+        {
+            float u1 = random.Next();
+            float u2 = random.Next();
+            float u3 = random.Next();
+            float u4 = random.Next();
+            glm::vec3 lightDirection;
+            float pdf;
+            glm::vec3 light = settings.environment->Sample(u1, u2, u3, u4, lightDirection, pdf);
+            float cosine = pdf > 0.0f ? glm::dot(hit.normal, lightDirection) : 0.0f;
+            SurfaceHit blocker;
+            if (cosine > 0.0f
+                && !IntersectScene(scene, surface, lightDirection, FLT_MAX, candidates, blocker, counters))
+            {
+                light *= throughput * albedo * (cosine / (Pi * pdf)) * PowerHeuristic(pdf, cosine / Pi);
+                if (bounce > 0 && settings.maxIndirect > 0.0f)
+                    light = glm::min(light, glm::vec3(settings.maxIndirect));
+                radiance += light;
+            }
+        }
+
+        // with a cache the light from every other surface is looked up,
+        // along with the environment's share the light sample above left
+        if (bounce == 0 && settings.irradianceCache)
+        {
+            glm::vec3 irradiance = settings.irradianceCache->Irradiance(scene, palette, settings, surface,
+                                                                        hit.normal, random, candidates, counters);
+            radiance += throughput * albedo * irradiance / Pi;
+            break;
+        }
+
+        // the next direction, cosine weighted, so the weight only takes
+        // on the albedo
+        throughput *= albedo;
+        if (bounce + 1 >= settings.rouletteBounces)
+        {
+            float survival = min(max(throughput.x, max(throughput.y, throughput.z)), MaxSurvival);
+            if (random.Next() >= survival)
+                break;
+            throughput /= survival;
+        }
+        float u1 = random.Next();
+        float u2 = random.Next();
+        rayOrigin = surface;
+        rayDirection = CosineDirection(hit.normal, u1, u2);
+        bouncePdf = max(glm::dot(hit.normal, rayDirection), 0.0f) / Pi;
+        spread = max(spread, DiffuseSpread);
+    }
+    return radiance;
+}
+
+glm::vec3 TracePathPixel(const Scene &scene, int palette, const Camera &camera,
+                         const PathSettings &settings, int x, int y, int *candidates,
+                         SurfaceAovs *aovs, TraceCounters *counters)
+{
+    PathRandom random(MixSeed((uint64_t)y * camera.width + x));
+    glm::vec3 sum(0.0f);
+    int samples = max(settings.samples, 1);
+    for (int s = 0; s < samples; s++)
+    {
+        // anywhere in the pixel, which is 2 / width of the image plane wide
+        // at a distance of 2
+        float dx = random.Next();
+        float dy = random.Next();
+        glm::vec3 direction = camera.PrimaryRay(x, y) + glm::vec3(dx * 2.0f / camera.width,
+                                                                  dy * 2.0f / camera.height, 0.0f);
+        sum += TracePath(scene, palette, settings, glm::vec3(0.0f), direction, random, candidates,
+                         s == 0 ? aovs : 0, counters, 1.0f / camera.width);
+    }
+    return sum / (float)samples;
+}
+
+// --------------------------------------------------------------------------
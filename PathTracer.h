@@ -0,0 +1,126 @@
+// ==========================================================================
+// Path Tracing Support Code
+//  - an alternative to the fixed shading of TracePixel: light carried by
+//    Monte Carlo paths that bounce between the surfaces, so walls light
+//    each other and shadows fall where the lights cannot see
+//  - every surface is Lambertian in its palette colour; a path leaves it
+//    in a cosine-weighted direction, which cancels the cosine and the pdf
+//    so the path weight is only multiplied by the colour
+//  - at each bounce the point lights are sampled directly with a shadow
+//    ray (next-event estimation); paths are cut with Russian roulette once
+//    they are a few bounces long, so their expected length stays bounded
+//    while the estimate stays unbiased
+//  - an environment is sampled at each bounce too, and also reached by
+//    paths that leave the scene; the two estimates are combined with
+//    multiple importance sampling (Veach's power heuristic), so bright
+//    small regions come through the light samples and broad dim ones
+//    through the bounces
+//  - intersections use the true geometry of every primitive from any ray
+//    origin, found through the same hierarchy as the primary rays
+//
+// Random numbers are seeded per pixel, so an image is the same whatever
+// the number of threads and the order the tiles are rendered in.
+// ==========================================================================
+#ifndef PATHTRACER_H
+#define PATHTRACER_H
+
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include "Raytracer.h"
+
+class IrradianceCache;
+class TextureCache;
+class Environment;
+
+// --------------------------------------------------------------------------
+
+// secondary rays start this far off the surface along its normal, so they
+// do not find the surface they leave
+const float RayOffset = 1e-3f;
+
+// how fast, in radians, the footprint of a path that has bounced off a
+// diffuse surface grows with distance; textures seen only through such a
+// bounce are looked up this blurred, which keeps their tiles few
+const float DiffuseSpread = 0.1f;
+
+struct PathSettings
+{
+    int   samples;          // paths per pixel
+    int   maxBounces;       // hard limit, roulette usually ends paths sooner
+    int   rouletteBounces;  // bounces before roulette may end a path
+    float lightIntensity;   // radiant intensity of every point light
+    float maxIndirect;      // most light one bounce after the first may add
+                            // to a path, per channel, or 0 for no limit;
+                            // trades a little energy for no fireflies from
+                            // paths that pass close to a light
+    IrradianceCache *irradianceCache;   // if set, the indirect light at the
+                                        // first surface comes from here and
+                                        // paths end there
+    TextureCache *textures;     // if set, the scene's textures are looked up
+                                // here; the scene must have been loaded into it
+    const Environment *environment;     // if set, light from far away: seen
+                                        // by rays that leave the scene and
+                                        // sampled like the lights
+
+    PathSettings()
+        : samples(16), maxBounces(16), rouletteBounces(3), lightIntensity(15.0f), maxIndirect(1.0f),
+          irradianceCache(0), textures(0), environment(0) {}
+};
+
+// closest surface a ray meets, with its normal turned towards the ray
+struct SurfaceHit
+{
+    float         t;
+    glm::vec3     position;
+    glm::vec3     normal;
+    PrimitiveType type;
+    int           index;
+};
+
+// PCG32 (O'Neill), small and fast enough to draw per bounce
+class PathRandom
+{
+    uint64_t m_state;
+
+public:
+    explicit PathRandom(uint64_t seed);
+
+    uint32_t NextBits();
+
+    // uniform in [0, 1)
+    float Next() { return (NextBits() >> 8) * (1.0f / 16777216.0f); }
+};
+
+// SplitMix64 finalizer, to turn pixel numbers and the like into unrelated
+// seeds for PathRandom
+uint64_t MixSeed(uint64_t v);
+
+// direction about the unit normal with pdf cos(theta) / pi for u1 and u2
+// uniform in [0, 1)
+glm::vec3 CosineDirection(const glm::vec3 &normal, float u1, float u2);
+
+// finds the closest surface along origin + t * direction for 0 < t < tMax;
+// candidates is scratch space as for TracePixel
+bool IntersectScene(const Scene &scene, const glm::vec3 &origin, const glm::vec3 &direction,
+                    float tMax, int *candidates, SurfaceHit &hit, TraceCounters *counters = 0);
+
+// estimates the light arriving along a ray, one path per call; aovs, if
+// given, receives the data of the first surface the path meets. The ray
+// stands for a cone whose width grows by spread per unit of distance, which
+// sets how blurred the textures it meets are looked up. A ray that a bounce
+// off a surface chose with density directionPdf, rather than one given
+// outright, only keeps its share of the environment it sees, as the
+// surface sampled the environment itself.
+glm::vec3 TracePath(const Scene &scene, int palette, const PathSettings &settings,
+                    const glm::vec3 &origin, const glm::vec3 &direction, PathRandom &random,
+                    int *candidates, SurfaceAovs *aovs = 0, TraceCounters *counters = 0,
+                    float spread = 0.0f, float directionPdf = 0.0f);
+
+// averages settings.samples paths through random points of pixel (x, y);
+// the AOVs are those of the first path
+glm::vec3 TracePathPixel(const Scene &scene, int palette, const Camera &camera,
+                         const PathSettings &settings, int x, int y, int *candidates,
+                         SurfaceAovs *aovs = 0, TraceCounters *counters = 0);
+
+// --------------------------------------------------------------------------
+#endif // PATHTRACER_H
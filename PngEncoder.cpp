@@ -0,0 +1,807 @@
+// ==========================================================================
+// PNG Encoder Support Code
+//
+// Deflate (RFC 1951) is implemented here directly: LZ77 over a 32 KB
+// window with hash chains whose length depends on the level, and each
+// block is sent with whichever of dynamic Huffman, fixed Huffman or stored
+// encoding comes out smallest.
+// ==========================================================================
+
+#include "PngEncoder.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <queue>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    const int WindowSize = 32768;
+    const int MinMatch = 3;
+    const int MaxMatch = 258;
+    const int HashBits = 15;
+    const int BlockTokens = 1 << 16;
+    const int MaxStoredBlock = 65535;
+
+    // aim for at least this much filtered data per band
+    const size_t BandBytes = 256 * 1024;
+
+    const int LitLenSymbols = 286;
+    const int DistanceSymbols = 30;
+    const int CodeLengthSymbols = 19;
+
+    const int LengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const int LengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const int DistanceBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577 };
+    const int DistanceExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const int CodeLengthOrder[CodeLengthSymbols] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    // hash chain length and "good enough" match length per level
+    const int ChainLength[10] = { 0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096 };
+    const int NiceLength[10] = { 0, 16, 32, 32, 64, 128, 128, 258, 258, 258 };
+
+    // symbol lookups for match lengths and distances, built once
+    struct CodeTables
+    {
+        uint8_t lengthCode[MaxMatch + 1];   // length -> index into LengthBase
+        uint8_t distanceCode[512];          // see DistanceCode()
+        uint32_t crc[256];
+
+        CodeTables()
+        {
+            for (int c = 0; c < 29; ++c)
+            {
+                int end = (c + 1 < 29) ? LengthBase[c + 1] : MaxMatch + 1;
+                for (int length = LengthBase[c]; length < end; ++length)
+                    lengthCode[length] = (uint8_t)c;
+            }
+            // code 28 stands for exactly 258, never for 227 + 31
+            lengthCode[MaxMatch] = 28;
+
+            for (int c = 0; c < 30; ++c)
+            {
+                int end = (c + 1 < 30) ? DistanceBase[c + 1] : WindowSize + 1;
+                for (int d = DistanceBase[c]; d < end; ++d)
+                {
+                    if (d <= 256)
+                        distanceCode[d - 1] = (uint8_t)c;
+                    else
+                        distanceCode[256 + ((d - 1) >> 7)] = (uint8_t)c;
+                }
+            }
+
+            for (uint32_t n = 0; n < 256; ++n)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                crc[n] = c;
+            }
+        }
+
+        int DistanceCode(int distance) const
+        {
+            return distance <= 256 ? distanceCode[distance - 1]
+                                   : distanceCode[256 + ((distance - 1) >> 7)];
+        }
+    };
+
+    const CodeTables &Tables()
+    {
+        static const CodeTables tables;
+        return tables;
+    }
+
+    // ----------------------------------------------------------------------
+    // Checksums
+
+    uint32_t Crc32(uint32_t crc, const unsigned char *data, size_t size)
+    {
+        const uint32_t *table = Tables().crc;
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    const uint32_t AdlerBase = 65521;
+
+    uint32_t Adler32(const unsigned char *data, size_t size)
+    {
+        uint32_t a = 1, b = 0;
+        while (size > 0)
+        {
+            // largest run before b could overflow 32 bits
+            size_t run = min<size_t>(size, 5552);
+            for (size_t i = 0; i < run; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= AdlerBase;
+            b %= AdlerBase;
+            data += run;
+            size -= run;
+        }
+        return (b << 16) | a;
+    }
+
+    // checksum of two pieces joined, from the checksums of each piece
+    uint32_t CombineAdler32(uint32_t adler1, uint32_t adler2, size_t size2)
+    {
+        uint32_t remainder = (uint32_t)(size2 % AdlerBase);
+        uint32_t sum1 = adler1 & 0xffff;
+        uint32_t sum2 = (uint32_t)(((uint64_t)remainder * sum1) % AdlerBase);
+        sum1 += (adler2 & 0xffff) + AdlerBase - 1;
+        sum2 += (adler1 >> 16) + (adler2 >> 16) + AdlerBase - remainder;
+        if (sum1 >= AdlerBase) sum1 -= AdlerBase;
+        if (sum1 >= AdlerBase) sum1 -= AdlerBase;
+        if (sum2 >= (AdlerBase << 1)) sum2 -= (AdlerBase << 1);
+        if (sum2 >= AdlerBase) sum2 -= AdlerBase;
+        return (sum2 << 16) | sum1;
+    }
+
+    // ----------------------------------------------------------------------
+    // Bit output, least significant bit first as deflate requires
+
+    class BitWriter
+    {
+        vector<unsigned char> &m_out;
+        uint64_t m_bits;
+        int      m_count;
+
+    public:
+        explicit BitWriter(vector<unsigned char> &out) : m_out(out), m_bits(0), m_count(0) {}
+
+        void Put(uint32_t value, int length)
+        {
+            m_bits |= (uint64_t)value << m_count;
+            m_count += length;
+            while (m_count >= 8)
+            {
+                m_out.push_back((unsigned char)m_bits);
+                m_bits >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        void AlignToByte()
+        {
+            if (m_count > 0)
+                Put(0, 8 - m_count);
+        }
+    };
+
+    // ----------------------------------------------------------------------
+    // Huffman codes
+
+    // code lengths for the given symbol frequencies, none longer than
+    // maxBits; frequencies are flattened until the tree is shallow enough
+    void BuildCodeLengths(const uint32_t *frequencies, int symbolCount, int maxBits,
+                          uint8_t *lengths)
+    {
+        vector<uint32_t> weights(frequencies, frequencies + symbolCount);
+        for (;;)
+        {
+            fill(lengths, lengths + symbolCount, 0);
+
+            typedef pair<uint64_t, int> Entry;      // weight, node
+            priority_queue<Entry, vector<Entry>, greater<Entry> > queue;
+            vector<int> parent;
+            for (int s = 0; s < symbolCount; ++s)
+                if (weights[s] > 0)
+                {
+                    queue.push(Entry(weights[s], (int)parent.size()));
+                    parent.push_back(s);            // leaves remember their symbol here
+                }
+
+            int leafCount = (int)parent.size();
+            if (leafCount == 0)
+                return;
+            if (leafCount == 1)
+            {
+                lengths[parent[0]] = 1;
+                return;
+            }
+
+            vector<int> symbols(parent);
+            fill(parent.begin(), parent.end(), -1);
+            while (queue.size() > 1)
+            {
+                Entry a = queue.top(); queue.pop();
+                Entry b = queue.top(); queue.pop();
+                int node = (int)parent.size();
+                parent.push_back(-1);
+                parent[a.second] = node;
+                parent[b.second] = node;
+                queue.push(Entry(a.first + b.first, node));
+            }
+
+            // internal nodes come after their children, so a reverse sweep
+            // knows a node's depth before its children need it
+            vector<int> depth(parent.size(), 0);
+            for (int n = (int)parent.size() - 2; n >= 0; --n)
+                depth[n] = depth[parent[n]] + 1;
+
+            int deepest = 0;
+            for (int i = 0; i < leafCount; ++i)
+            {
+                lengths[symbols[i]] = (uint8_t)depth[i];
+                deepest = max(deepest, depth[i]);
+            }
+            if (deepest <= maxBits)
+                return;
+
+            for (int s = 0; s < symbolCount; ++s)
+                if (weights[s] > 0)
+                    weights[s] = (weights[s] + 1) / 2;
+        }
+    }
+
+    // canonical codes for the lengths, bit-reversed for BitWriter
+    void BuildCodes(const uint8_t *lengths, int symbolCount, uint16_t *codes)
+    {
+        int lengthCount[16] = { 0 };
+        for (int s = 0; s < symbolCount; ++s)
+            lengthCount[lengths[s]]++;
+        lengthCount[0] = 0;
+
+        int nextCode[16] = { 0 };
+        int code = 0;
+        for (int bits = 1; bits < 16; ++bits)
+        {
+            code = (code + lengthCount[bits - 1]) << 1;
+            nextCode[bits] = code;
+        }
+
+        for (int s = 0; s < symbolCount; ++s)
+        {
+            int length = lengths[s];
+            codes[s] = 0;
+            if (length == 0)
+                continue;
+            int c = nextCode[length]++;
+            int reversed = 0;
+            for (int k = 0; k < length; ++k)
+                reversed |= ((c >> k) & 1) << (length - 1 - k);
+            codes[s] = (uint16_t)reversed;
+        }
+    }
+
+    // ----------------------------------------------------------------------
+    // Deflate
+
+    // a literal byte (distance 0) or a match of value bytes at distance
+    struct Token
+    {
+        uint16_t value;
+        uint16_t distance;
+    };
+
+    // code lengths and codes of one block's literal/length and distance
+    // alphabets
+    struct BlockCode
+    {
+        uint8_t  litLenLengths[288];
+        uint8_t  distanceLengths[32];
+        uint16_t litLenCodes[288];
+        uint16_t distanceCodes[32];
+    };
+
+    void FixedCode(BlockCode &code)
+    {
+        for (int s = 0; s < 288; ++s)
+            code.litLenLengths[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+        for (int s = 0; s < 32; ++s)
+            code.distanceLengths[s] = 5;
+        BuildCodes(code.litLenLengths, 288, code.litLenCodes);
+        BuildCodes(code.distanceLengths, 32, code.distanceCodes);
+    }
+
+    // run-length coded code lengths for a dynamic block header
+    struct DynamicHeader
+    {
+        int litLenCount;
+        int distanceCount;
+        int codeLengthCount;
+        vector<pair<int, int> > runs;       // code length symbol, extra bits value
+        uint8_t  codeLengthLengths[CodeLengthSymbols];
+        uint16_t codeLengthCodes[CodeLengthSymbols];
+    };
+
+    // returns the size in bits of the header
+    size_t BuildDynamicHeader(const BlockCode &code, DynamicHeader &header)
+    {
+        header.litLenCount = 286;
+        while (header.litLenCount > 257 && code.litLenLengths[header.litLenCount - 1] == 0)
+            header.litLenCount--;
+        header.distanceCount = 30;
+        while (header.distanceCount > 1 && code.distanceLengths[header.distanceCount - 1] == 0)
+            header.distanceCount--;
+
+        vector<uint8_t> lengths(code.litLenLengths, code.litLenLengths + header.litLenCount);
+        lengths.insert(lengths.end(), code.distanceLengths, code.distanceLengths + header.distanceCount);
+
+        header.runs.clear();
+        for (size_t i = 0; i < lengths.size();)
+        {
+            size_t run = 1;
+            while (i + run < lengths.size() && lengths[i + run] == lengths[i])
+                run++;
+
+            if (lengths[i] == 0 && run >= 3)
+            {
+                run = min<size_t>(run, 138);
+                if (run <= 10)
+                    header.runs.push_back(make_pair(17, (int)run - 3));
+                else
+                    header.runs.push_back(make_pair(18, (int)run - 11));
+                i += run;
+            }
+            else if (lengths[i] != 0 && run >= 4)
+            {
+                // the length itself, then repeats of it
+                header.runs.push_back(make_pair((int)lengths[i], 0));
+                run = min<size_t>(run - 1, 6);
+                header.runs.push_back(make_pair(16, (int)run - 3));
+                i += run + 1;
+            }
+            else
+            {
+                header.runs.push_back(make_pair((int)lengths[i], 0));
+                i++;
+            }
+        }
+
+        uint32_t frequencies[CodeLengthSymbols] = { 0 };
+        for (size_t r = 0; r < header.runs.size(); ++r)
+            frequencies[header.runs[r].first]++;
+        // this code has to be complete, which takes at least two symbols
+        if (count_if(frequencies, frequencies + CodeLengthSymbols, [](uint32_t f) { return f > 0; }) < 2)
+            frequencies[frequencies[0] > 0 ? 1 : 0] = 1;
+        BuildCodeLengths(frequencies, CodeLengthSymbols, 7, header.codeLengthLengths);
+        BuildCodes(header.codeLengthLengths, CodeLengthSymbols, header.codeLengthCodes);
+
+        header.codeLengthCount = CodeLengthSymbols;
+        while (header.codeLengthCount > 4
+               && header.codeLengthLengths[CodeLengthOrder[header.codeLengthCount - 1]] == 0)
+            header.codeLengthCount--;
+
+        size_t bits = 5 + 5 + 4 + 3 * header.codeLengthCount;
+        for (size_t r = 0; r < header.runs.size(); ++r)
+        {
+            int symbol = header.runs[r].first;
+            bits += header.codeLengthLengths[symbol];
+            bits += symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+        }
+        return bits;
+    }
+
+    void WriteDynamicHeader(BitWriter &out, const DynamicHeader &header)
+    {
+        out.Put(header.litLenCount - 257, 5);
+        out.Put(header.distanceCount - 1, 5);
+        out.Put(header.codeLengthCount - 4, 4);
+        for (int i = 0; i < header.codeLengthCount; ++i)
+            out.Put(header.codeLengthLengths[CodeLengthOrder[i]], 3);
+        for (size_t r = 0; r < header.runs.size(); ++r)
+        {
+            int symbol = header.runs[r].first;
+            out.Put(header.codeLengthCodes[symbol], header.codeLengthLengths[symbol]);
+            if (symbol == 16)
+                out.Put(header.runs[r].second, 2);
+            else if (symbol == 17)
+                out.Put(header.runs[r].second, 3);
+            else if (symbol == 18)
+                out.Put(header.runs[r].second, 7);
+        }
+    }
+
+    // size in bits of the tokens and end of block marker under a code
+    size_t TokenBits(const BlockCode &code, const uint32_t *litLenFrequencies,
+                     const uint32_t *distanceFrequencies)
+    {
+        size_t bits = 0;
+        for (int s = 0; s < LitLenSymbols; ++s)
+        {
+            bits += (size_t)litLenFrequencies[s] * code.litLenLengths[s];
+            if (s > 256)
+                bits += (size_t)litLenFrequencies[s] * LengthExtra[s - 257];
+        }
+        for (int s = 0; s < DistanceSymbols; ++s)
+            bits += (size_t)distanceFrequencies[s] * (code.distanceLengths[s] + DistanceExtra[s]);
+        return bits;
+    }
+
+    void WriteTokens(BitWriter &out, const BlockCode &code, const Token *tokens, int count)
+    {
+        const CodeTables &tables = Tables();
+        for (int i = 0; i < count; ++i)
+        {
+            const Token &token = tokens[i];
+            if (token.distance == 0)
+            {
+                out.Put(code.litLenCodes[token.value], code.litLenLengths[token.value]);
+                continue;
+            }
+            int lengthCode = tables.lengthCode[token.value];
+            out.Put(code.litLenCodes[257 + lengthCode], code.litLenLengths[257 + lengthCode]);
+            out.Put(token.value - LengthBase[lengthCode], LengthExtra[lengthCode]);
+
+            int distanceCode = tables.DistanceCode(token.distance);
+            out.Put(code.distanceCodes[distanceCode], code.distanceLengths[distanceCode]);
+            out.Put(token.distance - DistanceBase[distanceCode], DistanceExtra[distanceCode]);
+        }
+        out.Put(code.litLenCodes[256], code.litLenLengths[256]);
+    }
+
+    void WriteStored(BitWriter &out, const unsigned char *data, size_t size)
+    {
+        do
+        {
+            size_t length = min<size_t>(size, MaxStoredBlock);
+            out.Put(0, 1);                  // not the last block
+            out.Put(0, 2);                  // stored
+            out.AlignToByte();
+            out.Put((uint32_t)length, 16);
+            out.Put((uint32_t)(~length & 0xffff), 16);
+            for (size_t i = 0; i < length; ++i)
+                out.Put(data[i], 8);
+            data += length;
+            size -= length;
+        } while (size > 0);
+    }
+
+    // sends one block of tokens that covers data[0, size), in whichever of
+    // the three encodings is smallest
+    void WriteBlock(BitWriter &out, const Token *tokens, int count,
+                    const unsigned char *data, size_t size)
+    {
+        const CodeTables &tables = Tables();
+        uint32_t litLenFrequencies[LitLenSymbols] = { 0 };
+        uint32_t distanceFrequencies[DistanceSymbols] = { 0 };
+        for (int i = 0; i < count; ++i)
+        {
+            if (tokens[i].distance == 0)
+                litLenFrequencies[tokens[i].value]++;
+            else
+            {
+                litLenFrequencies[257 + tables.lengthCode[tokens[i].value]]++;
+                distanceFrequencies[tables.DistanceCode(tokens[i].distance)]++;
+            }
+        }
+        litLenFrequencies[256] = 1;
+
+        BlockCode dynamic;
+        fill(dynamic.litLenLengths, dynamic.litLenLengths + 288, 0);
+        fill(dynamic.distanceLengths, dynamic.distanceLengths + 32, 0);
+        BuildCodeLengths(litLenFrequencies, LitLenSymbols, 15, dynamic.litLenLengths);
+        BuildCodeLengths(distanceFrequencies, DistanceSymbols, 15, dynamic.distanceLengths);
+        // a block without matches still describes one distance code
+        if (*max_element(dynamic.distanceLengths, dynamic.distanceLengths + DistanceSymbols) == 0)
+            dynamic.distanceLengths[0] = 1;
+        BuildCodes(dynamic.litLenLengths, 288, dynamic.litLenCodes);
+        BuildCodes(dynamic.distanceLengths, 32, dynamic.distanceCodes);
+
+        DynamicHeader header;
+        size_t dynamicBits = BuildDynamicHeader(dynamic, header)
+                           + TokenBits(dynamic, litLenFrequencies, distanceFrequencies);
+
+        BlockCode fixed;
+        FixedCode(fixed);
+        size_t fixedBits = TokenBits(fixed, litLenFrequencies, distanceFrequencies);
+
+        size_t storedBits = (size / MaxStoredBlock + 1) * 5 * 8 + size * 8;
+
+        if (storedBits < dynamicBits && storedBits < fixedBits)
+        {
+            WriteStored(out, data, size);
+        }
+        else if (fixedBits <= dynamicBits)
+        {
+            out.Put(0, 1);
+            out.Put(1, 2);                  // fixed Huffman
+            WriteTokens(out, fixed, tokens, count);
+        }
+        else
+        {
+            out.Put(0, 1);
+            out.Put(2, 2);                  // dynamic Huffman
+            WriteDynamicHeader(out, header);
+            WriteTokens(out, dynamic, tokens, count);
+        }
+    }
+
+    // deflates data as a run of non-final blocks that ends on a byte
+    // boundary, so more deflate data can be appended directly after it
+    void DeflateBand(const unsigned char *data, size_t size, int level,
+                     vector<unsigned char> &compressed)
+    {
+        BitWriter out(compressed);
+        if (level <= 0)
+        {
+            WriteStored(out, data, size);
+            return;
+        }
+
+        int chainLength = ChainLength[min(level, 9)];
+        int niceLength = NiceLength[min(level, 9)];
+
+        vector<int> head(1 << HashBits, -1);
+        vector<int> previous(size);
+        vector<Token> tokens;
+        tokens.reserve(BlockTokens);
+
+        size_t blockStart = 0;
+        size_t i = 0;
+        while (i < size)
+        {
+            int bestLength = 0;
+            int bestDistance = 0;
+            if (i + MinMatch <= size)
+            {
+                uint32_t hash = ((uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2])
+                              * 2654435761u >> (32 - HashBits);
+                int maxLength = (int)min<size_t>(MaxMatch, size - i);
+                int candidate = head[hash];
+                for (int chain = chainLength; candidate >= 0 && chain > 0; --chain)
+                {
+                    if ((int)i - candidate > WindowSize)
+                        break;
+                    const unsigned char *a = data + candidate;
+                    const unsigned char *b = data + i;
+                    if (a[bestLength] == b[bestLength] && a[0] == b[0])
+                    {
+                        int length = 1;
+                        while (length < maxLength && a[length] == b[length])
+                            length++;
+                        if (length > bestLength)
+                        {
+                            bestLength = length;
+                            bestDistance = (int)i - candidate;
+                            if (length >= niceLength || length == maxLength)
+                                break;
+                        }
+                    }
+                    candidate = previous[candidate];
+                }
+                previous[i] = head[hash];
+                head[hash] = (int)i;
+            }
+
+            Token token;
+            if (bestLength >= MinMatch)
+            {
+                token.value = (uint16_t)bestLength;
+                token.distance = (uint16_t)bestDistance;
+
+                // the positions inside the match can start later matches
+                for (size_t k = i + 1; k < i + bestLength && k + MinMatch <= size; ++k)
+                {
+                    uint32_t hash = ((uint32_t)data[k] << 16 | (uint32_t)data[k + 1] << 8 | data[k + 2])
+                                  * 2654435761u >> (32 - HashBits);
+                    previous[k] = head[hash];
+                    head[hash] = (int)k;
+                }
+                i += bestLength;
+            }
+            else
+            {
+                token.value = data[i];
+                token.distance = 0;
+                i++;
+            }
+            tokens.push_back(token);
+
+            if ((int)tokens.size() == BlockTokens || i == size)
+            {
+                WriteBlock(out, tokens.data(), (int)tokens.size(), data + blockStart, i - blockStart);
+                tokens.clear();
+                blockStart = i;
+            }
+        }
+
+        // an empty stored block pads to the next byte boundary
+        WriteStored(out, data, 0);
+    }
+
+    // ----------------------------------------------------------------------
+    // PNG filtering
+
+    int Paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc)
+            return a;
+        return pb <= pc ? b : c;
+    }
+
+    // filters one row into out (filter type byte first), picking the filter
+    // with the smallest sum of absolute differences; previous is null for
+    // the first row
+    void FilterRow(const unsigned char *row, const unsigned char *previous,
+                   int rowBytes, unsigned char *out)
+    {
+        const int bpp = 3;
+
+        int bestFilter = 0;
+        long bestScore = -1;
+        for (int filter = 0; filter < 5; ++filter)
+        {
+            long score = 0;
+            for (int i = 0; i < rowBytes; ++i)
+            {
+                int a = i >= bpp ? row[i - bpp] : 0;
+                int b = previous ? previous[i] : 0;
+                int c = (previous && i >= bpp) ? previous[i - bpp] : 0;
+                int predicted = filter == 0 ? 0 : filter == 1 ? a : filter == 2 ? b
+                              : filter == 3 ? (a + b) / 2 : Paeth(a, b, c);
+                score += abs((int)(signed char)(row[i] - predicted));
+            }
+            if (bestScore < 0 || score < bestScore)
+            {
+                bestScore = score;
+                bestFilter = filter;
+            }
+        }
+
+        out[0] = (unsigned char)bestFilter;
+        for (int i = 0; i < rowBytes; ++i)
+        {
+            int a = i >= bpp ? row[i - bpp] : 0;
+            int b = previous ? previous[i] : 0;
+            int c = (previous && i >= bpp) ? previous[i - bpp] : 0;
+            int predicted = bestFilter == 0 ? 0 : bestFilter == 1 ? a : bestFilter == 2 ? b
+                          : bestFilter == 3 ? (a + b) / 2 : Paeth(a, b, c);
+            out[i + 1] = (unsigned char)(row[i] - predicted);
+        }
+    }
+
+    // ----------------------------------------------------------------------
+
+    void PutBigEndian(vector<unsigned char> &out, uint32_t value)
+    {
+        out.push_back((unsigned char)(value >> 24));
+        out.push_back((unsigned char)(value >> 16));
+        out.push_back((unsigned char)(value >> 8));
+        out.push_back((unsigned char)value);
+    }
+
+    void PutChunk(vector<unsigned char> &png, const char *type,
+                  const unsigned char *data, size_t size, uint32_t crc)
+    {
+        PutBigEndian(png, (uint32_t)size);
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data, data + size);
+        PutBigEndian(png, crc);
+    }
+
+    uint32_t ChunkCrc(const char *type, const unsigned char *data, size_t size)
+    {
+        return Crc32(Crc32(0, (const unsigned char *)type, 4), data, size);
+    }
+
+    struct Band
+    {
+        int                   firstRow;
+        int                   rowCount;
+        uint32_t              adler;
+        size_t                filteredSize;
+        vector<unsigned char> data;         // IDAT contents
+        uint32_t              crc;
+    };
+}
+
+// --------------------------------------------------------------------------
+
+void EncodePng(int width, int height, const unsigned char *rgb, int level,
+               ThreadPool *pool, vector<unsigned char> &png)
+{
+    level = max(0, min(level, 9));
+    int rowBytes = width * 3;
+    int bandRows = (int)max<size_t>(1, BandBytes / (rowBytes + 1));
+    int bandCount = max(1, (height + bandRows - 1) / bandRows);
+
+    vector<Band> bands(bandCount);
+    for (int b = 0; b < bandCount; ++b)
+    {
+        bands[b].firstRow = b * bandRows;
+        bands[b].rowCount = max(0, min(bandRows, height - b * bandRows));
+    }
+
+    // filter and deflate every band on its own
+    ThreadPool::ParallelFor(pool, 0, bandCount, 1, [&](int first, int last) {
+        vector<unsigned char> filtered;
+        for (int b = first; b < last; ++b)
+        {
+            TraceScope scope("png band", b);
+            Band &band = bands[b];
+            filtered.resize((size_t)band.rowCount * (rowBytes + 1));
+            for (int r = 0; r < band.rowCount; ++r)
+            {
+                int y = band.firstRow + r;
+                const unsigned char *row = rgb + (size_t)y * rowBytes;
+                const unsigned char *previous = y > 0 ? row - rowBytes : 0;
+                FilterRow(row, previous, rowBytes, &filtered[(size_t)r * (rowBytes + 1)]);
+            }
+            band.filteredSize = filtered.size();
+            band.adler = Adler32(filtered.data(), filtered.size());
+            DeflateBand(filtered.data(), filtered.size(), level, band.data);
+        }
+    });
+
+    // the zlib header goes in front of the first band, and an empty final
+    // block plus the checksum of all the filtered data after the last one
+    const unsigned char levelFlags[4][2] = { { 0x78, 0x01 }, { 0x78, 0x5e }, { 0x78, 0x9c }, { 0x78, 0xda } };
+    int flags = level <= 1 ? 0 : level <= 5 ? 1 : level == 6 ? 2 : 3;
+    bands[0].data.insert(bands[0].data.begin(), levelFlags[flags], levelFlags[flags] + 2);
+
+    uint32_t adler = bands[0].adler;
+    for (int b = 1; b < bandCount; ++b)
+        adler = CombineAdler32(adler, bands[b].adler, bands[b].filteredSize);
+    vector<unsigned char> &tail = bands[bandCount - 1].data;
+    tail.push_back(0x03);                   // last block, fixed Huffman, empty
+    tail.push_back(0x00);
+    PutBigEndian(tail, adler);
+
+    ThreadPool::ParallelFor(pool, 0, bandCount, 1, [&](int first, int last) {
+        for (int b = first; b < last; ++b)
+            bands[b].crc = ChunkCrc("IDAT", bands[b].data.data(), bands[b].data.size());
+    });
+
+    png.clear();
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    png.insert(png.end(), signature, signature + 8);
+
+    vector<unsigned char> header;
+    PutBigEndian(header, (uint32_t)width);
+    PutBigEndian(header, (uint32_t)height);
+    header.push_back(8);                    // bits per channel
+    header.push_back(2);                    // RGB
+    header.push_back(0);                    // deflate
+    header.push_back(0);                    // adaptive filtering
+    header.push_back(0);                    // no interlacing
+    PutChunk(png, "IHDR", header.data(), header.size(), ChunkCrc("IHDR", header.data(), header.size()));
+
+    for (int b = 0; b < bandCount; ++b)
+        PutChunk(png, "IDAT", bands[b].data.data(), bands[b].data.size(), bands[b].crc);
+    PutChunk(png, "IEND", 0, 0, ChunkCrc("IEND", 0, 0));
+}
+
+bool WritePng(const string &fileName, int width, int height,
+              const unsigned char *rgb, int level, ThreadPool *pool)
+{
+    vector<unsigned char> png;
+    {
+        TraceScope scope("png encode");
+        EncodePng(width, height, rgb, level, pool, png);
+    }
+
+    TraceScope scope("file write");
+    FILE *file = fopen(fileName.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(png.data(), 1, png.size(), file) == png.size();
+    return fclose(file) == 0 && written;
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,36 @@
+// ==========================================================================
+// PNG Encoder Support Code
+//  - 8-bit RGB PNG output with per-row adaptive filtering
+//  - the image is split into bands of rows that are filtered and deflated
+//    in parallel; every band ends on a byte boundary with an empty stored
+//    block, so the compressed bands join into one valid zlib stream
+//  - each band becomes its own IDAT chunk, so chunk checksums are
+//    computed in parallel as well
+//
+// Matches never reach back across a band boundary, which costs a little
+// compression compared to a single stream.
+// ==========================================================================
+#ifndef PNGENCODER_H
+#define PNGENCODER_H
+
+#include <vector>
+#include <string>
+
+class ThreadPool;
+
+// 0 stores the data uncompressed, 1 is fastest, 9 searches hardest
+const int DefaultPngLevel = 6;
+
+// encodes width x height RGB pixels (3 bytes each, top row first) into a
+// complete PNG file in png; with a pool the bands are spread over its
+// threads, otherwise everything runs on the caller's thread
+void EncodePng(int width, int height, const unsigned char *rgb, int level,
+               ThreadPool *pool, std::vector<unsigned char> &png);
+
+// encodes as above and writes the result to fileName; returns false if
+// the file could not be written
+bool WritePng(const std::string &fileName, int width, int height,
+              const unsigned char *rgb, int level, ThreadPool *pool);
+
+// --------------------------------------------------------------------------
+#endif // PNGENCODER_H
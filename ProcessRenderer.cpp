@@ -0,0 +1,220 @@
+// ==========================================================================
+// Process Renderer Support Code
+// ==========================================================================
+
+#include "ProcessRenderer.h"
+#include "Raytracer.h"
+#include "ThreadPool.h"
+#include "Arena.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // start of the shared block; the done flags follow it and the pixels
+    // start at the next cache line after them
+    struct SharedHeader
+    {
+        atomic<int> nextTile;       // next entry of the tile order to claim
+        int         tileCount;
+    };
+
+    size_t AlignUp(size_t size, size_t alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    // traces one tile straight into the row-major framebuffer
+    void RenderTile(const Scene &scene, int palette, const Camera &camera, int tile, int tilesX,
+                    int *candidates, glm::vec3 *pixels)
+    {
+        int x0 = (tile % tilesX) * TileSize;
+        int y0 = (tile / tilesX) * TileSize;
+        int x1 = min(x0 + TileSize, camera.width);
+        int y1 = min(y0 + TileSize, camera.height);
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+                pixels[(size_t)y * camera.width + x] =
+                    TracePixel(scene, palette, camera.PrimaryRay(x, y), candidates);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+ProcessRenderer::ProcessRenderer(int processes)
+    : m_processes(max(processes, 1)), m_memory(0), m_size(0)
+{
+}
+
+ProcessRenderer::~ProcessRenderer()
+{
+    Unmap();
+}
+
+#ifndef _WIN32
+
+bool ProcessRenderer::Map(size_t size)
+{
+    if (m_memory && m_size >= size)
+        return true;
+    Unmap();
+
+    // the name is only needed until the block is mapped; the children get
+    // the mapping itself through fork
+    string name = "/raytrace-" + to_string((long long)getpid());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        cout << "ERROR: Could not create shared memory " << name << endl;
+        return false;
+    }
+    shm_unlink(name.c_str());
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+        memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        cout << "ERROR: Could not map " << size / (1024 * 1024) << " MB of shared memory" << endl;
+        return false;
+    }
+    m_memory = memory;
+    m_size = size;
+    return true;
+}
+
+void ProcessRenderer::Unmap()
+{
+    if (m_memory)
+        munmap(m_memory, m_size);
+    m_memory = 0;
+    m_size = 0;
+}
+
+bool ProcessRenderer::Render(const Scene &scene, int palette, const Camera &camera,
+                             vector<glm::vec3> &pixels, ThreadPool *pool)
+{
+    int tilesX = (camera.width + TileSize - 1) / TileSize;
+    int tilesY = (camera.height + TileSize - 1) / TileSize;
+    int tileCount = tilesX * tilesY;
+    size_t pixelOffset = AlignUp(sizeof(SharedHeader) + tileCount * sizeof(int), 64);
+    size_t pixelCount = (size_t)camera.width * camera.height;
+    if (!Map(pixelOffset + pixelCount * sizeof(glm::vec3)))
+        return false;
+
+    char *memory = static_cast<char *>(m_memory);
+    SharedHeader *header = new (memory) SharedHeader;
+    header->nextTile.store(0);
+    header->tileCount = tileCount;
+    int *done = reinterpret_cast<int *>(memory + sizeof(SharedHeader));
+    fill(done, done + tileCount, 0);
+    glm::vec3 *framebuffer = reinterpret_cast<glm::vec3 *>(memory + pixelOffset);
+
+    // the order is made before forking, so every child reads the same one
+    vector<int> order(tileCount);
+    MortonTileOrder(tilesX, tilesY, &order[0]);
+
+    vector<pid_t> children;
+    for (int p = 0; p < m_processes; p++)
+    {
+        pid_t child = fork();
+        if (child < 0)
+        {
+            cout << "ERROR: Could not start render process " << p << endl;
+            break;
+        }
+        if (child == 0)
+        {
+            // only this thread exists in the child; it claims tiles until
+            // none are left and leaves without running any exit handlers
+            Arena &arena = ThreadArena();
+            ArenaScope scope(arena);
+            int *candidates = arena.Allocate<int>(max(scene.bvh.PrimitiveCount(), 1));
+            for (int n = header->nextTile.fetch_add(1); n < tileCount; n = header->nextTile.fetch_add(1))
+            {
+                RenderTile(scene, palette, camera, order[n], tilesX, candidates, framebuffer);
+                done[order[n]] = 1;
+            }
+            _exit(0);
+        }
+        children.push_back(child);
+    }
+
+    // waiting for a child also makes everything it wrote visible here
+    TraceScope waitScope("wait for processes");
+    int failed = 0;
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        int status = 0;
+        if (waitpid(children[c], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            if (WIFSIGNALED(status))
+                cout << "render process " << children[c] << " died with signal " << WTERMSIG(status) << endl;
+            else
+                cout << "render process " << children[c] << " failed" << endl;
+            failed++;
+        }
+    }
+
+    // whatever was left unfinished, including everything if no child
+    // could be started, is rendered here
+    vector<int> missing;
+    for (int t = 0; t < tileCount; t++)
+        if (!done[t])
+            missing.push_back(t);
+    if (!missing.empty())
+    {
+        if (failed > 0 || children.empty())
+            cout << "rendering " << missing.size() << " unfinished tiles again" << endl;
+        ThreadPool::ParallelFor(pool, 0, (int)missing.size(), 1, [&](int first, int last) {
+            Arena &arena = ThreadArena();
+            ArenaScope scope(arena);
+            int *candidates = arena.Allocate<int>(max(scene.bvh.PrimitiveCount(), 1));
+            for (int i = first; i < last; i++)
+                RenderTile(scene, palette, camera, missing[i], tilesX, candidates, framebuffer);
+        });
+    }
+
+    pixels.assign(framebuffer, framebuffer + pixelCount);
+    return true;
+}
+
+#else
+
+bool ProcessRenderer::Map(size_t)
+{
+    return false;
+}
+
+void ProcessRenderer::Unmap()
+{
+}
+
+bool ProcessRenderer::Render(const Scene &, int, const Camera &, vector<glm::vec3> &, ThreadPool *)
+{
+    cout << "ERROR: Rendering with processes needs fork and POSIX shared memory" << endl;
+    return false;
+}
+
+#endif
+
+// --------------------------------------------------------------------------
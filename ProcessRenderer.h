@@ -0,0 +1,58 @@
+// ==========================================================================
+// Process Renderer Support Code
+//  - renders a frame with forked processes instead of threads, for
+//    isolation and for hosts with several memory nodes
+//  - the children see the parent's scene and hierarchy through the pages
+//    fork shares with them; nothing writes to those, so they stay shared
+//    and are never copied
+//  - tiles are claimed from a counter in a POSIX shared-memory block and
+//    written straight into the framebuffer kept in the same block, which
+//    the parent reads the finished image from
+//  - a child that crashes only loses the tiles it had not finished; the
+//    parent renders those again itself
+//
+// Each child traces on its own thread and allocates its scratch memory
+// after the fork, so it stays on the memory node the child runs on.
+// ==========================================================================
+#ifndef PROCESSRENDERER_H
+#define PROCESSRENDERER_H
+
+#include <vector>
+#include <cstddef>
+#include <glm/vec3.hpp>
+
+struct Scene;
+struct Camera;
+class ThreadPool;
+
+class ProcessRenderer
+{
+    int    m_processes;
+    void  *m_memory;        // the shared block, mapped in the parent
+    size_t m_size;
+
+    // makes sure the shared block holds at least size bytes
+    bool Map(size_t size);
+    void Unmap();
+
+    ProcessRenderer(const ProcessRenderer &);
+    ProcessRenderer &operator=(const ProcessRenderer &);
+
+public:
+    explicit ProcessRenderer(int processes);
+    ~ProcessRenderer();
+
+    int Processes() const { return m_processes; }
+
+    // renders the whole image with the child processes into pixels,
+    // row-major and bottom row first, exactly as RenderTiles would; the
+    // tiles of any child that failed or could not be started are rendered
+    // on pool afterwards. Returns false, leaving pixels alone, only if the
+    // shared memory could not be created or the system has no fork and
+    // POSIX shared memory.
+    bool Render(const Scene &scene, int palette, const Camera &camera,
+                std::vector<glm::vec3> &pixels, ThreadPool *pool);
+};
+
+// --------------------------------------------------------------------------
+#endif // PROCESSRENDERER_H
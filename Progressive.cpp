@@ -0,0 +1,118 @@
+// ==========================================================================
+// Progressive Rendering Support Code
+// ==========================================================================
+
+#include "Progressive.h"
+#include "Raytracer.h"
+#include "ThreadPool.h"
+#include "Arena.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // the first pass traces one ray per block of this many pixels square;
+    // each following coarse pass halves it
+    const int CoarsestBlock = 8;
+    const int CoarsePasses = 3;
+
+    // offset of sample s from the pixel's own ray, in pixels; sample 0 is
+    // that ray, the others follow the R2 sequence, which covers the pixel
+    // evenly however many of them there are
+    void SampleOffset(int s, float &dx, float &dy)
+    {
+        dx = s == 0 ? 0.0f : (float)fmod(0.5 + 0.7548776662466927 * s, 1.0);
+        dy = s == 0 ? 0.0f : (float)fmod(0.5 + 0.5698402909980532 * s, 1.0);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+ProgressiveStats ProgressiveRenderer::Render(const Scene &scene, int palette, const Camera &camera,
+                                             chrono::steady_clock::time_point deadline,
+                                             vector<glm::vec3> &pixels, ThreadPool *pool)
+{
+    int width = camera.width;
+    int height = camera.height;
+    size_t pixelCount = (size_t)width * height;
+    pixels.resize(pixelCount);
+    m_sums.assign(pixelCount, glm::vec3(0.0f));
+    m_counts.assign(pixelCount, 0);
+
+    int tilesX = (width + TileSize - 1) / TileSize;
+    int tilesY = (height + TileSize - 1) / TileSize;
+    int tileCount = tilesX * tilesY;
+    m_order.resize(tileCount);
+    MortonTileOrder(tilesX, tilesY, &m_order[0]);
+
+    ProgressiveStats stats = { CoarsestBlock, 0, 1.0 };
+    for (int pass = 0; pass < CoarsePasses + MaxProgressiveSamples; pass++)
+    {
+        int block = pass < CoarsePasses ? CoarsestBlock >> pass : 1;
+        int sample = pass - CoarsePasses;
+        TraceScope passScope("progressive pass", pass);
+
+        atomic<int> reached(0);
+        ThreadPool::ParallelFor(pool, 0, tileCount, 1, [&](int first, int last) {
+            Arena &arena = ThreadArena();
+            ArenaScope scope(arena);
+            int *candidates = arena.Allocate<int>(max(scene.bvh.PrimitiveCount(), 1));
+            for (int n = first; n < last; n++)
+            {
+                if (pass > 0 && chrono::steady_clock::now() >= deadline)
+                    continue;
+                reached++;
+                int x0 = (m_order[n] % tilesX) * TileSize, x1 = min(x0 + TileSize, width);
+                int y0 = (m_order[n] / tilesX) * TileSize, y1 = min(y0 + TileSize, height);
+
+                // coarse: one ray per block, skipping the blocks a coarser
+                // pass has already traced, spread over the whole block. The
+                // ray is the pixel's own, so it also counts as its first
+                // sample.
+                for (int y = y0; sample < 0 && y < y1; y += block)
+                    for (int x = x0; x < x1; x += block)
+                    {
+                        if (pass > 0 && x % (2 * block) == 0 && y % (2 * block) == 0)
+                            continue;
+                        size_t i = (size_t)y * width + x;
+                        glm::vec3 colour = TracePixel(scene, palette, camera.PrimaryRay(x, y), candidates);
+                        m_sums[i] = colour;
+                        m_counts[i] = 1;
+                        for (int by = y; by < min(y + block, y1); by++)
+                            fill(&pixels[(size_t)by * width + x], &pixels[(size_t)by * width + min(x + block, x1)], colour);
+                    }
+
+                // refining: one more sample in every pixel that lacks it
+                float dx, dy;
+                SampleOffset(max(sample, 0), dx, dy);
+                glm::vec3 offset(dx * 2.0f / width, dy * 2.0f / height, 0.0f);
+                for (int y = y0; sample >= 0 && y < y1; y++)
+                    for (int x = x0; x < x1; x++)
+                    {
+                        size_t i = (size_t)y * width + x;
+                        if (m_counts[i] > sample)
+                            continue;
+                        m_sums[i] += TracePixel(scene, palette, camera.PrimaryRay(x, y) + offset, candidates);
+                        m_counts[i]++;
+                        pixels[i] = m_sums[i] / (float)m_counts[i];
+                    }
+            }
+        });
+
+        stats.lastPass = (double)reached / tileCount;
+        if (reached < tileCount)
+            break;
+        stats.blockSize = block;
+        stats.samples = max(sample + 1, 0);
+    }
+    return stats;
+}
+
+// --------------------------------------------------------------------------
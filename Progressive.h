@@ -0,0 +1,58 @@
+// ==========================================================================
+// Progressive Rendering Support Code
+//  - renders a frame against a deadline instead of to completion, for
+//    previews that must take the same time whatever the scene
+//  - a coarse pass (one ray per 8x8 block) always runs to the end, so
+//    there is a complete image however early the deadline comes; finer
+//    passes (4x4, 2x2, every pixel) then replace it, and every pass after
+//    that adds one more anti-aliasing sample per pixel
+//  - the deadline is checked before each tile, so a pass that runs out of
+//    time leaves the tiles it did not reach as the previous pass made them
+//
+// The first sample of every pixel is the ray the normal renderer traces,
+// so a budget that only reaches full resolution gives the usual image.
+// ==========================================================================
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <glm/vec3.hpp>
+
+struct Scene;
+struct Camera;
+class ThreadPool;
+
+// samples per pixel after which refining stops even with time left
+const int MaxProgressiveSamples = 64;
+
+struct ProgressiveStats
+{
+    int    blockSize;       // of the finest pass completed, 1 for full resolution
+    int    samples;         // per pixel, in every pixel
+    double lastPass;        // fraction of the tiles the last pass reached
+};
+
+class ProgressiveRenderer
+{
+    std::vector<glm::vec3> m_sums;      // of each pixel's samples
+    std::vector<uint16_t>  m_counts;    // samples in each sum
+    std::vector<int>       m_order;     // tiles in Z-order
+
+    ProgressiveRenderer(const ProgressiveRenderer &);
+    ProgressiveRenderer &operator=(const ProgressiveRenderer &);
+
+public:
+    ProgressiveRenderer() {}
+
+    // refines the image of scene in pixels (row-major, bottom row first)
+    // until deadline or MaxProgressiveSamples; only the first pass may run
+    // past the deadline
+    ProgressiveStats Render(const Scene &scene, int palette, const Camera &camera,
+                            std::chrono::steady_clock::time_point deadline,
+                            std::vector<glm::vec3> &pixels, ThreadPool *pool);
+};
+
+// --------------------------------------------------------------------------
+#endif // PROGRESSIVE_H
@@ -0,0 +1,863 @@
+// ==========================================================================
+// Ray Tracing Support Code
+//
+// Every surface is shaded with the same ambient plus diffuse term and a
+// specular lobe around the light direction. Spheres are tested first, then
+// the triangles the BVH reports, then the planes; a later surface only
+// takes over a pixel if it is closer than what the pixel shows so far.
+// ==========================================================================
+
+#include "Raytracer.h"
+#include "PathTracer.h"
+#include "ThreadPool.h"
+#include "Arena.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <climits>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // interleaves the low 16 bits of x and y, x in the even bits
+    uint32_t SpreadBits(uint32_t v)
+    {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    uint32_t CompactBits(uint32_t v)
+    {
+        v &= 0x55555555;
+        v = (v | (v >> 1)) & 0x33333333;
+        v = (v | (v >> 2)) & 0x0f0f0f0f;
+        v = (v | (v >> 4)) & 0x00ff00ff;
+        v = (v | (v >> 8)) & 0x0000ffff;
+        return v;
+    }
+
+    uint32_t MortonEncode(uint32_t x, uint32_t y) { return SpreadBits(x) | (SpreadBits(y) << 1); }
+    int MortonDecodeX(uint32_t code) { return (int)CompactBits(code); }
+    int MortonDecodeY(uint32_t code) { return (int)CompactBits(code >> 1); }
+
+    // reads the values of an object block whose opening brace comes next;
+    // blocks whose first value is the placeholder (as in the syntax summary
+    // at the top of each scene file) are skipped
+    bool ReadValues(ifstream &file, const char *placeholder, float *values, int count)
+    {
+        string word;
+        file >> word;
+        if (word != "{")
+            return false;
+        file >> word;
+        if (word == placeholder)
+            return false;
+        values[0] = (float)atof(word.c_str());
+        for (int i = 1; i < count; i++) {
+            file >> word;
+            values[i] = (float)atof(word.c_str());
+        }
+        return true;
+    }
+
+    // geometry and colour of the surface a primary ray ended on, worked
+    // out once per pixel from what the tracer kept of the winning primitive;
+    // t is the ray parameter of the hit for triangles and planes
+    void FillSurfaceAovs(const Scene &scene, int palette, const glm::vec3 &direction,
+                         PrimitiveType type, int index, float t, SurfaceAovs &aovs)
+    {
+        int objectId = 1 + index;
+        if (type == SpherePrimitive) {
+            // the tracer only keeps how close the ray passes to the centre,
+            // so take the nearer root of |t d - c| = r here; its closeness
+            // test is looser than the true one, and rays that pass the test
+            // but miss the sphere use their closest approach instead
+            const Sphere &sphere = scene.spheres[index];
+            float a = glm::dot(direction, direction);
+            float b = glm::dot(direction, sphere.centre);
+            float c = glm::dot(sphere.centre, sphere.centre) - sphere.radius * sphere.radius;
+            t = (b - sqrt(max(b * b - a * c, 0.0f))) / a;
+            aovs.position = t * direction;
+            aovs.normal = glm::normalize(aovs.position - sphere.centre);
+        } else if (type == TrianglePrimitive) {
+            const Triangle &tri = scene.triangles[index];
+            aovs.position = t * direction;
+            aovs.normal = glm::normalize(glm::cross(tri.v[1] - tri.v[0], tri.v[2] - tri.v[0]));
+            objectId += (int)scene.spheres.size();
+        } else {
+            aovs.position = t * direction;
+            aovs.normal = glm::normalize(scene.planes[index].normal);
+            objectId += (int)(scene.spheres.size() + scene.triangles.size());
+        }
+        aovs.depth = -aovs.position.z;
+        aovs.objectId = (float)objectId;
+
+        Material material;
+        if (SceneMaterial(palette, type, index, material))
+            aovs.albedo = glm::vec3((float)material.colour[0], (float)material.colour[1],
+                                    (float)material.colour[2]);
+    }
+
+    // a file name as a scene file gives it, quoted or not, with relative
+    // ones resolved against the scene file's directory
+    string SceneFilePath(const string &sceneFile, string name)
+    {
+        if (name.size() >= 2 && name[0] == '"' && name[name.size() - 1] == '"')
+            name = name.substr(1, name.size() - 2);
+        size_t slash = sceneFile.find_last_of("/\\");
+        if (!name.empty() && slash != string::npos && name[0] != '/')
+            name = sceneFile.substr(0, slash + 1) + name;
+        return name;
+    }
+
+    // reads a texture block, { type index file scale }, whose opening
+    // brace comes next; like ReadValues it skips the syntax summary
+    bool ReadTexture(ifstream &file, const string &sceneFile, SceneTexture &texture)
+    {
+        string word;
+        vector<string> words;
+        file >> word;
+        if (word != "{")
+            return false;
+        while (file >> word && word != "}")
+            words.push_back(word);
+        if (words.size() != 4 || words[0] == "type")
+            return false;
+
+        if (words[0] == "sphere")
+            texture.type = SpherePrimitive;
+        else if (words[0] == "plane")
+            texture.type = PlanePrimitive;
+        else if (words[0] == "triangle")
+            texture.type = TrianglePrimitive;
+        else {
+            cout << "Unknown texture primitive " << words[0] << " (use sphere, plane or triangle)" << endl;
+            return false;
+        }
+        texture.index = atoi(words[1].c_str());
+        texture.fileName = SceneFilePath(sceneFile, words[2]);
+        if (texture.fileName.empty())
+            return false;
+        texture.scale = (float)atof(words[3].c_str());
+        if (texture.scale <= 0.0f)
+            texture.scale = 1.0f;
+        texture.id = -1;
+        return true;
+    }
+
+    struct PaletteEntry
+    {
+        int           palette;
+        PrimitiveType type;
+        int           end;          // entry covers indices below this one
+        Material      material;
+    };
+
+    // entries of the same palette and type are listed by increasing end
+    const PaletteEntry Palette[] = {
+        // scene one: grey sphere, blue pyramid, white ceiling, green and
+        // red walls, grey floor and back wall
+        { 1, SpherePrimitive,   INT_MAX, { { 0.3, 0.3, 0.3 }, 10000 } },
+        { 1, TrianglePrimitive, 4,       { { 0.0, 0.0, 1.0 }, 10 } },
+        { 1, TrianglePrimitive, 6,       { { 1.0, 1.0, 1.0 }, 1000 } },
+        { 1, TrianglePrimitive, 8,       { { 0.0, 1.0, 0.0 }, 1000 } },
+        { 1, TrianglePrimitive, 10,      { { 1.0, 0.0, 0.0 }, 1000 } },
+        { 1, TrianglePrimitive, 12,      { { 0.5, 0.5, 0.5 }, 1000 } },
+        { 1, PlanePrimitive,    INT_MAX, { { 0.7, 0.7, 0.7 }, 1000 } },
+
+        // scene two: yellow, grey and magenta spheres, green icosahedron,
+        // red cone, grey floor and back wall
+        { 2, SpherePrimitive,   1,       { { 1.0, 1.0, 0.0 }, 1000 } },
+        { 2, SpherePrimitive,   2,       { { 0.7, 0.7, 0.7 }, 1000 } },
+        { 2, SpherePrimitive,   3,       { { 1.0, 0.0, 1.0 }, 1000 } },
+        { 2, TrianglePrimitive, 12,      { { 0.0, 1.0, 0.0 }, 1000 } },
+        { 2, TrianglePrimitive, 32,      { { 1.0, 0.0, 0.0 }, 1000 } },
+        { 2, PlanePrimitive,    INT_MAX, { { 0.7, 0.7, 0.7 }, 1000 } },
+
+        // scene three: scene one's room in other colours plus a yellow shape
+        { 3, SpherePrimitive,   INT_MAX, { { 0.0, 0.7, 0.7 }, 10000 } },
+        { 3, TrianglePrimitive, 4,       { { 0.0, 0.0, 1.0 }, 10 } },
+        { 3, TrianglePrimitive, 6,       { { 1.0, 1.0, 1.0 }, 1000 } },
+        { 3, TrianglePrimitive, 8,       { { 0.0, 1.0, 0.0 }, 1000 } },
+        { 3, TrianglePrimitive, 10,      { { 1.0, 0.0, 0.0 }, 1000 } },
+        { 3, TrianglePrimitive, 12,      { { 0.5, 0.5, 0.5 }, 1000 } },
+        { 3, TrianglePrimitive, 32,      { { 0.7, 0.7, 0.0 }, 1000 } },
+        { 3, PlanePrimitive,    INT_MAX, { { 0.0, 0.0, 0.7 }, 1000 } },
+    };
+}
+
+// --------------------------------------------------------------------------
+
+bool LoadScene(const string &fileName, Scene &scene)
+{
+    scene.lights.clear();
+    scene.spheres.clear();
+    scene.planes.clear();
+    scene.triangles.clear();
+    scene.textures.clear();
+    scene.environment.clear();
+
+    ifstream file(fileName.c_str());
+    if (!file.is_open()) {
+        cout << "ERROR: Could not open scene file " << fileName << endl;
+        return false;
+    }
+
+    float values[9];
+    string word;
+    while (file >> word) {
+        if (word == "light") {
+            if (ReadValues(file, "x", values, 3))
+                scene.lights.push_back(glm::vec3(values[0], values[1], values[2]));
+        } else if (word == "sphere") {
+            if (ReadValues(file, "x", values, 4)) {
+                Sphere sphere = { glm::vec3(values[0], values[1], values[2]), values[3] };
+                scene.spheres.push_back(sphere);
+            }
+        } else if (word == "plane") {
+            if (ReadValues(file, "xn", values, 6)) {
+                Plane plane = { glm::vec3(values[0], values[1], values[2]),
+                                glm::vec3(values[3], values[4], values[5]) };
+                scene.planes.push_back(plane);
+            }
+        } else if (word == "triangle") {
+            if (ReadValues(file, "x1", values, 9)) {
+                Triangle triangle;
+                for (int k = 0; k < 3; k++)
+                    triangle.v[k] = glm::vec3(values[3*k], values[3*k+1], values[3*k+2]);
+                scene.triangles.push_back(triangle);
+            }
+        } else if (word == "texture") {
+            SceneTexture texture;
+            if (ReadTexture(file, fileName, texture))
+                scene.textures.push_back(texture);
+        } else if (word == "environment") {
+            // a file name on its own, with no braces
+            string name;
+            if (file >> name && name != "{")
+                scene.environment = SceneFilePath(fileName, name);
+        }
+    }
+    return true;
+}
+
+void TriangleBounds(const Scene &scene, vector<AABB> &boxes)
+{
+    boxes.resize(scene.triangles.size());
+    for (size_t i = 0; i < scene.triangles.size(); i++) {
+        AABB box;
+        for (int k = 0; k < 3; k++)
+            box.Grow(scene.triangles[i].v[k]);
+        glm::vec3 pad = 1e-4f * (box.upper - box.lower) + glm::vec3(1e-5f);
+        boxes[i] = AABB(box.lower - pad, box.upper + pad);
+    }
+}
+
+bool SceneMaterial(int palette, PrimitiveType type, int index, Material &material)
+{
+    for (size_t i = 0; i < sizeof(Palette) / sizeof(Palette[0]); i++) {
+        const PaletteEntry &entry = Palette[i];
+        if (entry.palette == palette && entry.type == type && index < entry.end) {
+            material = entry.material;
+            return true;
+        }
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------------
+
+float Camera::ImageX(int x) const
+{
+    return (2*((float)x/width))-1;
+}
+
+float Camera::ImageY(int y) const
+{
+    // the bottom two rows share y = -1, as they always have
+    return (y == 0) ? -1.0f : (2*((float)(y-1)/height))-1;
+}
+
+glm::vec3 Camera::PrimaryRay(int x, int y) const
+{
+    return glm::vec3(ImageX(x), ImageY(y), -2.0f);
+}
+
+// --------------------------------------------------------------------------
+
+bool IntersectSphere(const Sphere &sphere, const glm::vec3 &direction,
+                     const glm::vec3 &light, PrimitiveHit &hit)
+{
+    float normalx = 0.0; float normaly = 0.0; float normalz = 0.0;
+    float nx = 0.0; float ny = 0.0; float nz = 0.0;
+    float ix = 0.0; float iy = 0.0; float iz = 0.0;
+    float nix = 0.0; float niy = 0.0; float niz = 0.0;
+    float hx = 0.0; float hy = 0.0; float hz = 0.0;
+    float scale = 0.0;
+
+    float proj = 0;
+    float projecton[3];
+
+    proj = ( (sphere.centre[0] * direction[0])
+    + (sphere.centre[1] * direction[1])
+    + (sphere.centre[2] * direction[2]) )/
+    (pow((pow(direction[0], 2.0)+pow(direction[1], 2.0)+pow(direction[2], 2.0)), 2.0 ));
+
+    projecton[0] = proj*direction[0];
+    projecton[1] = proj*direction[1];
+    projecton[2] = proj*direction[2];
+    proj = sqrt(pow(direction[0]-projecton[0], 2.0)+pow(direction[1]-projecton[1], 2.0)+pow(direction[2]-projecton[2], 2.0));
+
+    //unflatten sphere attempt
+    //proj = proj - sqrt( pow(sphere.radius,2.0) - pow(sqrt(pow((projecton[0] - sphere.centre[0]),2.0) + pow((projecton[1] - sphere.centre[1]),2.0) + pow((projecton[2] - sphere.centre[2]),2.0)), 2.0) );
+
+    if (proj < 0) {proj = proj * -1;}
+
+    scale = sqrt(pow(direction[0],2) + pow(direction[1],2) + pow(direction[2],2)) - proj;
+    ix = direction[0] - scale; iy = direction[1] - scale; iz = direction[2] - scale;
+
+    normalx = ix - sphere.centre[0];
+    normaly = iy - sphere.centre[1];
+    normalz = iz - sphere.centre[2];
+
+    nx = normalx/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
+    ny = normaly/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
+    nz = normalz/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
+
+    ix = light[0] - ix; iy = light[1] - iy; iz = light[2] - iz;
+
+    nix = ix/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+    niy = iy/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+    niz = iz/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+
+    hit.dot = -((nx * nix) + (ny * niy) + (nz * niz));
+
+    hx = (light[0])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+    hy = (light[1])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+    hz = (light[2])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+
+    hit.dot2 = -((nx * hx) + (ny * hy) + (nz * hz));
+    hit.depth = proj;
+
+    return proj <= (float)sphere.radius;
+}
+
+bool IntersectTriangle(const Triangle &tri, const glm::vec3 &direction,
+                       const glm::vec3 &light, PrimitiveHit &hit)
+{
+    float normalx = 0.0; float normaly = 0.0; float normalz = 0.0;
+    float nx = 0.0; float ny = 0.0; float nz = 0.0;
+    float ix = 0.0; float iy = 0.0; float iz = 0.0;
+    float nix = 0.0; float niy = 0.0; float niz = 0.0;
+    float hx = 0.0; float hy = 0.0; float hz = 0.0;
+    float scale = 0.0;
+
+    float t = 0.0;
+    float u = 0.0;
+    float v = 0.0;
+
+    float a = 0.0; float b = 0.0; float c = 0.0;
+    float d = 0.0; float e = 0.0; float f = 0.0;
+    float g = 0.0; float h = 0.0; float k = 0.0;
+
+    //p + t * d = (1-u-v) * p0 + u * p1 + v * p2
+    a = -tri.v[0][0]; b = tri.v[1][0] - tri.v[0][0]; c = tri.v[2][0] - tri.v[0][0];
+    d = -tri.v[0][1]; e = tri.v[1][1] - tri.v[0][1]; f = tri.v[2][1] - tri.v[0][1];
+    g = -tri.v[0][2]; h = tri.v[1][2] - tri.v[0][2]; k = tri.v[2][2] - tri.v[0][2];
+
+    t = a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g));
+
+    a = -direction[0]; b = tri.v[1][0] - tri.v[0][0]; c = tri.v[2][0] - tri.v[0][0];
+    d = -direction[1]; e = tri.v[1][1] - tri.v[0][1]; f = tri.v[2][1] - tri.v[0][1];
+    g = -direction[2]; h = tri.v[1][2] - tri.v[0][2]; k = tri.v[2][2] - tri.v[0][2];
+
+    t = t/(a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g)));
+
+
+    a = -direction[0]; b = -tri.v[0][0]; c = tri.v[2][0] - tri.v[0][0];
+    d = -direction[1]; e = -tri.v[0][1]; f = tri.v[2][1] - tri.v[0][1];
+    g = -direction[2]; h = -tri.v[0][2]; k = tri.v[2][2] - tri.v[0][2];
+    u = a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g));
+
+    a = -direction[0]; b = tri.v[1][0] - tri.v[0][0]; c = tri.v[2][0] - tri.v[0][0];
+    d = -direction[1]; e = tri.v[1][1] - tri.v[0][1]; f = tri.v[2][1] - tri.v[0][1];
+    g = -direction[2]; h = tri.v[1][2] - tri.v[0][2]; k = tri.v[2][2] - tri.v[0][2];
+
+    u = u/(a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g)));
+
+
+    a = -direction[0]; b = tri.v[1][0] - tri.v[0][0]; c = -tri.v[0][0];
+    d = -direction[1]; e = tri.v[1][1] - tri.v[0][1]; f = -tri.v[0][1];
+    g = -direction[2]; h = tri.v[1][2] - tri.v[0][2]; k = -tri.v[0][2];
+    v = a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g));
+
+    a = -direction[0]; b = tri.v[1][0] - tri.v[0][0]; c = tri.v[2][0] - tri.v[0][0];
+    d = -direction[1]; e = tri.v[1][1] - tri.v[0][1]; f = tri.v[2][1] - tri.v[0][1];
+    g = -direction[2]; h = tri.v[1][2] - tri.v[0][2]; k = tri.v[2][2] - tri.v[0][2];
+
+    v = v/(a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g)));
+
+    normalx = (tri.v[1][1] - tri.v[0][1]) * (tri.v[2][2] - tri.v[0][2]) - (tri.v[1][2] - tri.v[0][2]) * (tri.v[2][1] - tri.v[0][1]);
+    normaly = (tri.v[1][2] - tri.v[0][2]) * (tri.v[2][0] - tri.v[0][0]) - (tri.v[1][0] - tri.v[0][0]) * (tri.v[2][2] - tri.v[0][2]);
+    normalz = (tri.v[1][0] - tri.v[0][0]) * (tri.v[2][1] - tri.v[0][1]) - (tri.v[1][1] - tri.v[0][1]) * (tri.v[2][0] - tri.v[0][0]);
+
+    nx = normalx/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
+    ny = normaly/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
+    nz = normalz/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
+
+    scale = sqrt(pow(direction[0],2) + pow(direction[1],2) + pow(direction[2],2)) - t;
+    ix = direction[0] - scale; iy = direction[1] - scale; iz = direction[2] - scale;
+    ix = light[0] - ix; iy = light[1] - iy; iz = light[2] - iz;
+
+    nix = ix/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+    niy = iy/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+    niz = iz/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+
+    hit.dot = -((nx * nix) + (ny * niy) + (nz * niz));
+
+    hx = (light[0])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+    hy = (light[1])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+    hz = (light[2])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+
+    hit.dot2 = -((nx * hx) + (ny * hy) + (nz * hz));
+    hit.depth = t;
+
+    return u >= 0 && v >= 0 && u+v <= 1.0;
+}
+
+bool IntersectPlane(const Plane &plane, const glm::vec3 &direction,
+                    const glm::vec3 &light, PrimitiveHit &hit)
+{
+    float ix = 0.0; float iy = 0.0; float iz = 0.0;
+    float nix = 0.0; float niy = 0.0; float niz = 0.0;
+    float hx = 0.0; float hy = 0.0; float hz = 0.0;
+    float scale = 0.0;
+    float t = 0.0;
+
+    t = ((plane.point[0] * plane.normal[0]) + (plane.point[1] * plane.normal[1]) + (plane.point[2] * plane.normal[2]))/
+    ((direction[0] * plane.normal[0]) + (direction[1] * plane.normal[1]) + (direction[2] * plane.normal[2]));
+
+    scale = sqrt(pow(direction[0],2) + pow(direction[1],2) + pow(direction[2],2)) - t;
+    ix = direction[0] - scale; iy = direction[1] - scale; iz = direction[2] - scale;
+    ix = light[0] - ix; iy = light[1] - iy; iz = light[2] - iz;
+
+    nix = ix/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+    niy = iy/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+    niz = iz/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
+
+    hit.dot = -((plane.normal[0] * nix) + (plane.normal[1] * niy) + (plane.normal[2] * niz));
+
+    hx = (light[0])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+    hy = (light[1])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+    hz = (light[2])/sqrt(pow(light[0],2) + pow(light[1],2) + pow((light[2]),2));
+
+    hit.dot2 = -((plane.normal[0] * hx) + (plane.normal[1] * hy) + (plane.normal[2] * hz));
+    hit.depth = t;
+
+    return true;
+}
+
+void Shade(const Material &material, float dot, float dot2, float colour[3])
+{
+    for (int c = 0; c < 3; c++) {
+        double w = material.colour[c];
+        colour[c] = (w == 0.0) ? 0.0 : w*(0.5+(0.5*max(0.0f,dot))) + 0.5*w*pow(dot2,material.shininess);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+glm::vec3 TracePixel(const Scene &scene, int palette, const glm::vec3 &direction,
+                     int *candidates, SurfaceAovs *aovs, TraceCounters *counters)
+{
+    // depth of the closest hit so far (-1 before the first one) and the
+    // colour of the surface showing
+    float depth = -1.0f;
+    float colour[3] = { 0.0f, 0.0f, 0.0f };
+    Material material;
+    PrimitiveHit hit;
+
+    // which primitive the closest hit belongs to, for the AOVs
+    PrimitiveType hitType = SpherePrimitive;
+    int hitIndex = -1;
+    float hitT = 0.0f;
+
+    glm::vec3 light = scene.lights.empty() ? glm::vec3(0.0f) : scene.lights[0];
+
+    for (int i = 0; i < (int)scene.spheres.size(); i++) {
+        if (!IntersectSphere(scene.spheres[i], direction, light, hit))
+            continue;
+        if (depth == -1.0 || depth > hit.depth) {
+            depth = hit.depth;
+            hitType = SpherePrimitive; hitIndex = i;
+        }
+        if (depth == hit.depth && SceneMaterial(palette, SpherePrimitive, i, material))
+            Shade(material, hit.dot, hit.dot2, colour);
+    }
+
+    // only triangles whose bounds the ray's line crosses can pass the
+    // barycentric test, so ask the hierarchy for those; they are kept in
+    // scene order so that equal depths resolve the same way every time
+    int nodeVisits = 0;
+    int candidateCount = scene.bvh.Candidates(glm::vec3(0.0f), direction, -FLT_MAX, FLT_MAX,
+                                              candidates, counters ? &nodeVisits : 0);
+    sort(candidates, candidates + candidateCount);
+    for (int n = 0; n < candidateCount; n++) {
+        int i = candidates[n];
+        if (!IntersectTriangle(scene.triangles[i], direction, light, hit))
+            continue;
+        if (depth == -1.0 || depth > hit.depth) {
+            depth = hit.depth;
+            hitType = TrianglePrimitive; hitIndex = i; hitT = hit.depth;
+        }
+        if (depth == hit.depth && SceneMaterial(palette, TrianglePrimitive, i, material))
+            Shade(material, hit.dot, hit.dot2, colour);
+    }
+
+    // in scene two the planes only fill pixels nothing else has claimed
+    bool planesFillOnly = (palette == 2);
+
+    for (int i = 0; i < (int)scene.planes.size(); i++) {
+        IntersectPlane(scene.planes[i], direction, light, hit);
+        if (depth == -1.0 || (!planesFillOnly && depth > hit.depth)) {
+            depth = hit.depth;
+            hitType = PlanePrimitive; hitIndex = i; hitT = hit.depth;
+        }
+        if (depth == hit.depth && SceneMaterial(palette, PlanePrimitive, i, material))
+            Shade(material, hit.dot, hit.dot2, colour);
+    }
+
+    if (counters) {
+        counters->rays++;
+        counters->sphereTests += scene.spheres.size();
+        counters->triangleTests += candidateCount;
+        counters->planeTests += scene.planes.size();
+        counters->nodeVisits += nodeVisits;
+    }
+
+    if (aovs) {
+        *aovs = SurfaceAovs();
+        if (hitIndex >= 0)
+            FillSurfaceAovs(scene, palette, direction, hitType, hitIndex, hitT, *aovs);
+    }
+
+    return glm::vec3(colour[0], colour[1], colour[2]);
+}
+
+// --------------------------------------------------------------------------
+
+void AovChannelNames(int aovs, vector<string> &names)
+{
+    names.clear();
+    if (aovs & AovDepth)
+        names.push_back("Z");
+    if (aovs & AovNormal) {
+        names.push_back("N.X");
+        names.push_back("N.Y");
+        names.push_back("N.Z");
+    }
+    if (aovs & AovObjectId)
+        names.push_back("ID");
+    if (aovs & AovPosition) {
+        names.push_back("P.X");
+        names.push_back("P.Y");
+        names.push_back("P.Z");
+    }
+    if (aovs & AovAlbedo) {
+        names.push_back("A.R");
+        names.push_back("A.G");
+        names.push_back("A.B");
+    }
+}
+
+Framebuffer::Framebuffer()
+    : m_keepAovs(false), m_keepCosts(false), m_width(0), m_height(0), m_tilesX(0), m_layout(RowMajorLayout)
+{
+}
+
+void Framebuffer::Resize(int width, int height, FramebufferLayout layout)
+{
+    m_width = width;
+    m_height = height;
+    m_layout = layout;
+    m_tilesX = (width + TileSize - 1) / TileSize;
+    int tilesY = (height + TileSize - 1) / TileSize;
+
+    // tiles on the right and top edges are stored whole
+    size_t size = (layout == TiledLayout)
+        ? (size_t)m_tilesX * tilesY * TileSize * TileSize
+        : (size_t)width * height;
+    m_pixels.resize(size);
+    if (m_keepAovs)
+        m_aovs.resize(size);
+    if (m_keepCosts)
+        m_costs.resize(size);
+}
+
+void Framebuffer::KeepAovs(bool keep)
+{
+    m_keepAovs = keep;
+    m_aovs.resize(keep ? m_pixels.size() : 0);
+}
+
+void Framebuffer::KeepCosts(bool keep)
+{
+    m_keepCosts = keep;
+    m_costs.resize(keep ? m_pixels.size() : 0);
+}
+
+size_t Framebuffer::Index(int x, int y) const
+{
+    if (m_layout == RowMajorLayout)
+        return (size_t)y * m_width + x;
+
+    size_t tile = (size_t)(y / TileSize) * m_tilesX + x / TileSize;
+    return tile * TileSize * TileSize + MortonEncode(x % TileSize, y % TileSize);
+}
+
+void Framebuffer::CopyRowMajor(vector<glm::vec3> &pixels) const
+{
+    pixels.resize((size_t)m_width * m_height);
+    if (m_layout == RowMajorLayout) {
+        copy(m_pixels.begin(), m_pixels.begin() + pixels.size(), pixels.begin());
+        return;
+    }
+    for (int y = 0; y < m_height; y++)
+        for (int x = 0; x < m_width; x++)
+            pixels[(size_t)y * m_width + x] = At(x, y);
+}
+
+void Framebuffer::CopyAovsRowMajor(int aovs, vector<float> &values) const
+{
+    vector<string> names;
+    AovChannelNames(aovs, names);
+    size_t channels = names.size();
+    values.resize((size_t)m_width * m_height * channels);
+    if (!m_keepAovs) {
+        fill(values.begin(), values.end(), 0.0f);
+        return;
+    }
+
+    float *out = values.empty() ? 0 : &values[0];
+    for (int y = 0; y < m_height; y++)
+        for (int x = 0; x < m_width; x++) {
+            const SurfaceAovs &a = AovsAt(x, y);
+            if (aovs & AovDepth)
+                *out++ = a.depth;
+            if (aovs & AovNormal) {
+                *out++ = a.normal.x; *out++ = a.normal.y; *out++ = a.normal.z;
+            }
+            if (aovs & AovObjectId)
+                *out++ = a.objectId;
+            if (aovs & AovPosition) {
+                *out++ = a.position.x; *out++ = a.position.y; *out++ = a.position.z;
+            }
+            if (aovs & AovAlbedo) {
+                *out++ = a.albedo.x; *out++ = a.albedo.y; *out++ = a.albedo.z;
+            }
+        }
+}
+
+void Framebuffer::CopyCostsRowMajor(vector<PixelCost> &costs) const
+{
+    costs.resize((size_t)m_width * m_height);
+    for (int y = 0; y < m_height; y++)
+        for (int x = 0; x < m_width; x++)
+            costs[(size_t)y * m_width + x] = m_keepCosts ? CostAt(x, y) : PixelCost();
+}
+
+int Framebuffer::TileCount() const
+{
+    return m_tilesX * ((m_height + TileSize - 1) / TileSize);
+}
+
+// floats of a pixel: colour, then depth, normal, ID, position and albedo,
+// then tests, steps and nanoseconds
+size_t Framebuffer::TileValueCount(int tile) const
+{
+    int x0 = (tile % m_tilesX) * TileSize, y0 = (tile / m_tilesX) * TileSize;
+    size_t pixels = (size_t)min(TileSize, m_width - x0) * min(TileSize, m_height - y0);
+    return pixels * (3 + (m_keepAovs ? 13 : 0) + (m_keepCosts ? 3 : 0));
+}
+
+void Framebuffer::SaveTile(int tile, float *values) const
+{
+    int x0 = (tile % m_tilesX) * TileSize, y0 = (tile / m_tilesX) * TileSize;
+    for (int y = y0; y < min(y0 + TileSize, m_height); y++)
+        for (int x = x0; x < min(x0 + TileSize, m_width); x++) {
+            const glm::vec3 &c = At(x, y);
+            *values++ = c.x; *values++ = c.y; *values++ = c.z;
+            if (m_keepAovs) {
+                const SurfaceAovs &a = AovsAt(x, y);
+                *values++ = a.depth;
+                *values++ = a.normal.x; *values++ = a.normal.y; *values++ = a.normal.z;
+                *values++ = a.objectId;
+                *values++ = a.position.x; *values++ = a.position.y; *values++ = a.position.z;
+                *values++ = a.albedo.x; *values++ = a.albedo.y; *values++ = a.albedo.z;
+            }
+            if (m_keepCosts) {
+                const PixelCost &cost = CostAt(x, y);
+                *values++ = cost.tests; *values++ = cost.steps; *values++ = cost.nanoseconds;
+            }
+        }
+}
+
+void Framebuffer::RestoreTile(int tile, const float *values)
+{
+    int x0 = (tile % m_tilesX) * TileSize, y0 = (tile / m_tilesX) * TileSize;
+    for (int y = y0; y < min(y0 + TileSize, m_height); y++)
+        for (int x = x0; x < min(x0 + TileSize, m_width); x++) {
+            glm::vec3 &c = At(x, y);
+            c.x = *values++; c.y = *values++; c.z = *values++;
+            if (m_keepAovs) {
+                SurfaceAovs &a = AovsAt(x, y);
+                a.depth = *values++;
+                a.normal.x = *values++; a.normal.y = *values++; a.normal.z = *values++;
+                a.objectId = *values++;
+                a.position.x = *values++; a.position.y = *values++; a.position.z = *values++;
+                a.albedo.x = *values++; a.albedo.y = *values++; a.albedo.z = *values++;
+            }
+            if (m_keepCosts) {
+                PixelCost &cost = CostAt(x, y);
+                cost.tests = *values++; cost.steps = *values++; cost.nanoseconds = *values++;
+            }
+        }
+}
+
+void MortonTileOrder(int tilesX, int tilesY, int *order)
+{
+    ArenaScope scope(ThreadArena());
+    int tileCount = tilesX * tilesY;
+    uint64_t *keys = ThreadArena().Allocate<uint64_t>(tileCount);
+
+    // Morton code in the upper half, tile index in the lower
+    for (int y = 0; y < tilesY; y++)
+        for (int x = 0; x < tilesX; x++)
+            keys[y * tilesX + x] = ((uint64_t)MortonEncode(x, y) << 32) | (uint32_t)(y * tilesX + x);
+    sort(keys, keys + tileCount);
+
+    for (int i = 0; i < tileCount; i++)
+        order[i] = (int)(keys[i] & 0xffffffffu);
+}
+
+void RenderTiles(const Scene &scene, int palette, const Camera &camera,
+                 Framebuffer &framebuffer, ThreadPool *pool, RenderStats *stats,
+                 const PathSettings *path, const TileProgress *progress)
+{
+    framebuffer.Resize(camera.width, camera.height, framebuffer.Layout());
+    if (stats)
+        stats->Reset(pool ? pool->ThreadCount() : 0);
+
+    // everything the workers need, gathered so the task captures a single
+    // pointer and fits in std::function without a heap allocation
+    struct TileJob
+    {
+        const Scene  *scene;
+        const Camera *camera;
+        Framebuffer  *framebuffer;
+        RenderStats  *stats;
+        const PathSettings *path;
+        const TileProgress *progress;
+        int           palette;
+        int           tilesX;
+        int          *order;
+    } job;
+
+    ArenaScope scope(ThreadArena());
+    int tilesX = (camera.width + TileSize - 1) / TileSize;
+    int tilesY = (camera.height + TileSize - 1) / TileSize;
+    job.scene = &scene;
+    job.camera = &camera;
+    job.framebuffer = &framebuffer;
+    job.stats = stats;
+    job.path = path;
+    job.progress = progress;
+    job.palette = palette;
+    job.tilesX = tilesX;
+    job.order = ThreadArena().Allocate<int>(tilesX * tilesY);
+    MortonTileOrder(tilesX, tilesY, job.order);
+
+    ThreadPool::ParallelFor(pool, 0, tilesX * tilesY, 1, [&job](int first, int last) {
+        // candidate lists come from the worker's own arena and are given
+        // back at the end of each tile
+        Arena &arena = ThreadArena();
+        const Camera &camera = *job.camera;
+        for (int n = first; n < last; n++) {
+            if (job.progress && job.progress->done && (*job.progress->done)[job.order[n]])
+                continue;
+            ArenaScope tileScope(arena);
+            TraceScope tileTrace("tile", job.order[n]);
+            chrono::steady_clock::time_point tileStart;
+            if (job.stats)
+                tileStart = chrono::steady_clock::now();
+            TraceCounters tileCounters;
+            bool costs = job.framebuffer->HasCosts();
+            TraceCounters *counters = (job.stats || costs) ? &tileCounters : 0;
+
+            int *candidates = arena.Allocate<int>(max(job.scene->bvh.PrimitiveCount(), 1));
+            int x0 = (job.order[n] % job.tilesX) * TileSize;
+            int y0 = (job.order[n] / job.tilesX) * TileSize;
+            for (uint32_t code = 0; code < TileSize * TileSize; code++) {
+                int x = x0 + MortonDecodeX(code);
+                int y = y0 + MortonDecodeY(code);
+                if (x >= camera.width || y >= camera.height)
+                    continue;
+                SurfaceAovs *aovs = job.framebuffer->HasAovs() ? &job.framebuffer->AovsAt(x, y) : 0;
+                if (!costs) {
+                    job.framebuffer->At(x, y) = job.path
+                        ? TracePathPixel(*job.scene, job.palette, camera, *job.path, x, y, candidates, aovs, counters)
+                        : TracePixel(*job.scene, job.palette, camera.PrimaryRay(x, y), candidates, aovs, counters);
+                    continue;
+                }
+
+                // the pixel's own share is what the tile counters grew by
+                TraceCounters before = tileCounters;
+                chrono::steady_clock::time_point pixelStart = chrono::steady_clock::now();
+                job.framebuffer->At(x, y) = job.path
+                    ? TracePathPixel(*job.scene, job.palette, camera, *job.path, x, y, candidates, aovs, counters)
+                    : TracePixel(*job.scene, job.palette, camera.PrimaryRay(x, y), candidates, aovs, counters);
+                PixelCost &cost = job.framebuffer->CostAt(x, y);
+                cost.nanoseconds = (float)chrono::duration<double, nano>(chrono::steady_clock::now() - pixelStart).count();
+                cost.tests = (float)(tileCounters.Tests() - before.Tests());
+                cost.steps = (float)(tileCounters.nodeVisits - before.nodeVisits);
+            }
+
+            if (job.stats)
+                job.stats->AddTile(tileCounters, chrono::duration<double, milli>(
+                    chrono::steady_clock::now() - tileStart).count());
+            if (job.progress && job.progress->save)
+                job.progress->save(job.order[n]);
+        }
+    });
+}
+
+void RenderRegion(const Scene &scene, int palette, const Camera &camera,
+                  int x0, int y0, int width, int height, glm::vec3 *pixels, ThreadPool *pool)
+{
+    ThreadPool::ParallelFor(pool, 0, height, 1, [&](int first, int last) {
+        Arena &arena = ThreadArena();
+        ArenaScope scope(arena);
+        int *candidates = arena.Allocate<int>(max(scene.bvh.PrimitiveCount(), 1));
+        for (int y = first; y < last; y++)
+            for (int x = 0; x < width; x++)
+                pixels[(size_t)y * width + x] =
+                    TracePixel(scene, palette, camera.PrimaryRay(x0 + x, y0 + y), candidates);
+    });
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,318 @@
+// ==========================================================================
+// Ray Tracing Support Code
+//  - scene description and scene file loading
+//  - per-pixel primary ray generation from a camera description
+//  - tile based rendering on a thread pool
+//
+// Primary rays are generated inside the tile workers from pixel coordinates
+// and used immediately, so nothing per ray is kept between pixels.
+// ==========================================================================
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <glm/vec3.hpp>
+#include "BVH.h"
+#include "RenderStats.h"
+
+class ThreadPool;
+struct PathSettings;
+
+// --------------------------------------------------------------------------
+// Scene primitives, all expressed in the camera reference frame
+
+struct Sphere
+{
+    glm::vec3 centre;
+    float     radius;
+};
+
+struct Plane
+{
+    glm::vec3 normal;
+    glm::vec3 point;
+};
+
+struct Triangle
+{
+    glm::vec3 v[3];     // corners in counter-clockwise order
+};
+
+enum PrimitiveType
+{
+    SpherePrimitive,
+    PlanePrimitive,
+    TrianglePrimitive
+};
+
+// An image on one primitive, multiplying its colour in the path tracer.
+// Planes and triangles take it flat along two axes of their own plane,
+// repeating every `scale` scene units; spheres wrap it around by longitude
+// and latitude, 1 / scale times.
+struct SceneTexture
+{
+    PrimitiveType type;
+    int           index;
+    std::string   fileName;     // relative ones are resolved against the
+                                // directory of the scene file
+    float         scale;
+    int           id;           // in the texture cache, -1 until loaded
+};
+
+struct Scene
+{
+    std::vector<glm::vec3> lights;
+    std::vector<Sphere>    spheres;
+    std::vector<Plane>     planes;
+    std::vector<Triangle>  triangles;
+    std::vector<SceneTexture> textures;
+    std::string            environment;    // image of the light from far away
+                                           // in every direction, if not empty
+
+    // hierarchy over the triangles; loading a scene leaves it alone so that
+    // frames of a sequence can refit the previous one
+    BVH bvh;
+};
+
+// reads a scene file into scene, replacing its primitives; returns false if
+// the file could not be opened
+bool LoadScene(const std::string &fileName, Scene &scene);
+
+// bounding boxes of the scene triangles for building the hierarchy, padded
+// so that rounding in the intersection test can never land outside of them;
+// boxes is resized to fit and keeps its storage between frames
+void TriangleBounds(const Scene &scene, std::vector<AABB> &boxes);
+
+// --------------------------------------------------------------------------
+// Surface colours. The scene files carry no materials, so colours are
+// looked up by scene number (the palette), primitive type and index.
+
+struct Material
+{
+    double colour[3];
+    double shininess;
+};
+
+// returns false if the palette leaves this primitive uncoloured
+bool SceneMaterial(int palette, PrimitiveType type, int index, Material &material);
+
+// ambient plus diffuse term and specular lobe shared by every surface, from
+// the two cosines an intersection test reports
+void Shade(const Material &material, float dot, float dot2, float colour[3]);
+
+// --------------------------------------------------------------------------
+// Intersection tests of a primary ray (from the origin along direction)
+// against a single primitive, exactly as the tracer runs them; exposed so
+// the individual kernels can be exercised on their own. Each returns true
+// on a hit and fills hit with the depth used to pick the closest surface
+// and the shading cosines for the light.
+
+struct PrimitiveHit
+{
+    float depth;
+    float dot;      // diffuse cosine
+    float dot2;     // specular cosine
+};
+
+bool IntersectSphere(const Sphere &sphere, const glm::vec3 &direction,
+                     const glm::vec3 &light, PrimitiveHit &hit);
+bool IntersectTriangle(const Triangle &triangle, const glm::vec3 &direction,
+                       const glm::vec3 &light, PrimitiveHit &hit);
+
+// planes always report a hit, behind the camera included
+bool IntersectPlane(const Plane &plane, const glm::vec3 &direction,
+                    const glm::vec3 &light, PrimitiveHit &hit);
+
+// --------------------------------------------------------------------------
+// Arbitrary output variables: per-pixel data about the surface a primary
+// ray lands on, kept from the same traversal that produces the colour so
+// compositing needs no extra renders
+
+enum AovFlags
+{
+    AovDepth    = 1,        // channel Z: distance in front of the camera
+    AovNormal   = 2,        // channels N.X, N.Y, N.Z: unit geometric normal
+    AovObjectId = 4,        // channel ID: 1 + the primitive's object number
+    AovPosition = 8,        // channels P.X, P.Y, P.Z: hit point
+    AovAlbedo   = 16,       // channels A.R, A.G, A.B: surface colour, unlit
+    AllAovs     = 31
+};
+
+// Everything is in the camera frame. Pixels showing no surface are all
+// zero; object numbers count the spheres, then the triangles, then the
+// planes, each in scene file order.
+struct SurfaceAovs
+{
+    float     depth;
+    glm::vec3 normal;
+    float     objectId;
+    glm::vec3 position;
+    glm::vec3 albedo;
+
+    SurfaceAovs() : depth(0.0f), normal(0.0f), objectId(0.0f), position(0.0f), albedo(0.0f) {}
+};
+
+// What tracing one pixel cost, for finding geometry that is expensive to
+// render: intersection tests of every kind, BVH nodes visited, and the
+// time spent (which includes reading the clock around the pixel).
+struct PixelCost
+{
+    float tests;
+    float steps;
+    float nanoseconds;
+
+    PixelCost() : tests(0.0f), steps(0.0f), nanoseconds(0.0f) {}
+};
+
+// names of the float channels the selected AOVs (a combination of AovFlags)
+// are written as, in the order Framebuffer::CopyAovsRowMajor packs them
+void AovChannelNames(int aovs, std::vector<std::string> &names);
+
+// --------------------------------------------------------------------------
+// Pinhole camera at the origin looking down -z, one ray per pixel
+
+struct Camera
+{
+    int width;
+    int height;
+
+    Camera(int w, int h) : width(w), height(h) {}
+
+    // x and y of the pixel in the [-1, 1] image plane, (0,0) is bottom left
+    float ImageX(int x) const;
+    float ImageY(int y) const;
+
+    glm::vec3 PrimaryRay(int x, int y) const;
+};
+
+// --------------------------------------------------------------------------
+// Rendering
+
+// side length, in pixels, of the square tiles handed to the workers; a
+// power of two so that a tile can be walked along a Z-order curve
+const int TileSize = 32;
+
+// How the framebuffer stores its pixels:
+//  - row-major, bottom row first, as the image and the display expect
+//  - tiled, each tile contiguous with its pixels in Z-order, so a worker
+//    writes one compact block; converted to row-major on the way out
+enum FramebufferLayout
+{
+    RowMajorLayout,
+    TiledLayout
+};
+
+class Framebuffer
+{
+    std::vector<glm::vec3> m_pixels;
+    std::vector<SurfaceAovs> m_aovs;    // same order as m_pixels, if kept
+    std::vector<PixelCost> m_costs;     // likewise
+    bool m_keepAovs;
+    bool m_keepCosts;
+    int m_width;
+    int m_height;
+    int m_tilesX;
+    FramebufferLayout m_layout;
+
+public:
+    Framebuffer();
+
+    // (re)allocates storage, keeping it when the size and layout are unchanged
+    void Resize(int width, int height, FramebufferLayout layout);
+
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+    FramebufferLayout Layout() const { return m_layout; }
+
+    // position of pixel (x, y) in storage
+    size_t Index(int x, int y) const;
+
+    glm::vec3 &At(int x, int y) { return m_pixels[Index(x, y)]; }
+    const glm::vec3 &At(int x, int y) const { return m_pixels[Index(x, y)]; }
+
+    // whether the renderer also stores each pixel's AOVs; off by default,
+    // the storage is only allocated once turned on
+    void KeepAovs(bool keep);
+    bool HasAovs() const { return m_keepAovs; }
+
+    SurfaceAovs &AovsAt(int x, int y) { return m_aovs[Index(x, y)]; }
+    const SurfaceAovs &AovsAt(int x, int y) const { return m_aovs[Index(x, y)]; }
+
+    // whether the renderer also measures each pixel's cost; off by default
+    // as reading the clock per pixel slows rendering down
+    void KeepCosts(bool keep);
+    bool HasCosts() const { return m_keepCosts; }
+
+    PixelCost &CostAt(int x, int y) { return m_costs[Index(x, y)]; }
+    const PixelCost &CostAt(int x, int y) const { return m_costs[Index(x, y)]; }
+
+    // writes the pixels out in row-major order, bottom row first
+    void CopyRowMajor(std::vector<glm::vec3> &pixels) const;
+
+    // writes the selected AOVs out the same way, channels interleaved as
+    // named by AovChannelNames
+    void CopyAovsRowMajor(int aovs, std::vector<float> &values) const;
+
+    // and the costs, if kept
+    void CopyCostsRowMajor(std::vector<PixelCost> &costs) const;
+
+    // tiles of TileSize pixels, numbered row-major from the bottom left, as
+    // RenderTiles renders them
+    int TileCount() const;
+
+    // the values of a tile, pixel by pixel row-major: the colour, then the
+    // AOVs and costs if kept; all a finished tile needs to be saved and
+    // put back by RestoreTile
+    size_t TileValueCount(int tile) const;
+    void SaveTile(int tile, float *values) const;
+    void RestoreTile(int tile, const float *values);
+};
+
+// tiles of a frame finished before, for resuming it: RenderTiles leaves out
+// those marked done, whose values are in the framebuffer already, and
+// passes every tile it renders to save, on the thread that rendered it
+struct TileProgress
+{
+    const std::vector<bool>      *done;     // by tile number, if set
+    std::function<void(int tile)> save;     // if set
+
+    TileProgress() : done(0) {}
+};
+
+// fills order with the tile indices (row-major, tilesX per row) sorted along
+// a Z-order curve, so consecutive tiles are neighbours and their rays share
+// hierarchy nodes
+void MortonTileOrder(int tilesX, int tilesY, int *order);
+
+// traces one primary ray and returns its colour; candidates is scratch
+// space for the triangle query with room for every scene triangle. If aovs
+// is given it receives the data of the surface the pixel shows, and if
+// counters is given the ray and its intersection tests are added to it.
+glm::vec3 TracePixel(const Scene &scene, int palette, const glm::vec3 &direction,
+                     int *candidates, SurfaceAovs *aovs = 0, TraceCounters *counters = 0);
+
+// renders the whole image into framebuffer, which is resized to the camera
+// and keeps its layout; tiles are taken in Z-order, one per task on the
+// pool (or on the caller's thread if pool is null), and the pixels of each
+// tile are traced in Z-order as well. Scratch memory comes from the thread
+// arenas, so once they have grown a frame makes no heap allocations. AOVs
+// and costs are filled in as well if the framebuffer keeps them. If stats is given it
+// is reset and receives the counts and busy time of each thread. With path
+// settings each pixel is path traced (see PathTracer.h) instead of shaded
+// by TracePixel. With progress, tiles done already are left out and each
+// tile rendered is reported.
+void RenderTiles(const Scene &scene, int palette, const Camera &camera,
+                 Framebuffer &framebuffer, ThreadPool *pool, RenderStats *stats = 0,
+                 const PathSettings *path = 0, const TileProgress *progress = 0);
+
+// renders the width x height rectangle of the camera's image whose bottom
+// left pixel is (x0, y0) into pixels, row-major and bottom row first, as a
+// render farm worker does with the tiles it is sent; rows are spread over
+// the pool
+void RenderRegion(const Scene &scene, int palette, const Camera &camera,
+                  int x0, int y0, int width, int height, glm::vec3 *pixels, ThreadPool *pool);
+
+// --------------------------------------------------------------------------
+#endif // RAYTRACER_H
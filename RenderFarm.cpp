@@ -0,0 +1,806 @@
+// ==========================================================================
+// Render Farm Support Code
+// ==========================================================================
+
+#include "RenderFarm.h"
+#include "Raytracer.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Checkpoint.h"
+
+#include <iostream>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifndef _WIN32
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    enum MessageType
+    {
+        HelloMessage = 1,       // worker: protocol version, thread count
+        SceneMessage,           // coordinator: image settings, then the scene
+        TileMessage,            // coordinator: tile number and rectangle
+        PixelsMessage,          // worker: tile number, then its RGB floats
+        DoneMessage             // coordinator: the frame is complete
+    };
+
+    const uint32_t FarmProtocolVersion = 1;
+    const uint32_t MaxPayloadBytes = 1u << 30;
+
+    // ----------------------------------------------------------------------
+    // payloads are sequences of 32-bit values; floats are stored bit for
+    // bit so the workers see exactly the scene the coordinator parsed
+
+    void PutFloat(vector<uint32_t> &payload, float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        payload.push_back(bits);
+    }
+
+    void PutVector(vector<uint32_t> &payload, const glm::vec3 &v)
+    {
+        for (int k = 0; k < 3; ++k)
+            PutFloat(payload, v[k]);
+    }
+
+    // reads a payload front to back; reading past the end gives zeros and
+    // marks the payload as malformed
+    class PayloadReader
+    {
+        const vector<uint32_t> &m_payload;
+        size_t m_next;
+        bool m_valid;
+
+    public:
+        explicit PayloadReader(const vector<uint32_t> &payload)
+            : m_payload(payload), m_next(0), m_valid(true) {}
+
+        bool Valid() const { return m_valid; }
+        size_t Remaining() const { return m_payload.size() - m_next; }
+
+        uint32_t Next()
+        {
+            if (m_next >= m_payload.size())
+            {
+                m_valid = false;
+                return 0;
+            }
+            return m_payload[m_next++];
+        }
+
+        float NextFloat()
+        {
+            uint32_t bits = Next();
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        glm::vec3 NextVector()
+        {
+            float x = NextFloat(), y = NextFloat();
+            return glm::vec3(x, y, NextFloat());
+        }
+    };
+
+    void PutScene(const Scene &scene, vector<uint32_t> &payload)
+    {
+        payload.push_back((uint32_t)scene.lights.size());
+        payload.push_back((uint32_t)scene.spheres.size());
+        payload.push_back((uint32_t)scene.planes.size());
+        payload.push_back((uint32_t)scene.triangles.size());
+        for (size_t i = 0; i < scene.lights.size(); ++i)
+            PutVector(payload, scene.lights[i]);
+        for (size_t i = 0; i < scene.spheres.size(); ++i)
+        {
+            PutVector(payload, scene.spheres[i].centre);
+            PutFloat(payload, scene.spheres[i].radius);
+        }
+        for (size_t i = 0; i < scene.planes.size(); ++i)
+        {
+            PutVector(payload, scene.planes[i].normal);
+            PutVector(payload, scene.planes[i].point);
+        }
+        for (size_t i = 0; i < scene.triangles.size(); ++i)
+            for (int k = 0; k < 3; ++k)
+                PutVector(payload, scene.triangles[i].v[k]);
+    }
+
+    bool ReadScene(PayloadReader &reader, Scene &scene)
+    {
+        uint32_t lights = reader.Next(), spheres = reader.Next();
+        uint32_t planes = reader.Next(), triangles = reader.Next();
+        uint64_t values = 3ull * lights + 4ull * spheres + 6ull * planes + 9ull * triangles;
+        if (!reader.Valid() || values != reader.Remaining())
+            return false;
+
+        scene.lights.resize(lights);
+        scene.spheres.resize(spheres);
+        scene.planes.resize(planes);
+        scene.triangles.resize(triangles);
+        for (uint32_t i = 0; i < lights; ++i)
+            scene.lights[i] = reader.NextVector();
+        for (uint32_t i = 0; i < spheres; ++i)
+        {
+            scene.spheres[i].centre = reader.NextVector();
+            scene.spheres[i].radius = reader.NextFloat();
+        }
+        for (uint32_t i = 0; i < planes; ++i)
+        {
+            scene.planes[i].normal = reader.NextVector();
+            scene.planes[i].point = reader.NextVector();
+        }
+        for (uint32_t i = 0; i < triangles; ++i)
+            for (int k = 0; k < 3; ++k)
+                scene.triangles[i].v[k] = reader.NextVector();
+        return reader.Valid();
+    }
+
+    // ----------------------------------------------------------------------
+    // blocking socket I/O for the workers and the coordinator's small
+    // messages; a timeout on the socket bounds how long a silent peer can
+    // hold things up. The coordinator reads without blocking, below.
+
+    bool SendAll(int fd, const void *data, size_t size, int flags = 0)
+    {
+        const char *bytes = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL | flags);
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent <= 0)
+                return false;
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool ReceiveAll(int fd, void *data, size_t size)
+    {
+        char *bytes = static_cast<char *>(data);
+        while (size > 0)
+        {
+            ssize_t received = recv(fd, bytes, size, 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                return false;
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    // with Nagle's algorithm off, the header goes out together with the
+    // payload where the system can be told more data follows
+    bool SendMessage(int fd, MessageType type, const vector<uint32_t> &payload)
+    {
+        uint32_t header[2] = { (uint32_t)type, (uint32_t)(payload.size() * sizeof(uint32_t)) };
+#ifdef MSG_MORE
+        int more = payload.empty() ? 0 : MSG_MORE;
+#else
+        int more = 0;
+#endif
+        return SendAll(fd, header, sizeof(header), more)
+            && (payload.empty() || SendAll(fd, payload.data(), header[1]));
+    }
+
+    bool ReceiveMessage(int fd, uint32_t &type, vector<uint32_t> &payload)
+    {
+        uint32_t header[2];
+        if (!ReceiveAll(fd, header, sizeof(header)) || header[1] > MaxPayloadBytes
+            || header[1] % sizeof(uint32_t) != 0)
+            return false;
+        type = header[0];
+        payload.resize(header[1] / sizeof(uint32_t));
+        return payload.empty() || ReceiveAll(fd, payload.data(), header[1]);
+    }
+
+    // small messages, tile requests above all, must not wait for more data
+    void DisableNagle(int fd)
+    {
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+
+    void ConfigureSocket(int fd, double timeout)
+    {
+        timeval tv;
+        tv.tv_sec = (time_t)timeout;
+        tv.tv_usec = (suseconds_t)((timeout - (double)tv.tv_sec) * 1e6);
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        DisableNagle(fd);
+    }
+
+    // ----------------------------------------------------------------------
+    // coordinator
+
+    struct FarmTile
+    {
+        int x0, y0;
+        int width, height;
+    };
+
+    // a connection is a worker once it has said hello and has the whole
+    // scene; until then the poll loop drives it without ever blocking
+    enum WorkerState
+    {
+        AwaitingHello,
+        SendingScene,
+        Working
+    };
+
+    struct WorkerConnection
+    {
+        int                              fd;
+        string                           name;      // peer address
+        WorkerState                      state;
+        vector<char>                     hello;     // bytes of it received so far
+        size_t                           sceneSent; // bytes of the scene message
+        chrono::steady_clock::time_point progress;  // last time any bytes moved
+        vector<int>                      tiles;     // sent, not back yet, in order
+        chrono::steady_clock::time_point started;   // when the first of them began,
+                                                    // as near as can be told
+        uint32_t                         header[2]; // of the message coming in
+        vector<uint32_t>                 payload;
+        size_t                           received;  // bytes of both so far
+    };
+
+    // a connection that stops moving for this many seconds before it has
+    // joined is dropped, so a port scan or a stuck peer costs nothing
+    const double HandshakeTimeout = 5.0;
+
+    // header and payload: type, length, protocol version, thread count
+    const size_t HelloBytes = 4 * sizeof(uint32_t);
+
+    // takes a connection from the listener; the handshake goes on in
+    // AdvanceHandshake
+    bool AcceptWorker(int listener, const CoordinatorSettings &settings, WorkerConnection &worker)
+    {
+        sockaddr_in address;
+        socklen_t length = sizeof(address);
+        worker.fd = accept(listener, (sockaddr *)&address, &length);
+        if (worker.fd < 0)
+            return false;
+        char host[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+        worker.name = string(host) + ":" + to_string(ntohs(address.sin_port));
+        ConfigureSocket(worker.fd, settings.tileTimeout);
+        worker.state = AwaitingHello;
+        worker.sceneSent = 0;
+        worker.received = 0;
+        worker.progress = chrono::steady_clock::now();
+        return true;
+    }
+
+    // reads what there is of the hello, or sends what the socket takes of
+    // the scene message (header and payload); false if the peer is not a
+    // usable worker
+    bool AdvanceHandshake(WorkerConnection &worker, const vector<char> &sceneMessage)
+    {
+        if (worker.state == AwaitingHello)
+        {
+            char bytes[HelloBytes];
+            ssize_t received = recv(worker.fd, bytes, HelloBytes - worker.hello.size(), MSG_DONTWAIT);
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                return true;
+            if (received <= 0)
+                return false;
+            worker.hello.insert(worker.hello.end(), bytes, bytes + received);
+            worker.progress = chrono::steady_clock::now();
+            if (worker.hello.size() < HelloBytes)
+                return true;
+
+            uint32_t hello[4];
+            memcpy(hello, worker.hello.data(), sizeof(hello));
+            if (hello[0] != HelloMessage || hello[1] != 2 * sizeof(uint32_t) || hello[2] != FarmProtocolVersion)
+                return false;
+            worker.state = SendingScene;
+            return true;
+        }
+
+        ssize_t sent = send(worker.fd, &sceneMessage[worker.sceneSent], sceneMessage.size() - worker.sceneSent,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return true;
+        if (sent <= 0)
+            return false;
+        worker.sceneSent += sent;
+        worker.progress = chrono::steady_clock::now();
+        if (worker.sceneSent == sceneMessage.size())
+        {
+            uint32_t threads;
+            memcpy(&threads, &worker.hello[3 * sizeof(uint32_t)], sizeof(threads));
+            cout << "coordinator: worker " << worker.name << " joined with " << threads << " threads" << endl;
+            worker.state = Working;
+        }
+        return true;
+    }
+
+    // reads what the socket has of a worker's next message without waiting:
+    // 1 once header and payload are both in, 0 until then, and -1 if the
+    // connection is gone or the payload would be longer than maxBytes
+    int ReceivePart(WorkerConnection &worker, size_t maxBytes)
+    {
+        const size_t headerBytes = sizeof(worker.header);
+        for (;;)
+        {
+            char *target;
+            size_t wanted;
+            if (worker.received < headerBytes)
+            {
+                target = reinterpret_cast<char *>(worker.header) + worker.received;
+                wanted = headerBytes - worker.received;
+            }
+            else
+            {
+                target = reinterpret_cast<char *>(worker.payload.data()) + (worker.received - headerBytes);
+                wanted = headerBytes + worker.header[1] - worker.received;
+            }
+            ssize_t received = recv(worker.fd, target, wanted, MSG_DONTWAIT);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+            if (received <= 0)
+                return -1;
+            worker.received += received;
+            worker.progress = chrono::steady_clock::now();
+
+            if (worker.received == headerBytes)
+            {
+                if (worker.header[1] > maxBytes || worker.header[1] % sizeof(uint32_t) != 0)
+                    return -1;
+                worker.payload.resize(worker.header[1] / sizeof(uint32_t));
+            }
+            if (worker.received >= headerBytes && worker.received == headerBytes + worker.header[1])
+            {
+                worker.received = 0;
+                return 1;
+            }
+        }
+    }
+
+    // copies the RGB values of a tile, row by row, into the image
+    void CopyTile(const FarmTile &tile, const void *rgb, int imageWidth, vector<glm::vec3> &pixels)
+    {
+        const char *values = static_cast<const char *>(rgb);
+        size_t rowBytes = (size_t)tile.width * 3 * sizeof(float);
+        for (int y = 0; y < tile.height; ++y)
+            memcpy(&pixels[(size_t)(tile.y0 + y) * imageWidth + tile.x0].x, values + y * rowBytes, rowBytes);
+    }
+
+    // copies a returned tile into the image if it is one the worker was
+    // sent, and gives its number
+    bool StoreTile(const vector<uint32_t> &payload, const vector<FarmTile> &tiles,
+                   int imageWidth, WorkerConnection &worker, vector<glm::vec3> &pixels, int &t)
+    {
+        if (payload.empty())
+            return false;
+        vector<int>::iterator held = find(worker.tiles.begin(), worker.tiles.end(), (int)payload[0]);
+        if (held == worker.tiles.end())
+            return false;
+        t = *held;
+        const FarmTile &tile = tiles[t];
+        if (payload.size() != 1 + (size_t)tile.width * tile.height * 3)
+            return false;
+
+        CopyTile(tile, &payload[1], imageWidth, pixels);
+        worker.tiles.erase(held);
+
+        // workers render their tiles in the order they were sent, so the
+        // next one starts now
+        worker.started = chrono::steady_clock::now();
+        return true;
+    }
+
+    // ----------------------------------------------------------------------
+    // worker
+
+    int Connect(const string &host, int port, double timeout)
+    {
+        chrono::steady_clock::time_point deadline =
+            chrono::steady_clock::now() + chrono::milliseconds((long long)(timeout * 1000.0));
+        string service = to_string(port);
+        for (;;)
+        {
+            addrinfo hints, *addresses = 0;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses) == 0)
+            {
+                for (addrinfo *a = addresses; a; a = a->ai_next)
+                {
+                    int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+                    {
+                        DisableNagle(fd);
+                        freeaddrinfo(addresses);
+                        return fd;
+                    }
+                    if (fd >= 0)
+                        close(fd);
+                }
+                freeaddrinfo(addresses);
+            }
+
+            // the coordinator may not be listening yet
+            if (chrono::steady_clock::now() >= deadline)
+                return -1;
+            this_thread::sleep_for(chrono::milliseconds(250));
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+
+bool RunCoordinator(const Scene &scene, const CoordinatorSettings &settings,
+                    vector<glm::vec3> &pixels)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t)settings.port);
+    if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0
+        || bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 64) < 0)
+    {
+        cout << "ERROR: Could not listen on port " << settings.port << endl;
+        if (listener >= 0)
+            close(listener);
+        return false;
+    }
+
+    // tiles in row-major order from the bottom; the queue hands them out
+    // front first and gets the tiles of failed workers back at the front
+    int tileSize = max(settings.tileSize, 1);
+    vector<FarmTile> tiles;
+    for (int y0 = 0; y0 < settings.height; y0 += tileSize)
+        for (int x0 = 0; x0 < settings.width; x0 += tileSize)
+        {
+            FarmTile tile = { x0, y0, min(tileSize, settings.width - x0), min(tileSize, settings.height - y0) };
+            tiles.push_back(tile);
+        }
+    pixels.assign((size_t)settings.width * settings.height, glm::vec3(0.0f));
+
+    vector<uint32_t> scenePayload;
+    scenePayload.push_back((uint32_t)settings.width);
+    scenePayload.push_back((uint32_t)settings.height);
+    scenePayload.push_back((uint32_t)settings.palette);
+    scenePayload.push_back((uint32_t)settings.bvhMethod);
+    scenePayload.push_back(settings.wideBVH ? 1 : 0);
+    PutScene(scene, scenePayload);
+
+    // sent to each new worker as the socket takes it
+    uint32_t sceneHeader[2] = { SceneMessage, (uint32_t)(scenePayload.size() * sizeof(uint32_t)) };
+    vector<char> sceneMessage((const char *)sceneHeader, (const char *)(sceneHeader + 2));
+    sceneMessage.insert(sceneMessage.end(), (const char *)scenePayload.data(),
+                        (const char *)(scenePayload.data() + scenePayload.size()));
+
+    // tiles saved by an earlier run of the same render need not be sent
+    vector<bool> finished(tiles.size(), false);
+    TileCheckpoint checkpoint;
+    if (!settings.checkpointFile.empty())
+    {
+        uint64_t signature = HashBytes(scenePayload.data(), scenePayload.size() * sizeof(uint32_t));
+        signature = HashBytes(&tileSize, sizeof(tileSize), signature);
+        bool opened = checkpoint.Open(settings.checkpointFile, signature, settings.resume,
+            [&](int t, const float *rgb, size_t count) {
+                if (t < 0 || t >= (int)tiles.size() || count != (size_t)tiles[t].width * tiles[t].height * 3)
+                    return false;
+                CopyTile(tiles[t], rgb, settings.width, pixels);
+                finished[t] = true;
+                return true;
+            });
+        if (!opened)
+        {
+            close(listener);
+            return false;
+        }
+    }
+    chrono::steady_clock::time_point lastSave = chrono::steady_clock::now();
+
+    deque<int> pending;
+    for (size_t t = 0; t < tiles.size(); ++t)
+        if (!finished[t])
+            pending.push_back((int)t);
+    size_t remaining = pending.size();
+
+    cout << "coordinator: " << tiles.size() << " tiles of " << tileSize << "x" << tileSize
+         << ", waiting for workers on port " << settings.port << endl;
+
+    // a tile number and the RGB floats of the largest tile
+    size_t maxPixelsBytes = (1 + (size_t)tileSize * tileSize * 3) * sizeof(uint32_t);
+
+    vector<WorkerConnection> workers;
+    vector<pollfd> fds;
+    size_t reported = 0;
+    while (remaining > 0)
+    {
+        fds.resize(1 + workers.size());
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            fds[i + 1].fd = workers[i].fd;
+            fds[i + 1].events = workers[i].state == SendingScene ? POLLOUT : POLLIN;
+        }
+        for (size_t i = 0; i < fds.size(); ++i)
+            fds[i].revents = 0;
+        poll(fds.data(), fds.size(), 250);
+
+        // results first, then anyone who failed or ran out of time
+        vector<bool> failed(workers.size(), false);
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            WorkerConnection &worker = workers[i];
+            if (worker.state != Working)
+            {
+                if ((fds[i + 1].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR))
+                    && !AdvanceHandshake(worker, sceneMessage))
+                {
+                    cout << "coordinator: rejected connection from " << worker.name << endl;
+                    failed[i] = true;
+                }
+                else if (worker.state != Working
+                         && chrono::duration<double>(now - worker.progress).count() > HandshakeTimeout)
+                {
+                    cout << "coordinator: connection from " << worker.name << " timed out" << endl;
+                    failed[i] = true;
+                }
+                continue;
+            }
+            // a result comes in as the socket has it, so a slow worker
+            // holds up nobody else
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                int t = 0;
+                int part = ReceivePart(worker, maxPixelsBytes);
+                if (part > 0 && worker.header[0] == PixelsMessage
+                    && StoreTile(worker.payload, tiles, settings.width, worker, pixels, t))
+                {
+                    remaining--;
+                    if (!settings.checkpointFile.empty())
+                        checkpoint.Append(t, reinterpret_cast<const float *>(&worker.payload[1]),
+                                          worker.payload.size() - 1);
+                }
+                else if (part != 0)
+                {
+                    cout << "coordinator: lost worker " << worker.name << endl;
+                    failed[i] = true;
+                }
+            }
+            // only the tile being rendered is timed, from when it started or
+            // the last of its result arrived, whichever is later; those
+            // queued behind it have not started
+            if (!failed[i] && !worker.tiles.empty()
+                && chrono::duration<double>(now - max(worker.started, worker.progress)).count()
+                   > settings.tileTimeout)
+            {
+                cout << "coordinator: worker " << worker.name << " timed out" << endl;
+                failed[i] = true;
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            WorkerConnection worker;
+            if (AcceptWorker(listener, settings, worker))
+            {
+                workers.push_back(worker);
+                failed.push_back(false);
+            }
+        }
+
+        // keep every worker busy, with the next tile already on its way
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            WorkerConnection &worker = workers[i];
+            while (!failed[i] && worker.state == Working
+                   && (int)worker.tiles.size() < max(settings.tilesInFlight, 1) && !pending.empty())
+            {
+                int t = pending.front();
+                const FarmTile &tile = tiles[t];
+                uint32_t request[5] = { (uint32_t)t, (uint32_t)tile.x0, (uint32_t)tile.y0,
+                                        (uint32_t)tile.width, (uint32_t)tile.height };
+                if (!SendMessage(worker.fd, TileMessage, vector<uint32_t>(request, request + 5)))
+                {
+                    cout << "coordinator: lost worker " << worker.name << endl;
+                    failed[i] = true;
+                    break;
+                }
+                pending.pop_front();
+                if (worker.tiles.empty())
+                    worker.started = now;
+                worker.tiles.push_back(t);
+            }
+        }
+
+        for (size_t i = workers.size(); i-- > 0;)
+        {
+            if (!failed[i])
+                continue;
+            if (!workers[i].tiles.empty())
+                cout << "coordinator: reassigning " << workers[i].tiles.size() << " tiles" << endl;
+            pending.insert(pending.begin(), workers[i].tiles.begin(), workers[i].tiles.end());
+            close(workers[i].fd);
+            workers.erase(workers.begin() + i);
+        }
+
+        // the last tiles are saved however soon they come
+        if (!settings.checkpointFile.empty()
+            && (remaining == 0 || chrono::duration<double>(now - lastSave).count() >= settings.checkpointInterval))
+        {
+            if (!checkpoint.Sync())
+                cout << "coordinator: could not save checkpoint " << settings.checkpointFile << endl;
+            lastSave = now;
+        }
+
+        size_t done = tiles.size() - remaining;
+        if (done * 10 / tiles.size() > reported * 10 / tiles.size())
+        {
+            size_t working = 0;
+            for (size_t i = 0; i < workers.size(); ++i)
+                working += workers[i].state == Working ? 1 : 0;
+            cout << "coordinator: " << done << " of " << tiles.size() << " tiles, "
+                 << working << " workers" << endl;
+            reported = done;
+        }
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        if (workers[i].state == Working)
+            SendMessage(workers[i].fd, DoneMessage, vector<uint32_t>());
+        close(workers[i].fd);
+    }
+    close(listener);
+    return true;
+}
+
+bool RunWorker(const WorkerSettings &settings, ThreadPool &pool)
+{
+    int fd = Connect(settings.host, settings.port, settings.connectTimeout);
+    if (fd < 0)
+    {
+        cout << "ERROR: Could not connect to " << settings.host << ":" << settings.port << endl;
+        return false;
+    }
+
+    uint32_t type = 0;
+    vector<uint32_t> payload;
+    uint32_t hello[2] = { FarmProtocolVersion, (uint32_t)pool.ThreadCount() };
+    if (!SendMessage(fd, HelloMessage, vector<uint32_t>(hello, hello + 2))
+        || !ReceiveMessage(fd, type, payload) || type != SceneMessage)
+    {
+        cout << "ERROR: " << settings.host << ":" << settings.port << " did not send a scene" << endl;
+        close(fd);
+        return false;
+    }
+
+    PayloadReader reader(payload);
+    int width = (int)reader.Next(), height = (int)reader.Next();
+    int palette = (int)reader.Next();
+    BVHBuildMethod method = (BVHBuildMethod)reader.Next();
+    bool wide = reader.Next() != 0;
+    Scene scene;
+    if (!ReadScene(reader, scene))
+    {
+        cout << "ERROR: The scene from " << settings.host << " is malformed" << endl;
+        close(fd);
+        return false;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        TraceScope scope("build bvh");
+        vector<AABB> boxes;
+        TriangleBounds(scene, boxes);
+        scene.bvh.Build(boxes, &pool, method);
+        if (wide)
+            scene.bvh.Compress();
+    }
+    cout << "worker: " << width << "x" << height << " frame, bvh built in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+
+    Camera camera(width, height);
+    vector<glm::vec3> tilePixels;
+    vector<uint32_t> reply;
+    int rendered = 0;
+    for (;;)
+    {
+        if (!ReceiveMessage(fd, type, payload))
+        {
+            cout << "ERROR: Lost the connection to the coordinator" << endl;
+            close(fd);
+            return false;
+        }
+        if (type == DoneMessage)
+            break;
+
+        PayloadReader request(payload);
+        uint32_t t = request.Next();
+        int x0 = (int)request.Next(), y0 = (int)request.Next();
+        int w = (int)request.Next(), h = (int)request.Next();
+        if (type != TileMessage || !request.Valid() || x0 < 0 || y0 < 0 || w <= 0 || h <= 0
+            || x0 + w > width || y0 + h > height)
+        {
+            cout << "ERROR: Unexpected message from the coordinator" << endl;
+            close(fd);
+            return false;
+        }
+        if (settings.failAfter > 0 && rendered == settings.failAfter)
+        {
+            cout << "worker: disconnecting after " << rendered << " tiles, as asked" << endl;
+            close(fd);
+            return false;
+        }
+
+        TraceScope scope("farm tile", (int)t);
+        tilePixels.resize((size_t)w * h);
+        RenderRegion(scene, palette, camera, x0, y0, w, h, tilePixels.data(), &pool);
+        reply.resize(1 + tilePixels.size() * 3);
+        reply[0] = t;
+        memcpy(&reply[1], &tilePixels[0].x, tilePixels.size() * 3 * sizeof(float));
+        if (!SendMessage(fd, PixelsMessage, reply))
+        {
+            cout << "ERROR: Lost the connection to the coordinator" << endl;
+            close(fd);
+            return false;
+        }
+        rendered++;
+    }
+
+    cout << "worker: frame done, rendered " << rendered << " tiles" << endl;
+    close(fd);
+    return true;
+}
+
+#else
+
+// --------------------------------------------------------------------------
+
+bool RunCoordinator(const Scene &, const CoordinatorSettings &, vector<glm::vec3> &)
+{
+    cout << "ERROR: The render farm needs POSIX sockets" << endl;
+    return false;
+}
+
+bool RunWorker(const WorkerSettings &, ThreadPool &)
+{
+    cout << "ERROR: The render farm needs POSIX sockets" << endl;
+    return false;
+}
+
+#endif
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,81 @@
+// ==========================================================================
+// Render Farm Support Code
+//  - a coordinator that splits one frame into tiles and hands them out to
+//    worker processes over TCP, on this machine or others
+//  - workers receive the parsed scene in binary form, build their own
+//    hierarchy, render the tiles they are sent headless and stream the
+//    float pixels back
+//  - tiles held by a worker that disconnects, fails or takes longer than
+//    the timeout are given to the others again; workers may join at any
+//    time while the frame is being rendered; their handshake, scene upload
+//    and results are read and written as the sockets take them, so a slow
+//    worker never holds up the others
+//
+// Messages are an 8-byte header (type, payload length) and a payload of
+// 32-bit values in the host's byte order, so every machine of a farm must
+// share it, as all x86 and ARM Linux machines do. POSIX sockets only.
+// ==========================================================================
+#ifndef RENDERFARM_H
+#define RENDERFARM_H
+
+#include <vector>
+#include <string>
+#include <glm/vec3.hpp>
+#include "BVH.h"
+
+struct Scene;
+class ThreadPool;
+
+// --------------------------------------------------------------------------
+
+const int DefaultFarmPort = 7878;
+
+struct CoordinatorSettings
+{
+    int            port;
+    int            width;
+    int            height;
+    int            palette;
+    int            tileSize;        // side of the square tiles sent out
+    int            tilesInFlight;   // per worker, so it never waits for work
+    double         tileTimeout;     // seconds a worker may spend on one tile,
+                                    // or go quiet while sending it back,
+                                    // before its tiles are reassigned
+    BVHBuildMethod bvhMethod;       // how the workers build their hierarchy
+    bool           wideBVH;         // and whether they compress it
+    std::string    checkpointFile;  // finished tiles are saved here, if set
+    double         checkpointInterval;  // seconds between saves
+    bool           resume;          // start from the tiles already saved
+
+    CoordinatorSettings()
+        : port(DefaultFarmPort), width(640), height(640), palette(1), tileSize(128),
+          tilesInFlight(2), tileTimeout(60.0), bvhMethod(BuildBinnedSAH), wideBVH(false),
+          checkpointInterval(30.0), resume(false) {}
+};
+
+// renders scene with whichever workers connect to the port and fills pixels
+// with the image, row-major and bottom row first; returns once every tile
+// has come back, or false if the port or the checkpoint could not be
+// opened. The checkpoint is left in place for the caller to delete once
+// the image is safely saved.
+bool RunCoordinator(const Scene &scene, const CoordinatorSettings &settings,
+                    std::vector<glm::vec3> &pixels);
+
+struct WorkerSettings
+{
+    std::string host;
+    int         port;
+    double      connectTimeout; // seconds to keep retrying the connection
+    int         failAfter;      // testing aid: disconnect without replying
+                                // once this many tiles are done, if positive
+
+    WorkerSettings()
+        : port(DefaultFarmPort), connectTimeout(30.0), failAfter(0) {}
+};
+
+// connects to a coordinator and renders tiles on the pool until it says the
+// frame is done; returns false if the connection failed or was lost
+bool RunWorker(const WorkerSettings &settings, ThreadPool &pool);
+
+// --------------------------------------------------------------------------
+#endif // RENDERFARM_H
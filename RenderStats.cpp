@@ -0,0 +1,163 @@
+// ==========================================================================
+// Render Statistics Support Code
+// ==========================================================================
+
+#include "RenderStats.h"
+#include "ThreadPool.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // rays per microsecond is millions of rays per second
+    double MraysPerSecond(uint64_t rays, double milliseconds)
+    {
+        return milliseconds > 0.0 ? rays / (milliseconds * 1000.0) : 0.0;
+    }
+
+    string JsonString(const string &s)
+    {
+        string quoted = "\"";
+        for (size_t i = 0; i < s.size(); ++i)
+        {
+            unsigned char c = s[i];
+            if (c == '"' || c == '\\')
+            {
+                quoted += '\\';
+                quoted += c;
+            }
+            else if (c < 0x20)
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                quoted += escape;
+            }
+            else
+                quoted += c;
+        }
+        return quoted + "\"";
+    }
+}
+
+// --------------------------------------------------------------------------
+
+TraceCounters &TraceCounters::operator+=(const TraceCounters &other)
+{
+    rays += other.rays;
+    sphereTests += other.sphereTests;
+    triangleTests += other.triangleTests;
+    planeTests += other.planeTests;
+    nodeVisits += other.nodeVisits;
+    return *this;
+}
+
+void RenderStats::Reset(int threadCount)
+{
+    m_counters.assign(threadCount + 1, TraceCounters());
+    m_busy.assign(threadCount + 1, 0.0);
+}
+
+void RenderStats::AddTile(const TraceCounters &counters, double milliseconds)
+{
+    // the caller and workers of other pools share slot 0; only one of them
+    // runs tiles of a given render
+    int slot = ThreadPool::WorkerIndex() + 1;
+    if (slot >= (int)m_counters.size())
+        slot = 0;
+    m_counters[slot] += counters;
+    m_busy[slot] += milliseconds;
+}
+
+void RenderStats::Add(const RenderStats &other)
+{
+    for (size_t i = 0; i < other.m_counters.size() && i < m_counters.size(); ++i)
+    {
+        m_counters[i] += other.m_counters[i];
+        m_busy[i] += other.m_busy[i];
+    }
+}
+
+TraceCounters RenderStats::Total() const
+{
+    TraceCounters total;
+    for (size_t i = 0; i < m_counters.size(); ++i)
+        total += m_counters[i];
+    return total;
+}
+
+FrameStats::FrameStats()
+    : frame(0), width(0), height(0), parseTime(0.0), buildTime(0.0), traceTime(0.0),
+      copyTime(0.0), denoiseTime(0.0), displayTime(0.0), saveTime(0.0)
+{
+}
+
+// --------------------------------------------------------------------------
+
+bool WriteStatsReport(const string &fileName, int threadCount,
+                      const vector<FrameStats> &frames, double writerTime)
+{
+    ofstream file(fileName.c_str());
+    if (!file.is_open())
+    {
+        cout << "ERROR: Could not write statistics to " << fileName << endl;
+        return false;
+    }
+
+    file << "{\n"
+         << "  \"threads\": " << threadCount << ",\n"
+         << "  \"writer_ms\": " << writerTime << ",\n"
+         << "  \"frames\": [";
+    for (size_t f = 0; f < frames.size(); ++f)
+    {
+        const FrameStats &frame = frames[f];
+        TraceCounters total = frame.render.Total();
+        double frameTime = frame.parseTime + frame.buildTime + frame.traceTime
+                         + frame.copyTime + frame.denoiseTime + frame.displayTime + frame.saveTime;
+
+        file << (f ? ",\n" : "\n")
+             << "    {\n"
+             << "      \"frame\": " << frame.frame << ",\n"
+             << "      \"scene\": " << JsonString(frame.sceneFile) << ",\n"
+             << "      \"width\": " << frame.width << ",\n"
+             << "      \"height\": " << frame.height << ",\n"
+             << "      \"phases_ms\": { \"parse\": " << frame.parseTime
+             << ", \"build\": " << frame.buildTime
+             << ", \"trace\": " << frame.traceTime
+             << ", \"copy\": " << frame.copyTime
+             << ", \"denoise\": " << frame.denoiseTime
+             << ", \"display\": " << frame.displayTime
+             << ", \"save\": " << frame.saveTime
+             << ", \"total\": " << frameTime << " },\n"
+             << "      \"rays\": " << total.rays << ",\n"
+             << "      \"tests\": { \"sphere\": " << total.sphereTests
+             << ", \"triangle\": " << total.triangleTests
+             << ", \"plane\": " << total.planeTests << " },\n"
+             << "      \"bvh_nodes\": " << total.nodeVisits << ",\n"
+             << "      \"tests_per_ray\": " << (total.rays ? (double)total.Tests() / total.rays : 0.0) << ",\n"
+             << "      \"mrays_per_s\": " << MraysPerSecond(total.rays, frame.traceTime) << ",\n"
+             << "      \"per_thread\": [";
+        for (int slot = 0; slot < frame.render.Slots(); ++slot)
+        {
+            const TraceCounters &counters = frame.render.Counters(slot);
+            double busy = frame.render.BusyTime(slot);
+            file << (slot ? ", " : "")
+                 << "{ \"rays\": " << counters.rays
+                 << ", \"busy_ms\": " << busy
+                 << ", \"mrays_per_s\": " << MraysPerSecond(counters.rays, busy) << " }";
+        }
+        file << "]\n"
+             << "    }";
+    }
+    file << "\n  ]\n}\n";
+
+    file.close();
+    return !file.fail();
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,86 @@
+// ==========================================================================
+// Render Statistics Support Code
+//  - counts of rays cast and intersection tests by primitive type, kept
+//    per worker thread so the tile workers never share a counter
+//  - per-frame wall times of each phase of the render loop
+//  - a JSON report of every frame rendered, for capacity planning and for
+//    comparing builds
+// ==========================================================================
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// work done while tracing, summed over some set of pixels
+struct TraceCounters
+{
+    uint64_t rays;
+    uint64_t sphereTests;
+    uint64_t triangleTests;     // triangles the BVH could not rule out
+    uint64_t planeTests;
+    uint64_t nodeVisits;        // BVH nodes whose boxes were tested
+
+    TraceCounters() : rays(0), sphereTests(0), triangleTests(0), planeTests(0), nodeVisits(0) {}
+
+    TraceCounters &operator+=(const TraceCounters &other);
+    uint64_t Tests() const { return sphereTests + triangleTests + planeTests; }
+};
+
+// What the tile workers of one render did. Slot 0 belongs to the thread
+// that started the render (which may run tiles while it waits), slot i + 1
+// to pool worker i.
+class RenderStats
+{
+    std::vector<TraceCounters> m_counters;
+    std::vector<double>        m_busy;      // milliseconds spent in tiles
+
+public:
+    // clears the counts and makes room for a pool of threadCount workers;
+    // the storage is kept, so doing this every frame does not allocate
+    void Reset(int threadCount);
+
+    // adds a finished tile to the calling thread's slot
+    void AddTile(const TraceCounters &counters, double milliseconds);
+
+    // adds the counts and times of another render of the same pool, slot
+    // by slot, such as a pass that ran before this one
+    void Add(const RenderStats &other);
+
+    int Slots() const { return (int)m_counters.size(); }
+    const TraceCounters &Counters(int slot) const { return m_counters[slot]; }
+    double BusyTime(int slot) const { return m_busy[slot]; }
+
+    TraceCounters Total() const;
+};
+
+// one frame of the render loop, times in milliseconds
+struct FrameStats
+{
+    int         frame;
+    std::string sceneFile;
+    int         width;
+    int         height;
+
+    double      parseTime;      // reading the scene file
+    double      buildTime;      // building or refitting the BVH
+    double      traceTime;      // ray generation, intersection and shading,
+                                // which happen together for each pixel
+    double      copyTime;       // framebuffer to row-major pixels and AOVs
+    double      denoiseTime;    // filtering the colours, with --denoise
+    double      displayTime;    // uploading the colours and drawing them
+    double      saveTime;       // handing the frame to the image writer
+    RenderStats render;
+
+    FrameStats();
+};
+
+// writes every frame to fileName as JSON, together with the time the image
+// writer thread spent encoding in the background; false if it could not
+// be written
+bool WriteStatsReport(const std::string &fileName, int threadCount,
+                      const std::vector<FrameStats> &frames, double writerTime);
+
+// --------------------------------------------------------------------------
+#endif // RENDERSTATS_H
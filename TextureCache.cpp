@@ -0,0 +1,523 @@
+// ==========================================================================
+// Texture Cache Support Code
+// ==========================================================================
+
+#include "TextureCache.h"
+#include "ImageFile.h"
+#include "Raytracer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <sys/stat.h>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    const char TilesMagic[8] = { 'R', 'T', 'M', 'I', 'P', 'S', 0, 0 };
+    const uint32_t TilesVersion = 2;   // 2: odd sizes filtered over their area
+    const int TileBytes = TextureTileSize * TextureTileSize * 3;
+    const int ShardCount = 16;
+    const int LocalTileCount = 8;   // two mip levels of four tiles each
+    const int MaxLevels = 32;
+    const uint32_t MaxTextureSide = 65536;
+
+    struct TilesHeader
+    {
+        char     magic[8];          // "RTMIPS" and two zeros
+        uint32_t version;
+        uint32_t tileSize;
+        uint32_t levels;
+        uint32_t reserved;
+        uint64_t sourceSize;        // of the image the pyramid was made from,
+        int64_t  sourceTime;        // to notice when it changes
+    };
+
+    // followed by the tiles, level after level, each level's in row-major
+    // tile order, bottom row first; edge tiles are stored whole
+    struct LevelRecord
+    {
+        uint32_t width;
+        uint32_t height;
+        uint32_t tilesX;
+        uint32_t tilesY;
+        uint32_t firstTile;
+    };
+
+    // 8-bit values to linear light and back
+    struct GammaTables
+    {
+        float linear[256];
+
+        GammaTables()
+        {
+            for (int i = 0; i < 256; i++)
+                linear[i] = (float)pow(i / 255.0, 2.2);
+        }
+    };
+
+    const GammaTables &Gamma()
+    {
+        static const GammaTables tables;
+        return tables;
+    }
+
+    unsigned char Encode(float x)
+    {
+        x = min(max(x, 0.0f), 1.0f);
+        return (unsigned char)(255.0 * pow(x, 1.0 / 2.2) + 0.5);
+    }
+
+    bool SourceStamp(const string &fileName, uint64_t &size, int64_t &time)
+    {
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0)
+            return false;
+        size = (uint64_t)info.st_size;
+        time = (int64_t)info.st_mtime;
+        return true;
+    }
+
+    int Wrap(int x, int size)
+    {
+        x %= size;
+        return x < 0 ? x + size : x;
+    }
+
+    // The last few tiles a thread looked at, copied out of the shared
+    // slots, so the texels of a lookup seldom take a shard lock. The tiles
+    // of a pyramid never change, so a copy stays right after its slot is
+    // given to another tile; owner tells the caches of a thread apart.
+    struct LocalTiles
+    {
+        uint64_t      owner;
+        int           count;
+        int           next;         // to be replaced, round robin
+        uint64_t      keys[LocalTileCount];
+        unsigned char texels[LocalTileCount][TileBytes];
+    };
+
+    thread_local LocalTiles localTiles;
+
+    // numbers the caches, starting at 1 so no thread's copies match at first
+    atomic<uint64_t> cacheSerials(1);
+
+    // texture, level and tile packed into a single key
+    uint64_t TileKey(int texture, int level, int tileX, int tileY)
+    {
+        return ((uint64_t)texture << 48) | ((uint64_t)level << 40)
+             | ((uint64_t)(uint32_t)tileY << 20) | (uint64_t)(uint32_t)tileX;
+    }
+
+    // the texels of the level above that one texel of a level covers, and
+    // how much of each: a box over exactly its area, so the last column or
+    // row of an odd size is shared out between its neighbours instead of
+    // dropped. Positions are scaled by both sizes to keep them whole.
+    struct Footprint
+    {
+        uint32_t first;
+        int      count;
+        float    weights[3];
+    };
+
+    void Footprints(uint32_t above, uint32_t size, vector<Footprint> &footprints)
+    {
+        footprints.resize(size);
+        for (uint32_t x = 0; x < size; x++)
+        {
+            uint64_t start = (uint64_t)x * above, end = start + above;
+            Footprint &footprint = footprints[x];
+            footprint.first = (uint32_t)(start / size);
+            footprint.count = 0;
+            for (uint32_t i = footprint.first; i < above && (uint64_t)i * size < end && footprint.count < 3; i++)
+            {
+                uint64_t overlap = min<uint64_t>((uint64_t)(i + 1) * size, end) - max<uint64_t>((uint64_t)i * size, start);
+                footprint.weights[footprint.count++] = (float)overlap / above;
+            }
+        }
+    }
+
+    // the records of a pyramid as ConvertImage lays them out: each level
+    // half the one above down to 1x1, with its tiles following theirs, and
+    // all of them within dataBytes
+    bool ValidLevels(const vector<LevelRecord> &levels, uint64_t dataBytes)
+    {
+        uint64_t tiles = 0;
+        for (size_t l = 0; l < levels.size(); l++)
+        {
+            const LevelRecord &level = levels[l];
+            uint32_t width = l == 0 ? level.width : max(levels[l - 1].width / 2, 1u);
+            uint32_t height = l == 0 ? level.height : max(levels[l - 1].height / 2, 1u);
+            if (width == 0 || height == 0 || width > MaxTextureSide || height > MaxTextureSide
+                || level.width != width || level.height != height
+                || level.tilesX != (width + TextureTileSize - 1) / TextureTileSize
+                || level.tilesY != (height + TextureTileSize - 1) / TextureTileSize
+                || level.firstTile != tiles)
+                return false;
+            tiles += (uint64_t)level.tilesX * level.tilesY;
+        }
+        return levels.back().width == 1 && levels.back().height == 1 && tiles * TileBytes <= dataBytes;
+    }
+
+    // writes the pyramid of an 8-bit RGB image to fileName
+    bool ConvertImage(const string &imageName, const string &fileName)
+    {
+        int width, height;
+        vector<unsigned char> rgb;
+        if (!ReadImageRgb8(imageName, width, height, rgb))
+            return false;
+        if (width > (int)MaxTextureSide || height > (int)MaxTextureSide)
+        {
+            cout << "ERROR: Texture " << imageName << " is larger than " << MaxTextureSide
+                 << " texels on a side" << endl;
+            return false;
+        }
+        TilesHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TilesMagic, sizeof(header.magic));
+        header.version = TilesVersion;
+        header.tileSize = TextureTileSize;
+        if (!SourceStamp(imageName, header.sourceSize, header.sourceTime))
+            return false;
+
+        // the levels in linear light, each half the last one down to 1x1
+        vector<vector<glm::vec3> > levels(1);
+        vector<Footprint> columns, rows;
+        vector<LevelRecord> records(1);
+        levels[0].resize((size_t)width * height);
+        const float *linear = Gamma().linear;
+        for (size_t i = 0; i < levels[0].size(); i++)
+            levels[0][i] = glm::vec3(linear[rgb[3*i]], linear[rgb[3*i+1]], linear[rgb[3*i+2]]);
+        records[0].width = width;
+        records[0].height = height;
+        while ((records.back().width > 1 || records.back().height > 1) && (int)records.size() < MaxLevels)
+        {
+            const LevelRecord &above = records.back();
+            const vector<glm::vec3> &source = levels.back();
+            LevelRecord level;
+            level.width = max(above.width / 2, 1u);
+            level.height = max(above.height / 2, 1u);
+            vector<glm::vec3> pixels((size_t)level.width * level.height);
+            Footprints(above.width, level.width, columns);
+            Footprints(above.height, level.height, rows);
+            for (uint32_t y = 0; y < level.height; y++)
+                for (uint32_t x = 0; x < level.width; x++)
+                {
+                    const Footprint &row = rows[y], &column = columns[x];
+                    glm::vec3 sum(0.0f);
+                    for (int j = 0; j < row.count; j++)
+                        for (int i = 0; i < column.count; i++)
+                            sum += row.weights[j] * column.weights[i]
+                                 * source[(size_t)(row.first + j) * above.width + column.first + i];
+                    pixels[(size_t)y * level.width + x] = sum;
+                }
+            records.push_back(level);
+            levels.push_back(pixels);
+        }
+        header.levels = (uint32_t)records.size();
+
+        uint32_t tiles = 0;
+        for (size_t l = 0; l < records.size(); l++)
+        {
+            records[l].tilesX = (records[l].width + TextureTileSize - 1) / TextureTileSize;
+            records[l].tilesY = (records[l].height + TextureTileSize - 1) / TextureTileSize;
+            records[l].firstTile = tiles;
+            tiles += records[l].tilesX * records[l].tilesY;
+        }
+
+        FILE *file = fopen(fileName.c_str(), "wb");
+        if (!file)
+        {
+            cout << "ERROR: Could not write texture tiles " << fileName << endl;
+            return false;
+        }
+        bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                    && fwrite(records.data(), sizeof(LevelRecord), records.size(), file) == records.size();
+        unsigned char tile[TileBytes];
+        for (size_t l = 0; written && l < records.size(); l++)
+        {
+            const LevelRecord &level = records[l];
+            for (uint32_t ty = 0; written && ty < level.tilesY; ty++)
+                for (uint32_t tx = 0; written && tx < level.tilesX; tx++)
+                {
+                    memset(tile, 0, sizeof(tile));
+                    for (int y = 0; y < TextureTileSize; y++)
+                        for (int x = 0; x < TextureTileSize; x++)
+                        {
+                            uint32_t px = tx * TextureTileSize + x, py = ty * TextureTileSize + y;
+                            if (px >= level.width || py >= level.height)
+                                continue;
+                            const glm::vec3 &c = levels[l][(size_t)py * level.width + px];
+                            unsigned char *out = tile + (y * TextureTileSize + x) * 3;
+                            out[0] = Encode(c.x);
+                            out[1] = Encode(c.y);
+                            out[2] = Encode(c.z);
+                        }
+                    written = fwrite(tile, sizeof(tile), 1, file) == 1;
+                }
+        }
+        if (fclose(file) != 0 || !written)
+        {
+            cout << "ERROR: Could not write texture tiles " << fileName << endl;
+            remove(fileName.c_str());
+            return false;
+        }
+        cout << "converted " << imageName << " (" << width << "x" << height << ") into "
+             << header.levels << " mip levels, " << tiles << " tiles" << endl;
+        return true;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+struct TextureCache::Texture
+{
+    string              imageName;
+    FILE               *file;
+    mutable mutex       fileMutex;      // the file position is shared
+    long                dataOffset;
+    vector<LevelRecord> levels;
+
+    Texture() : file(0), dataOffset(0) {}
+    ~Texture() { if (file) fclose(file); }
+};
+
+// Slots are kept in a list from most to least recently used; a free slot
+// is one whose key is not in the map.
+struct TextureCache::Shard
+{
+    mutex                        lock;
+    unordered_map<uint64_t, int> slots;     // tile key to slot
+    vector<uint64_t>             keys;      // of each slot
+    vector<int>                  previous;  // towards the most recent
+    vector<int>                  next;      // towards the least recent
+    vector<unsigned char>        texels;
+    int                          head;
+    int                          tail;
+    int                          used;
+    uint64_t                     hits;
+    uint64_t                     misses;
+
+    explicit Shard(int slotCount)
+        : keys(slotCount), previous(slotCount, -1), next(slotCount, -1),
+          texels((size_t)slotCount * TileBytes), head(-1), tail(-1), used(0), hits(0), misses(0)
+    {
+        slots.reserve(slotCount);
+    }
+
+    void Unlink(int slot)
+    {
+        if (previous[slot] >= 0) next[previous[slot]] = next[slot]; else head = next[slot];
+        if (next[slot] >= 0) previous[next[slot]] = previous[slot]; else tail = previous[slot];
+    }
+
+    void PushFront(int slot)
+    {
+        previous[slot] = -1;
+        next[slot] = head;
+        if (head >= 0) previous[head] = slot; else tail = slot;
+        head = slot;
+    }
+};
+
+// --------------------------------------------------------------------------
+
+TextureCache::TextureCache(size_t budgetBytes)
+    : m_serial(cacheSerials.fetch_add(1))
+{
+    int slotsPerShard = max((int)(budgetBytes / TileBytes / ShardCount), 1);
+    for (int i = 0; i < ShardCount; i++)
+        m_shards.push_back(unique_ptr<Shard>(new Shard(slotsPerShard)));
+}
+
+TextureCache::~TextureCache()
+{
+}
+
+int TextureCache::Load(const string &imageName)
+{
+    for (size_t i = 0; i < m_textures.size(); i++)
+        if (m_textures[i]->imageName == imageName)
+            return (int)i;
+
+    // a pyramid made from the image as it is now is used as it is
+    string fileName = imageName + ".tiles";
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    if (!SourceStamp(imageName, sourceSize, sourceTime))
+    {
+        cout << "ERROR: Could not find texture " << imageName << endl;
+        return -1;
+    }
+    unique_ptr<Texture> texture(new Texture);
+    texture->imageName = imageName;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (attempt == 1 && !ConvertImage(imageName, fileName))
+            return -1;
+        if (texture->file)
+            fclose(texture->file);
+        texture->file = fopen(fileName.c_str(), "rb");
+        TilesHeader header;
+        if (!texture->file || fread(&header, sizeof(header), 1, texture->file) != 1
+            || memcmp(header.magic, TilesMagic, sizeof(header.magic)) != 0
+            || header.version != TilesVersion || header.tileSize != (uint32_t)TextureTileSize
+            || header.levels == 0 || header.levels > (uint32_t)MaxLevels
+            || header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+            continue;
+        texture->levels.resize(header.levels);
+        if (fread(texture->levels.data(), sizeof(LevelRecord), header.levels, texture->file) != header.levels)
+            continue;
+        texture->dataOffset = (long)(sizeof(header) + header.levels * sizeof(LevelRecord));
+        struct stat info;
+        if (stat(fileName.c_str(), &info) != 0 || info.st_size < texture->dataOffset
+            || !ValidLevels(texture->levels, (uint64_t)(info.st_size - texture->dataOffset)))
+            continue;
+        m_textures.push_back(move(texture));
+        return (int)m_textures.size() - 1;
+    }
+    cout << "ERROR: Could not read texture tiles " << fileName << endl;
+    return -1;
+}
+
+void TextureCache::LoadSceneTextures(Scene &scene)
+{
+    for (size_t i = 0; i < scene.textures.size(); i++)
+        scene.textures[i].id = Load(scene.textures[i].fileName);
+}
+
+bool TextureCache::ReadTile(const Texture &texture, uint32_t tile, unsigned char *texels) const
+{
+    lock_guard<mutex> lock(texture.fileMutex);
+    return fseek(texture.file, texture.dataOffset + (long)tile * TileBytes, SEEK_SET) == 0
+        && fread(texels, TileBytes, 1, texture.file) == 1;
+}
+
+const unsigned char *TextureCache::Tile(int texture, int level, int tileX, int tileY)
+{
+    uint64_t key = TileKey(texture, level, tileX, tileY);
+    LocalTiles &local = localTiles;
+    if (local.owner != m_serial)
+    {
+        local.owner = m_serial;
+        local.count = 0;
+        local.next = 0;
+    }
+    for (int i = 0; i < local.count; i++)
+        if (local.keys[i] == key)
+            return local.texels[i];
+
+    int entry = local.next;
+    local.next = (local.next + 1) % LocalTileCount;
+    local.count = max(local.count, entry + 1);
+    unsigned char *texels = local.texels[entry];
+    local.keys[entry] = key;
+
+    Shard &shard = *m_shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+    {
+        lock_guard<mutex> lock(shard.lock);
+        unordered_map<uint64_t, int>::iterator found = shard.slots.find(key);
+        if (found != shard.slots.end())
+        {
+            shard.hits++;
+            shard.Unlink(found->second);
+            shard.PushFront(found->second);
+            memcpy(texels, &shard.texels[(size_t)found->second * TileBytes], TileBytes);
+            return texels;
+        }
+    }
+
+    // read without holding the shard, so other tiles can be looked up
+    // meanwhile; a tile that cannot be read is black
+    const LevelRecord &record = m_textures[texture]->levels[level];
+    if (!ReadTile(*m_textures[texture], record.firstTile + tileY * record.tilesX + tileX, texels))
+        memset(texels, 0, TileBytes);
+
+    lock_guard<mutex> lock(shard.lock);
+    shard.misses++;
+    if (shard.slots.find(key) == shard.slots.end())
+    {
+        // a free slot while there are any, then the least recently used
+        int slot;
+        if (shard.used < (int)shard.keys.size())
+            slot = shard.used++;
+        else
+        {
+            slot = shard.tail;
+            shard.Unlink(slot);
+            shard.slots.erase(shard.keys[slot]);
+        }
+        memcpy(&shard.texels[(size_t)slot * TileBytes], texels, TileBytes);
+        shard.keys[slot] = key;
+        shard.slots[key] = slot;
+        shard.PushFront(slot);
+    }
+    return texels;
+}
+
+glm::vec3 TextureCache::Texel(int texture, int level, int x, int y)
+{
+    const LevelRecord &record = m_textures[texture]->levels[level];
+    x = Wrap(x, (int)record.width);
+    y = Wrap(y, (int)record.height);
+    const unsigned char *t = Tile(texture, level, x / TextureTileSize, y / TextureTileSize)
+                           + ((y % TextureTileSize) * TextureTileSize + x % TextureTileSize) * 3;
+    const float *linear = Gamma().linear;
+    return glm::vec3(linear[t[0]], linear[t[1]], linear[t[2]]);
+}
+
+glm::vec3 TextureCache::Bilinear(int texture, int level, float u, float v)
+{
+    const LevelRecord &record = m_textures[texture]->levels[level];
+    float x = u * record.width - 0.5f;
+    float y = v * record.height - 0.5f;
+    float fx = floor(x), fy = floor(y);
+    int x0 = (int)fx, y0 = (int)fy;
+    fx = x - fx;
+    fy = y - fy;
+    return (1.0f - fy) * ((1.0f - fx) * Texel(texture, level, x0, y0) + fx * Texel(texture, level, x0 + 1, y0))
+         + fy * ((1.0f - fx) * Texel(texture, level, x0, y0 + 1) + fx * Texel(texture, level, x0 + 1, y0 + 1));
+}
+
+glm::vec3 TextureCache::Lookup(int texture, float u, float v, float footprint)
+{
+    if (texture < 0 || texture >= (int)m_textures.size())
+        return glm::vec3(1.0f);
+
+    // keep u and v small so the texel positions stay exact
+    u -= floor(u);
+    v -= floor(v);
+    const vector<LevelRecord> &levels = m_textures[texture]->levels;
+    float texels = footprint * max(levels[0].width, levels[0].height);
+    float level = texels > 1.0f ? log2(texels) : 0.0f;
+    level = min(level, (float)(levels.size() - 1));
+    int fine = (int)level;
+    float blend = level - fine;
+    glm::vec3 colour = Bilinear(texture, fine, u, v);
+    if (blend > 0.0f && fine + 1 < (int)levels.size())
+        colour = (1.0f - blend) * colour + blend * Bilinear(texture, fine + 1, u, v);
+    return colour;
+}
+
+TextureCacheStats TextureCache::Stats() const
+{
+    TextureCacheStats stats = { 0, 0, 0 };
+    for (size_t i = 0; i < m_shards.size(); i++)
+    {
+        lock_guard<mutex> lock(m_shards[i]->lock);
+        stats.hits += m_shards[i]->hits;
+        stats.misses += m_shards[i]->misses;
+        stats.residentTiles += m_shards[i]->used;
+    }
+    return stats;
+}
+
+// --------------------------------------------------------------------------
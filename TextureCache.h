@@ -0,0 +1,85 @@
+// ==========================================================================
+// Texture Cache Support Code
+//  - image textures for the path tracer, converted the first time they
+//    are used into a tiled mip pyramid file next to the image
+//    (<image>.tiles) and afterwards read from it one tile at a time
+//  - a fixed number of tile slots shared by every thread: tiles are read
+//    in when a lookup needs them and the least recently used ones are
+//    dropped, so scenes may use far more texture than fits in the budget
+//  - the slots are split into shards with a lock and an LRU list each, so
+//    threads looking up different tiles seldom wait for one another
+//  - in front of them each thread keeps copies of the last few tiles it
+//    used, so the texels of a lookup, nearly always from the same one or
+//    two tiles, take no lock at all
+//  - lookups are trilinear, between the two mip levels whose texels are
+//    nearest in size to the footprint asked for
+//
+// Texels are stored as 8-bit RGB with a 2.2 gamma and filtered in linear
+// light, each level a box filter of the one above over its whole area.
+// Converting an image holds it and its pyramid in memory once; a tiled
+// file whose image has not changed since, and whose levels are laid out as
+// a conversion would, is used as it is, and any other is made again.
+// ==========================================================================
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <glm/vec3.hpp>
+
+struct Scene;
+
+// --------------------------------------------------------------------------
+
+const int TextureTileSize = 32;     // texels on a side, 3 KB a tile
+
+struct TextureCacheStats
+{
+    uint64_t hits;          // tiles a thread did not have a copy of but
+                            // found in the shared slots
+    uint64_t misses;        // and those that had to be read
+    int      residentTiles;
+};
+
+class TextureCache
+{
+    struct Texture;
+    struct Shard;
+
+    std::vector<std::unique_ptr<Texture> > m_textures;
+    std::vector<std::unique_ptr<Shard> >   m_shards;
+    uint64_t                               m_serial;    // tells the caches apart
+                                                        // in the threads' copies
+
+    TextureCache(const TextureCache &);
+    TextureCache &operator=(const TextureCache &);
+
+    bool ReadTile(const Texture &texture, uint32_t tile, unsigned char *texels) const;
+    const unsigned char *Tile(int texture, int level, int tileX, int tileY);
+    glm::vec3 Texel(int texture, int level, int x, int y);
+    glm::vec3 Bilinear(int texture, int level, float u, float v);
+
+public:
+    // keeps at most budgetBytes of tiles in memory
+    explicit TextureCache(size_t budgetBytes);
+    ~TextureCache();
+
+    // returns the number of the texture in fileName, converting the image
+    // to a tiled pyramid first if needed, or -1 if it cannot be used
+    int Load(const std::string &fileName);
+
+    // loads every texture the scene refers to and records their numbers
+    // in it
+    void LoadSceneTextures(Scene &scene);
+
+    // colour of texture at (u, v), repeating outside [0, 1), filtered over
+    // a footprint this wide in the same units
+    glm::vec3 Lookup(int texture, float u, float v, float footprint);
+
+    TextureCacheStats Stats() const;
+};
+
+// --------------------------------------------------------------------------
+#endif // TEXTURECACHE_H
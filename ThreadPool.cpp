@@ -0,0 +1,194 @@
+// ==========================================================================
+// Thread Pool Support Code
+// ==========================================================================
+
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    thread_local int CurrentWorker = -1;
+}
+
+// --------------------------------------------------------------------------
+
+ThreadPool::TaskGroup::TaskGroup(ThreadPool *pool)
+    : m_pool(pool), m_pending(0)
+{
+}
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+    Wait();
+}
+
+void ThreadPool::TaskGroup::Run(const function<void()> &task)
+{
+    if (!m_pool)
+    {
+        task();
+        return;
+    }
+
+    m_pending++;
+    {
+        lock_guard<mutex> lock(m_pool->m_mutex);
+        Task t = { task, this };
+        m_pool->PushTask(t);
+    }
+    m_pool->m_taskAvailable.notify_one();
+}
+
+void ThreadPool::TaskGroup::Wait()
+{
+    if (!m_pool)
+        return;
+
+    while (m_pending > 0)
+    {
+        // help with whatever is queued rather than sitting idle
+        if (m_pool->RunPendingTask())
+            continue;
+
+        unique_lock<mutex> lock(m_pool->m_mutex);
+        m_pool->m_taskFinished.wait(lock, [this] {
+            return m_pending == 0 || m_pool->m_taskCount > 0;
+        });
+    }
+}
+
+// --------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(int threadCount)
+    : m_taskHead(0), m_taskCount(0), m_stopping(false)
+{
+    if (threadCount <= 0)
+        threadCount = max(1, (int)thread::hardware_concurrency());
+    for (int i = 0; i < threadCount; ++i)
+        m_workers.push_back(thread(&ThreadPool::WorkerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_taskAvailable.notify_all();
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+}
+
+// the queue functions below are called with m_mutex held
+
+void ThreadPool::PushTask(const Task &task)
+{
+    if (m_taskCount == m_tasks.size())
+    {
+        // unwrap into a buffer twice the size
+        vector<Task> tasks(max<size_t>(64, 2 * m_tasks.size()));
+        for (size_t i = 0; i < m_taskCount; ++i)
+            tasks[i] = m_tasks[(m_taskHead + i) % m_tasks.size()];
+        m_tasks.swap(tasks);
+        m_taskHead = 0;
+    }
+    m_tasks[(m_taskHead + m_taskCount) % m_tasks.size()] = task;
+    m_taskCount++;
+}
+
+ThreadPool::Task ThreadPool::PopFrontTask()
+{
+    Task task = m_tasks[m_taskHead];
+    m_tasks[m_taskHead].function = nullptr;
+    m_taskHead = (m_taskHead + 1) % m_tasks.size();
+    m_taskCount--;
+    return task;
+}
+
+ThreadPool::Task ThreadPool::PopBackTask()
+{
+    size_t back = (m_taskHead + m_taskCount - 1) % m_tasks.size();
+    Task task = m_tasks[back];
+    m_tasks[back].function = nullptr;
+    m_taskCount--;
+    return task;
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+    CurrentWorker = index;
+    SetTraceThreadName("worker " + to_string(index));
+    for (;;)
+    {
+        Task task;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_taskAvailable.wait(lock, [this] { return m_stopping || m_taskCount > 0; });
+            if (m_taskCount == 0)
+                return;
+            task = PopFrontTask();
+        }
+        task.function();
+        Finish(task.group);
+    }
+}
+
+bool ThreadPool::RunPendingTask()
+{
+    Task task;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_taskCount == 0)
+            return false;
+        task = PopBackTask();
+    }
+    task.function();
+    Finish(task.group);
+    return true;
+}
+
+void ThreadPool::Finish(TaskGroup *group)
+{
+    // decrement under the lock so a waiter cannot miss the notification
+    {
+        lock_guard<mutex> lock(m_mutex);
+        group->m_pending--;
+    }
+    m_taskFinished.notify_all();
+}
+
+// --------------------------------------------------------------------------
+
+int ThreadPool::WorkerIndex()
+{
+    return CurrentWorker;
+}
+
+void ThreadPool::ParallelFor(ThreadPool *pool, int begin, int end, int grain,
+                             const function<void(int, int)> &body)
+{
+    if (end <= begin)
+        return;
+    grain = max(grain, 1);
+    if (!pool || end - begin <= grain)
+    {
+        body(begin, end);
+        return;
+    }
+
+    TaskGroup group(pool);
+    for (int chunk = begin; chunk < end; chunk += grain)
+    {
+        int chunkEnd = min(chunk + grain, end);
+        group.Run([&body, chunk, chunkEnd] { body(chunk, chunkEnd); });
+    }
+    group.Wait();
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,88 @@
+// ==========================================================================
+// Thread Pool Support Code
+//  - a fixed set of worker threads fed from one shared task queue
+//  - task groups that can be waited on from any thread, including from
+//    inside another task: a waiting thread runs queued tasks itself instead
+//    of blocking, so nested parallel loops cannot deadlock the pool
+// ==========================================================================
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+class ThreadPool
+{
+public:
+    // a set of tasks that are waited for together
+    class TaskGroup
+    {
+        friend class ThreadPool;
+
+        ThreadPool       *m_pool;
+        std::atomic<int>  m_pending;
+
+        TaskGroup(const TaskGroup &);
+        TaskGroup &operator=(const TaskGroup &);
+
+    public:
+        // pool may be null, in which case every task runs immediately
+        explicit TaskGroup(ThreadPool *pool);
+        ~TaskGroup();
+
+        void Run(const std::function<void()> &task);
+        void Wait();
+    };
+
+private:
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup            *group;
+    };
+
+    // queued tasks live in a ring buffer that only ever grows, so a pool
+    // that has warmed up queues tasks without touching the heap
+    std::vector<std::thread> m_workers;
+    std::vector<Task>        m_tasks;
+    size_t                   m_taskHead;
+    size_t                   m_taskCount;
+    std::mutex               m_mutex;
+    std::condition_variable  m_taskAvailable;
+    std::condition_variable  m_taskFinished;
+    bool                     m_stopping;
+
+    void PushTask(const Task &task);
+    Task PopFrontTask();
+    Task PopBackTask();
+
+    void WorkerLoop(int index);
+    bool RunPendingTask();
+    void Finish(TaskGroup *group);
+
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+
+public:
+    // threadCount 0 picks one worker per hardware thread
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    int ThreadCount() const { return (int)m_workers.size(); }
+
+    // index of the calling thread among its pool's workers, or -1 when
+    // called from a thread that is not a pool worker
+    static int WorkerIndex();
+
+    // calls body(chunkBegin, chunkEnd) over [begin, end) in chunks of at most
+    // grain items and returns once all of them are done; pool may be null
+    static void ParallelFor(ThreadPool *pool, int begin, int end, int grain,
+                            const std::function<void(int, int)> &body);
+};
+
+// --------------------------------------------------------------------------
+#endif // THREADPOOL_H
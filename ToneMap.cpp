@@ -0,0 +1,137 @@
+// ==========================================================================
+// Tone Mapping Support Code
+// ==========================================================================
+
+#include "ToneMap.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // the sRGB curve is looked up rather than computed; 4096 steps keep
+    // every 8-bit result within one of the exact value
+    const int SrgbTableSize = 4096;
+
+    struct SrgbTable
+    {
+        unsigned char values[SrgbTableSize];
+
+        SrgbTable()
+        {
+            for (int i = 0; i < SrgbTableSize; ++i)
+            {
+                double x = (double)i / (SrgbTableSize - 1);
+                double s = x <= 0.0031308 ? 12.92 * x : 1.055 * pow(x, 1.0 / 2.4) - 0.055;
+                values[i] = (unsigned char)(255.0 * s + 0.5);
+            }
+        }
+    };
+
+    const SrgbTable &Srgb()
+    {
+        static const SrgbTable table;
+        return table;
+    }
+
+    // the scalar path, also used for the values left over by the SSE one;
+    // the operations are the same, in the same order, so both agree exactly
+    unsigned char MapValue(float x, float scale, const ToneMapSettings &settings)
+    {
+        x *= scale;
+        if (settings.curve == ReinhardCurve)
+            x = x / (1.f + x);
+        else if (settings.curve == FilmicCurve)
+            x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+
+        // written so that NaN ends up as 0
+        x = x > 0.f ? x : 0.f;
+        x = x < 1.f ? x : 1.f;
+
+        if (settings.srgb)
+            return Srgb().values[(int)(x * (SrgbTableSize - 1) + 0.5f)];
+        return (unsigned char)(255 * x);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+void ToneMapValues(const float *values, size_t count, const ToneMapSettings &settings,
+                   unsigned char *bytes)
+{
+    float scale = exp2f(settings.exposure);
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const unsigned char *srgb = Srgb().values;
+    __m128 vscale = _mm_set1_ps(scale);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.f);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(values + i), vscale);
+        if (settings.curve == ReinhardCurve)
+            x = _mm_div_ps(x, _mm_add_ps(one, x));
+        else if (settings.curve == FilmicCurve)
+        {
+            __m128 n = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+            __m128 d = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x),
+                                                           _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+            x = _mm_div_ps(n, d);
+        }
+
+        // max and min return their second operand for NaN, giving 0
+        x = _mm_min_ps(_mm_max_ps(x, zero), one);
+
+        if (settings.srgb)
+        {
+            __m128 index = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps((float)(SrgbTableSize - 1))),
+                                      _mm_set1_ps(0.5f));
+            int32_t lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), _mm_cvttps_epi32(index));
+            for (int k = 0; k < 4; ++k)
+                bytes[i + k] = srgb[lanes[k]];
+        }
+        else
+        {
+            __m128i v = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(255.f)));
+            v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+            int32_t packed = _mm_cvtsi128_si32(v);
+            memcpy(bytes + i, &packed, 4);
+        }
+    }
+#endif
+
+    ToneMapValuesScalar(values + i, count - i, settings, bytes + i);
+}
+
+void ToneMapValuesScalar(const float *values, size_t count, const ToneMapSettings &settings,
+                         unsigned char *bytes)
+{
+    float scale = exp2f(settings.exposure);
+    for (size_t i = 0; i < count; ++i)
+        bytes[i] = MapValue(values[i], scale, settings);
+}
+
+void ToneMapImage(const float *rgb, int width, int height, const ToneMapSettings &settings,
+                  unsigned char *bytes, ThreadPool *pool)
+{
+    size_t rowValues = (size_t)width * 3;
+    ThreadPool::ParallelFor(pool, 0, height, 64, [=, &settings](int first, int last) {
+        for (int y = first; y < last; ++y)
+            ToneMapValues(rgb + y * rowValues, rowValues, settings,
+                          bytes + (height - 1 - y) * rowValues);
+    });
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,50 @@
+// ==========================================================================
+// Tone Mapping Support Code
+//  - turns linear float colours into 8-bit values as a pass of its own, so
+//    exposure and tone curve can be changed on a saved float image without
+//    rendering again
+//  - works on four channels at a time with SSE where available
+//
+// With the default settings the result is exactly what the renderer has
+// always saved: each channel clamped to [0,1] and scaled to 0..255.
+// ==========================================================================
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include <cstddef>
+
+class ThreadPool;
+
+enum ToneCurve
+{
+    ClampCurve,         // clip at 1
+    ReinhardCurve,      // x / (1 + x)
+    FilmicCurve         // Narkowicz's fit of the ACES reference curve
+};
+
+struct ToneMapSettings
+{
+    float     exposure;     // in stops, applied before the curve
+    ToneCurve curve;
+    bool      srgb;         // sRGB transfer function instead of linear
+
+    ToneMapSettings() : exposure(0.f), curve(ClampCurve), srgb(false) {}
+};
+
+// maps count floats from values into bytes, channel by channel
+void ToneMapValues(const float *values, size_t count, const ToneMapSettings &settings,
+                   unsigned char *bytes);
+
+// the same without SSE, one value at a time; gives identical bytes and is
+// exposed so the two can be compared
+void ToneMapValuesScalar(const float *values, size_t count, const ToneMapSettings &settings,
+                         unsigned char *bytes);
+
+// maps a width x height RGB float image (row-major, bottom row first) into
+// 8-bit RGB rows top row first, ready for PNG output; rows are spread over
+// the pool if one is given
+void ToneMapImage(const float *rgb, int width, int height, const ToneMapSettings &settings,
+                  unsigned char *bytes, ThreadPool *pool);
+
+// --------------------------------------------------------------------------
+#endif // TONEMAP_H
@@ -0,0 +1,172 @@
+// ==========================================================================
+// Trace Recording Support Code
+// ==========================================================================
+
+#include "Trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char *name;
+        int         arg;
+        int64_t     start;
+        int64_t     end;
+    };
+
+    // one per thread that has recorded anything; only its own thread
+    // appends to it, and the registry keeps it alive after the thread ends
+    struct ThreadBuffer
+    {
+        int                thread;
+        string             name;
+        vector<TraceEvent> events;
+    };
+
+    atomic<bool> enabled(false);
+    const chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+
+    mutex registryMutex;
+    vector<unique_ptr<ThreadBuffer> > registry;
+
+    thread_local ThreadBuffer *currentBuffer = 0;
+    thread_local string *currentName = 0;
+
+    ThreadBuffer &CurrentBuffer()
+    {
+        if (!currentBuffer)
+        {
+            lock_guard<mutex> lock(registryMutex);
+            registry.push_back(unique_ptr<ThreadBuffer>(new ThreadBuffer));
+            currentBuffer = registry.back().get();
+            currentBuffer->thread = (int)registry.size();
+            currentBuffer->name = currentName ? *currentName : "thread " + to_string(registry.size());
+            currentBuffer->events.reserve(4096);
+        }
+        return *currentBuffer;
+    }
+
+    string JsonString(const char *s)
+    {
+        string quoted = "\"";
+        for (; *s; ++s)
+        {
+            if (*s == '"' || *s == '\\')
+                quoted += '\\';
+            if ((unsigned char)*s >= 0x20)
+                quoted += *s;
+        }
+        return quoted + "\"";
+    }
+}
+
+// --------------------------------------------------------------------------
+
+void EnableTracing(bool enable)
+{
+    enabled.store(enable, memory_order_relaxed);
+}
+
+bool TracingEnabled()
+{
+    return enabled.load(memory_order_relaxed);
+}
+
+void SetTraceThreadName(const string &name)
+{
+    // kept until the thread records its first event, or renames it
+    static thread_local string storedName;
+    storedName = name;
+    currentName = &storedName;
+    if (currentBuffer)
+    {
+        lock_guard<mutex> lock(registryMutex);
+        currentBuffer->name = name;
+    }
+}
+
+int64_t TraceClock()
+{
+    return TraceTime(chrono::steady_clock::now());
+}
+
+int64_t TraceTime(chrono::steady_clock::time_point time)
+{
+    return chrono::duration_cast<chrono::nanoseconds>(time - origin).count();
+}
+
+void RecordTraceEvent(const char *name, int arg, int64_t start, int64_t end)
+{
+    if (!TracingEnabled())
+        return;
+    TraceEvent event = { name, arg, start, end };
+    CurrentBuffer().events.push_back(event);
+}
+
+TraceScope::TraceScope(const char *name, int arg)
+    : m_name(TracingEnabled() ? name : 0), m_arg(arg), m_start(0)
+{
+    if (m_name)
+        m_start = TraceClock();
+}
+
+TraceScope::~TraceScope()
+{
+    if (m_name)
+        RecordTraceEvent(m_name, m_arg, m_start, TraceClock());
+}
+
+// --------------------------------------------------------------------------
+
+bool WriteTrace(const string &fileName)
+{
+    ofstream file(fileName.c_str());
+    if (!file.is_open())
+    {
+        cout << "ERROR: Could not write trace to " << fileName << endl;
+        return false;
+    }
+
+    lock_guard<mutex> lock(registryMutex);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (size_t t = 0; t < registry.size(); ++t)
+    {
+        const ThreadBuffer &buffer = *registry[t];
+        file << (first ? "" : ",\n")
+             << "{\"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer.thread
+             << ", \"name\": \"thread_name\", \"args\": {\"name\": " << JsonString(buffer.name.c_str()) << "}}";
+        first = false;
+
+        // timestamps and durations are in microseconds
+        for (size_t e = 0; e < buffer.events.size(); ++e)
+        {
+            const TraceEvent &event = buffer.events[e];
+            file << ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer.thread
+                 << ", \"name\": " << JsonString(event.name)
+                 << ", \"ts\": " << event.start / 1000.0
+                 << ", \"dur\": " << (event.end - event.start) / 1000.0;
+            if (event.arg >= 0)
+                file << ", \"args\": {\"n\": " << event.arg << "}";
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+
+    file.close();
+    return !file.fail();
+}
+
+// --------------------------------------------------------------------------
@@ -0,0 +1,59 @@
+// ==========================================================================
+// Trace Recording Support Code
+//  - opt-in timeline of what each thread was doing: scene parsing, BVH
+//    builds, tiles, image encoding and file writes
+//  - every thread records into its own buffer, so recording takes no lock
+//    once a thread has made its first event
+//  - written out as Chrome trace-event JSON, for chrome://tracing or
+//    Perfetto, to show load imbalance, idle workers and serial tails
+//
+// While tracing is off a TraceScope costs one relaxed atomic load.
+// ==========================================================================
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <cstdint>
+#include <chrono>
+
+// turns recording on or off for every thread; events already recorded are
+// kept either way
+void EnableTracing(bool enable);
+bool TracingEnabled();
+
+// names the calling thread in the timeline, e.g. "worker 3"; may be called
+// before tracing is enabled
+void SetTraceThreadName(const std::string &name);
+
+// nanoseconds since the process started, now or at a given time, so
+// phases already timed with steady_clock can be recorded as they are
+int64_t TraceClock();
+int64_t TraceTime(std::chrono::steady_clock::time_point time);
+
+// records one complete event on the calling thread, if tracing is on; name
+// must be a string literal (or otherwise outlive the recording) and arg, if
+// not negative, is shown with the event, e.g. the tile or frame number
+void RecordTraceEvent(const char *name, int arg, int64_t start, int64_t end);
+
+// records the lifetime of the scope as one event
+class TraceScope
+{
+    const char *m_name;
+    int         m_arg;
+    int64_t     m_start;
+
+    TraceScope(const TraceScope &);
+    TraceScope &operator=(const TraceScope &);
+
+public:
+    explicit TraceScope(const char *name, int arg = -1);
+    ~TraceScope();
+};
+
+// writes every event recorded so far as Chrome trace-event JSON; call it
+// once the other threads are idle. Returns false if the file could not be
+// written.
+bool WriteTrace(const std::string &fileName);
+
+// --------------------------------------------------------------------------
+#endif // TRACE_H
@@ -0,0 +1,111 @@
+// ==========================================================================
+// Frame Allocation Benchmark
+//
+// Renders the same scene over and over, the way a preview session does, and
+// counts the heap allocations made per frame once everything has warmed up.
+// Anything above zero means some per-frame data is not being reused.
+//
+// Usage: frame_allocations [scene file] [threads] [frames]
+// ==========================================================================
+
+#include <iostream>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "Raytracer.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Every allocation in the process goes through these while counting is on
+
+namespace
+{
+    atomic<bool> counting(false);
+    atomic<long> allocations(0);
+
+    void *CountedAllocate(size_t size)
+    {
+        if (counting)
+            allocations++;
+        void *p = malloc(size ? size : 1);
+        if (!p)
+            throw bad_alloc();
+        return p;
+    }
+}
+
+void *operator new(size_t size) { return CountedAllocate(size); }
+void *operator new[](size_t size) { return CountedAllocate(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// --------------------------------------------------------------------------
+
+// one frame of the render loop, without the window and file output
+void RenderFrame(Scene &scene, vector<AABB> &boxes, const Camera &camera,
+                 Framebuffer &framebuffer, vector<glm::vec3> &pixels, ThreadPool &pool)
+{
+    TriangleBounds(scene, boxes);
+    scene.bvh.Update(boxes, 1.3f, &pool);
+    RenderTiles(scene, 1, camera, framebuffer, &pool);
+    framebuffer.CopyRowMajor(pixels);
+}
+
+// returns the allocations made over the measured frames of one layout
+long Measure(Scene &scene, FramebufferLayout layout, ThreadPool &pool, int frames)
+{
+    const int warmupFrames = 3;
+    Camera camera(640, 640);
+    Framebuffer framebuffer;
+    framebuffer.Resize(camera.width, camera.height, layout);
+    vector<AABB> boxes;
+    vector<glm::vec3> pixels;
+
+    for (int i = 0; i < warmupFrames; i++)
+        RenderFrame(scene, boxes, camera, framebuffer, pixels, pool);
+
+    allocations = 0;
+    counting = true;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++)
+        RenderFrame(scene, boxes, camera, framebuffer, pixels, pool);
+    double time = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    counting = false;
+
+    cout << (layout == TiledLayout ? "tiled    " : "row-major") << ": "
+         << time / frames << " ms/frame, "
+         << (double)allocations / frames << " allocations/frame" << endl;
+    return allocations;
+}
+
+int main(int argc, char *argv[])
+{
+    string sceneFile = argc > 1 ? argv[1] : "scene1.txt";
+    int threadCount = argc > 2 ? atoi(argv[2]) : 0;
+    int frames = argc > 3 ? atoi(argv[3]) : 10;
+
+    Scene scene;
+    if (!LoadScene(sceneFile, scene))
+        return -1;
+    ThreadPool pool(threadCount);
+    vector<AABB> boxes;
+    TriangleBounds(scene, boxes);
+    scene.bvh.Build(boxes, &pool);
+    cout << sceneFile << ", " << pool.ThreadCount() << " threads, "
+         << frames << " frames" << endl;
+
+    long total = Measure(scene, RowMajorLayout, pool, frames)
+               + Measure(scene, TiledLayout, pool, frames);
+    if (total != 0) {
+        cout << "FAILED: frames still allocate after warm-up" << endl;
+        return 1;
+    }
+    cout << "OK: no allocations after warm-up" << endl;
+    return 0;
+}
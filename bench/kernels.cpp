@@ -0,0 +1,249 @@
+// ==========================================================================
+// Kernel Micro-Benchmarks
+//
+// Times the individual kernels of the renderer on synthetic batches, away
+// from the rest of a frame: the sphere, triangle and plane tests, the box
+// tests of both hierarchy layouts, shading and the float to 8-bit pass.
+// Kernels with a hand-vectorized version are timed in both forms; the
+// whole program is also built once per instruction set (make bench gives
+// kernels and kernels_avx2) so compiler code generation can be compared.
+//
+// Usage: kernels [rays] [runs]
+// ==========================================================================
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cfloat>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "Raytracer.h"
+#include "BVH.h"
+#include "ToneMap.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // keeps results alive so the compiler cannot drop the work
+    volatile uint32_t sink;
+
+    // small deterministic generator, so every variant sees the same data
+    class Random
+    {
+        uint64_t m_state;
+
+    public:
+        explicit Random(uint64_t seed) : m_state(seed * 2654435761u + 1) {}
+
+        // uniform in [lo, hi)
+        float Uniform(float lo, float hi)
+        {
+            m_state = m_state * 6364136223846793005ull + 1442695040888963407ull;
+            return lo + (hi - lo) * (float)((m_state >> 40) / 16777216.0);
+        }
+    };
+
+    const char *InstructionSet()
+    {
+#if defined(__AVX2__)
+        return "AVX2";
+#elif defined(__AVX__)
+        return "AVX";
+#elif defined(__SSE4_1__)
+        return "SSE4.1";
+#elif defined(__SSE2__)
+        return "SSE2";
+#else
+        return "generic";
+#endif
+    }
+
+    // best of runs timings of body, in nanoseconds per test
+    template <typename Body>
+    double BestTime(int runs, double tests, Body body)
+    {
+        double best = 0.0;
+        for (int r = 0; r < runs; r++) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            body();
+            double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+            if (r == 0 || ns < best)
+                best = ns;
+        }
+        return best / tests;
+    }
+
+    void Report(const char *kernel, const char *variant, double nsPerTest)
+    {
+        printf("%-22s %-8s %10.2f %12.1f\n", kernel, variant, nsPerTest, 1000.0 / nsPerTest);
+    }
+}
+
+// --------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    int rayCount = argc > 1 ? atoi(argv[1]) : 65536;
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+
+#if defined(__GNUC__) && defined(__AVX2__)
+    if (!__builtin_cpu_supports("avx2")) {
+        cout << "This build needs AVX2, which the CPU does not have" << endl;
+        return -1;
+    }
+#endif
+
+    // primary rays over the image plane, as the camera makes them
+    Random random(1);
+    vector<glm::vec3> directions(rayCount), invDirections(rayCount);
+    for (int i = 0; i < rayCount; i++) {
+        directions[i] = glm::vec3(random.Uniform(-1.0f, 1.0f), random.Uniform(-1.0f, 1.0f), -2.0f);
+        invDirections[i] = 1.0f / directions[i];
+    }
+    glm::vec3 light(0.0f, 2.5f, -5.75f);
+
+    // a handful of each primitive in front of the camera
+    const int primitiveCount = 16;
+    vector<Sphere> spheres(primitiveCount);
+    vector<Triangle> triangles(primitiveCount);
+    vector<Plane> planes(primitiveCount);
+    vector<AABB> boxes(primitiveCount);
+    for (int i = 0; i < primitiveCount; i++) {
+        glm::vec3 p(random.Uniform(-4.0f, 4.0f), random.Uniform(-4.0f, 4.0f), random.Uniform(-20.0f, -6.0f));
+        spheres[i].centre = p;
+        spheres[i].radius = random.Uniform(0.2f, 1.5f);
+        for (int k = 0; k < 3; k++)
+            triangles[i].v[k] = p + glm::vec3(random.Uniform(-2.0f, 2.0f), random.Uniform(-2.0f, 2.0f),
+                                              random.Uniform(-1.0f, 1.0f));
+        planes[i].normal = glm::normalize(glm::vec3(random.Uniform(-1.0f, 1.0f), random.Uniform(-1.0f, 1.0f),
+                                                    random.Uniform(0.1f, 1.0f)));
+        planes[i].point = p;
+        boxes[i] = AABB(p - glm::vec3(1.0f), p + glm::vec3(1.0f));
+    }
+
+    // compressed nodes with random quantized children
+    vector<WideNode, AlignedAllocator<WideNode, 64> > wideNodes(primitiveCount);
+    for (int i = 0; i < primitiveCount; i++) {
+        WideNode &node = wideNodes[i];
+        for (int k = 0; k < 3; k++) {
+            node.origin[k] = boxes[i].lower[k] - 4.0f;
+            node.exponent[k] = -5;
+        }
+        node.internalMask = 0;
+        for (int c = 0; c < 8; c++) {
+            uint8_t *lower[3] = { node.lowerX, node.lowerY, node.lowerZ };
+            uint8_t *upper[3] = { node.upperX, node.upperY, node.upperZ };
+            for (int k = 0; k < 3; k++) {
+                int a = (int)random.Uniform(0.0f, 255.0f), b = (int)random.Uniform(0.0f, 255.0f);
+                lower[k][c] = (uint8_t)min(a, b);
+                upper[k][c] = (uint8_t)max(a, b);
+            }
+        }
+    }
+
+    double tests = (double)rayCount * primitiveCount;
+    cout << "instruction set " << InstructionSet() << ", " << rayCount << " rays x "
+         << primitiveCount << " primitives, best of " << runs << " runs" << endl;
+    printf("%-22s %-8s %10s %12s\n", "kernel", "variant", "ns/test", "Mtests/s");
+
+    PrimitiveHit hit;
+    Report("ray-sphere", "scalar", BestTime(runs, tests, [&] {
+        uint32_t hits = 0;
+        for (int r = 0; r < rayCount; r++)
+            for (int i = 0; i < primitiveCount; i++)
+                hits += IntersectSphere(spheres[i], directions[r], light, hit);
+        sink = hits;
+    }));
+    Report("ray-triangle", "scalar", BestTime(runs, tests, [&] {
+        uint32_t hits = 0;
+        for (int r = 0; r < rayCount; r++)
+            for (int i = 0; i < primitiveCount; i++)
+                hits += IntersectTriangle(triangles[i], directions[r], light, hit);
+        sink = hits;
+    }));
+    Report("ray-plane", "scalar", BestTime(runs, tests, [&] {
+        uint32_t hits = 0;
+        for (int r = 0; r < rayCount; r++)
+            for (int i = 0; i < primitiveCount; i++)
+                hits += IntersectPlane(planes[i], directions[r], light, hit) && hit.depth > 0.0f;
+        sink = hits;
+    }));
+    Report("ray-AABB", "scalar", BestTime(runs, tests, [&] {
+        uint32_t hits = 0;
+        glm::vec3 origin(0.0f);
+        for (int r = 0; r < rayCount; r++)
+            for (int i = 0; i < primitiveCount; i++)
+                hits += IntersectBox(boxes[i].lower, boxes[i].upper, origin, invDirections[r], 0.0f, FLT_MAX);
+        sink = hits;
+    }));
+
+    // eight child boxes per node test
+    Report("ray-wide node (8 box)", "scalar", BestTime(runs, tests * 8, [&] {
+        uint32_t hits = 0;
+        glm::vec3 origin(0.0f);
+        for (int r = 0; r < rayCount; r++)
+            for (int i = 0; i < primitiveCount; i++)
+                hits += IntersectWideNodeScalar(wideNodes[i], origin, invDirections[r], 0.0f, FLT_MAX);
+        sink = hits;
+    }));
+#if defined(__SSE2__)
+    Report("ray-wide node (8 box)", "SSE", BestTime(runs, tests * 8, [&] {
+        uint32_t hits = 0;
+        glm::vec3 origin(0.0f);
+        for (int r = 0; r < rayCount; r++)
+            for (int i = 0; i < primitiveCount; i++)
+                hits += IntersectWideNodeSSE(wideNodes[i], origin, invDirections[r], 0.0f, FLT_MAX);
+        sink = hits;
+    }));
+#endif
+
+    // shading with the cosines of real hits and the shininess values the
+    // palettes use
+    vector<PrimitiveHit> shadeInputs(rayCount);
+    for (int r = 0; r < rayCount; r++)
+        IntersectSphere(spheres[r % primitiveCount], directions[r], light, shadeInputs[r]);
+    Material materials[3] = { { { 0.3, 0.3, 0.3 }, 10 }, { { 0.0, 1.0, 0.0 }, 1000 },
+                              { { 1.0, 1.0, 0.0 }, 10000 } };
+    Report("shade", "scalar", BestTime(runs, rayCount, [&] {
+        float colour[3], total = 0.0f;
+        for (int r = 0; r < rayCount; r++) {
+            Shade(materials[r % 3], shadeInputs[r].dot, shadeInputs[r].dot2, colour);
+            total += colour[0];
+        }
+        sink = (uint32_t)total;
+    }));
+
+    // float to 8-bit, per value, with the default clamp and with the most
+    // expensive curve
+    vector<float> values((size_t)rayCount * 3);
+    vector<unsigned char> bytes(values.size());
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = random.Uniform(-0.1f, 1.5f);
+    ToneMapSettings clamp, filmic;
+    filmic.curve = FilmicCurve;
+    filmic.srgb = true;
+    double count = (double)values.size();
+    Report("float to 8-bit clamp", "scalar", BestTime(runs, count, [&] {
+        ToneMapValuesScalar(&values[0], values.size(), clamp, &bytes[0]);
+        sink = bytes[values.size() / 2];
+    }));
+    Report("float to 8-bit clamp", "SSE", BestTime(runs, count, [&] {
+        ToneMapValues(&values[0], values.size(), clamp, &bytes[0]);
+        sink = bytes[values.size() / 2];
+    }));
+    Report("float to 8-bit filmic", "scalar", BestTime(runs, count, [&] {
+        ToneMapValuesScalar(&values[0], values.size(), filmic, &bytes[0]);
+        sink = bytes[values.size() / 2];
+    }));
+    Report("float to 8-bit filmic", "SSE", BestTime(runs, count, [&] {
+        ToneMapValues(&values[0], values.size(), filmic, &bytes[0]);
+        sink = bytes[values.size() / 2];
+    }));
+    return 0;
+}
@@ -0,0 +1,366 @@
+// ==========================================================================
+// Scene Scaling Benchmark
+//
+// Generates scenes of increasing size in the usual scene file format,
+// renders each one headless at fixed resolutions and reports parse, build
+// and trace times, memory and Mrays/s. Results can be saved as a baseline
+// and later runs compared against it; the run fails if the baseline cannot
+// be read, if a case is missing from it, or if a case's Mrays/s dropped or
+// its trace time or resident memory grew by more than the threshold.
+//
+// Suites:
+//   triangles  N small random triangles
+//   spheres    N random spheres (every ray tests every sphere, so keep N
+//              well below the triangle sizes)
+//   mixed      N triangles and N/10 spheres, with a floor, a back wall and
+//              two lights
+//
+// Usage: scene_scaling [--sizes 1K,10K,...] [--suites triangles,spheres,mixed]
+//                      [--resolutions 256,512] [--threads N] [--repeat N]
+//                      [--scene-dir DIR] [--baseline FILE]
+//                      [--save-baseline FILE] [--threshold 0.1]
+// ==========================================================================
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "Raytracer.h"
+#include "ThreadPool.h"
+#include "RenderStats.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    // small deterministic generator, so a scene of a given size is the same
+    // on every platform and every run
+    class Random
+    {
+        uint64_t m_state;
+
+    public:
+        explicit Random(uint64_t seed) : m_state(seed * 2654435761u + 1) {}
+
+        // uniform in [lo, hi)
+        float Uniform(float lo, float hi)
+        {
+            m_state = m_state * 6364136223846793005ull + 1442695040888963407ull;
+            return lo + (hi - lo) * (float)((m_state >> 40) / 16777216.0);
+        }
+    };
+
+    // a point somewhere in the camera's view, between 4 and 20 units away
+    glm::vec3 PointInView(Random &random)
+    {
+        float z = random.Uniform(-20.0f, -4.0f);
+        float spread = -z * 0.45f;
+        return glm::vec3(random.Uniform(-spread, spread), random.Uniform(-spread, spread), z);
+    }
+
+    // writes the generated scene and returns false if it could not
+    bool GenerateScene(const string &fileName, const string &suite, int size)
+    {
+        ofstream file(fileName.c_str());
+        if (!file.is_open()) {
+            cout << "ERROR: Could not write scene file " << fileName << endl;
+            return false;
+        }
+
+        Random random(size + 7919 * suite.size());
+        int triangles = (suite == "spheres") ? 0 : size;
+        int spheres = (suite == "triangles") ? 0 : (suite == "mixed" ? size / 10 : size);
+        bool room = (suite == "mixed");
+
+        file << "# generated by scene_scaling: " << suite << " " << size << "\n\n";
+        file << "light {\n  0 2.5 -5.75\n}\n\n";
+        if (room)
+            file << "light {\n  -3 3 -2\n}\n\n"
+                 << "plane {\n  0 1 0\n  0 -2.75 0\n}\n\n"
+                 << "plane {\n  0 0 1\n  0 0 -24\n}\n\n";
+
+        // triangle size shrinks with the count so the image does not turn
+        // into a solid wall of overlapping triangles
+        float edge = 6.0f / sqrt((float)max(triangles, 1)) + 0.02f;
+        for (int i = 0; i < triangles; i++) {
+            glm::vec3 p = PointInView(random);
+            file << "triangle {\n";
+            for (int k = 0; k < 3; k++) {
+                glm::vec3 v = p + glm::vec3(random.Uniform(-edge, edge), random.Uniform(-edge, edge),
+                                            random.Uniform(-edge, edge));
+                file << "  " << v.x << " " << v.y << " " << v.z << "\n";
+            }
+            file << "}\n";
+        }
+
+        float radius = 2.0f / sqrt((float)max(spheres, 1)) + 0.01f;
+        for (int i = 0; i < spheres; i++) {
+            glm::vec3 c = PointInView(random);
+            file << "sphere {\n  " << c.x << " " << c.y << " " << c.z << "\n  "
+                 << radius * random.Uniform(0.5f, 1.5f) << "\n}\n";
+        }
+
+        file.close();
+        return !file.fail();
+    }
+
+    // resident memory of the process in MB, or 0 where it cannot be read
+    double ResidentMegabytes()
+    {
+        ifstream statm("/proc/self/statm");
+        long pages = 0, resident = 0;
+        if (!(statm >> pages >> resident))
+            return 0.0;
+        return resident * 4096.0 / (1024.0 * 1024.0);
+    }
+
+    // sizes like 1000, 10K or 1M
+    int ParseSize(const string &text)
+    {
+        int value = atoi(text.c_str());
+        char suffix = text.empty() ? 0 : text[text.size() - 1];
+        if (suffix == 'K' || suffix == 'k')
+            value *= 1000;
+        else if (suffix == 'M' || suffix == 'm')
+            value *= 1000000;
+        return value;
+    }
+
+    vector<string> SplitList(const string &text)
+    {
+        vector<string> items;
+        stringstream list(text);
+        string item;
+        while (getline(list, item, ','))
+            if (!item.empty())
+                items.push_back(item);
+        return items;
+    }
+
+    struct CaseResult
+    {
+        string name;            // suite/size/resolution
+        double parseTime;
+        double buildTime;
+        double traceTime;       // best of the repeats
+        double mraysPerSecond;
+        double testsPerRay;
+        double bvhKilobytes;
+        double residentMegabytes;
+    };
+
+    // baseline files hold one "name mrays_per_s trace_ms rss_mb" line per
+    // case; false (after saying why) if the file cannot be read
+    bool LoadBaseline(const string &fileName, map<string, CaseResult> &baseline)
+    {
+        ifstream file(fileName.c_str());
+        if (!file.is_open()) {
+            cout << "ERROR: Could not open baseline " << fileName << endl;
+            return false;
+        }
+        string line;
+        while (getline(file, line)) {
+            if (line.empty())
+                continue;
+            stringstream fields(line);
+            CaseResult result = CaseResult();
+            if (!(fields >> result.name >> result.mraysPerSecond >> result.traceTime
+                         >> result.residentMegabytes)) {
+                cout << "ERROR: " << fileName << " is not a baseline (\"" << line << "\")" << endl;
+                return false;
+            }
+            baseline[result.name] = result;
+        }
+        return true;
+    }
+
+    // counts a regression if value moved the wrong way from the baseline by
+    // more than the threshold; higher says whether more is better
+    int Compare(const string &name, const char *what, double value, double base,
+                bool higher, double threshold)
+    {
+        if (base <= 0.0)
+            return 0;
+        double change = value / base - 1.0;
+        if ((higher ? -change : change) <= threshold)
+            return 0;
+        printf("REGRESSION %s: %.3f %s, baseline %.3f (%+.1f%%)\n", name.c_str(), value, what,
+               base, 100.0 * change);
+        return 1;
+    }
+
+    bool SaveBaseline(const string &fileName, const vector<CaseResult> &results)
+    {
+        ofstream file(fileName.c_str());
+        if (!file.is_open()) {
+            cout << "ERROR: Could not write baseline " << fileName << endl;
+            return false;
+        }
+        for (size_t i = 0; i < results.size(); i++)
+            file << results[i].name << " " << results[i].mraysPerSecond << " "
+                 << results[i].traceTime << " " << results[i].residentMegabytes << "\n";
+        return true;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+bool RunCase(const string &sceneFile, const string &name, int resolution, int repeat,
+             ThreadPool &pool, CaseResult &result)
+{
+    result.name = name;
+
+    Scene scene;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!LoadScene(sceneFile, scene))
+        return false;
+    chrono::steady_clock::time_point parsed = chrono::steady_clock::now();
+
+    vector<AABB> boxes;
+    TriangleBounds(scene, boxes);
+    scene.bvh.Build(boxes, &pool);
+    chrono::steady_clock::time_point built = chrono::steady_clock::now();
+    result.parseTime = chrono::duration<double, milli>(parsed - start).count();
+    result.buildTime = chrono::duration<double, milli>(built - parsed).count();
+    result.bvhKilobytes = scene.bvh.MemoryUsage() / 1024.0;
+
+    Camera camera(resolution, resolution);
+    Framebuffer framebuffer;
+    RenderStats stats;
+    result.traceTime = 0.0;
+    for (int i = 0; i < max(repeat, 1); i++) {
+        chrono::steady_clock::time_point traceStart = chrono::steady_clock::now();
+        RenderTiles(scene, 1, camera, framebuffer, &pool, &stats);
+        double time = chrono::duration<double, milli>(chrono::steady_clock::now() - traceStart).count();
+        if (i == 0 || time < result.traceTime)
+            result.traceTime = time;
+    }
+
+    TraceCounters total = stats.Total();
+    result.mraysPerSecond = total.rays / (result.traceTime * 1000.0);
+    result.testsPerRay = total.rays ? (double)total.Tests() / total.rays : 0.0;
+    result.residentMegabytes = ResidentMegabytes();
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    vector<string> suites = SplitList("triangles,spheres,mixed");
+    vector<string> sizeList;
+    vector<string> resolutions = SplitList("256");
+    int threadCount = 0;
+    int repeat = 3;
+    string sceneDir = ".";
+    string baselineFile, saveBaselineFile;
+    double threshold = 0.1;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--sizes" && i + 1 < argc)
+            sizeList = SplitList(argv[++i]);
+        else if (arg == "--suites" && i + 1 < argc)
+            suites = SplitList(argv[++i]);
+        else if (arg == "--resolutions" && i + 1 < argc)
+            resolutions = SplitList(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            threadCount = atoi(argv[++i]);
+        else if (arg == "--repeat" && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (arg == "--scene-dir" && i + 1 < argc)
+            sceneDir = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baselineFile = argv[++i];
+        else if (arg == "--save-baseline" && i + 1 < argc)
+            saveBaselineFile = argv[++i];
+        else if (arg == "--threshold" && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else
+            cout << "Ignoring unknown option " << arg << endl;
+    }
+
+    ThreadPool pool(threadCount);
+    cout << pool.ThreadCount() << " threads, best of " << repeat << " frames" << endl;
+    printf("%-28s %10s %10s %10s %9s %9s %10s %8s\n", "case", "parse ms", "build ms",
+           "trace ms", "Mrays/s", "tests/ray", "bvh KB", "rss MB");
+
+    vector<CaseResult> results;
+    for (size_t s = 0; s < suites.size(); s++) {
+        // spheres are not in the hierarchy, so their default sizes stop
+        // where a frame would take minutes
+        vector<string> sizes = sizeList;
+        if (sizes.empty())
+            sizes = SplitList(suites[s] == "triangles" ? "1K,10K,100K,1M" : "1K,10K");
+
+        for (size_t n = 0; n < sizes.size(); n++) {
+            int size = ParseSize(sizes[n]);
+            char sceneName[64];
+            snprintf(sceneName, sizeof(sceneName), "scaling_%s_%d.txt", suites[s].c_str(), size);
+            string sceneFile = sceneDir + "/" + sceneName;
+            if (!GenerateScene(sceneFile, suites[s], size))
+                return -1;
+
+            for (size_t r = 0; r < resolutions.size(); r++) {
+                int resolution = atoi(resolutions[r].c_str());
+                char name[64];
+                snprintf(name, sizeof(name), "%s/%d/%d", suites[s].c_str(), size, resolution);
+
+                CaseResult result;
+                if (!RunCase(sceneFile, name, resolution, repeat, pool, result))
+                    return -1;
+                printf("%-28s %10.1f %10.1f %10.1f %9.3f %9.2f %10.0f %8.1f\n", name,
+                       result.parseTime, result.buildTime, result.traceTime,
+                       result.mraysPerSecond, result.testsPerRay, result.bvhKilobytes,
+                       result.residentMegabytes);
+                results.push_back(result);
+            }
+            remove(sceneFile.c_str());
+        }
+    }
+
+    if (!saveBaselineFile.empty() && SaveBaseline(saveBaselineFile, results))
+        cout << "baseline saved to " << saveBaselineFile << endl;
+
+    if (baselineFile.empty())
+        return 0;
+
+    // every case run has to be in the baseline; cases only in the baseline
+    // were simply not asked for this time
+    map<string, CaseResult> baseline;
+    if (!LoadBaseline(baselineFile, baseline))
+        return 1;
+    int regressions = 0, missing = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        const CaseResult &result = results[i];
+        map<string, CaseResult>::const_iterator found = baseline.find(result.name);
+        if (found == baseline.end()) {
+            printf("MISSING %s: not in the baseline\n", result.name.c_str());
+            missing++;
+            continue;
+        }
+        const CaseResult &base = found->second;
+        regressions += Compare(result.name, "Mrays/s", result.mraysPerSecond, base.mraysPerSecond,
+                               true, threshold);
+        regressions += Compare(result.name, "trace ms", result.traceTime, base.traceTime,
+                               false, threshold);
+        regressions += Compare(result.name, "rss MB", result.residentMegabytes, base.residentMegabytes,
+                               false, threshold);
+    }
+    if (regressions > 0 || missing > 0) {
+        cout << "FAILED: " << regressions << " regression(s) by more than " << 100.0 * threshold
+             << "%, " << missing << " case(s) missing from the baseline" << endl;
+        return 1;
+    }
+    cout << "OK: no case worse than the baseline by more than " << 100.0 * threshold << "%" << endl;
+    return 0;
+}
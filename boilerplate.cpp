@@ -14,11 +14,31 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
 #include <string>
 #include <iterator>
+#include <cfloat>
+#include <cstdio>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <glm/glm.hpp>
-#include "ImageBuffer.h"
+#include "BVH.h"
+#include "ThreadPool.h"
+#include "Raytracer.h"
+#include "ImageWriter.h"
+#include "Denoise.h"
+#include "PathTracer.h"
+#include "IrradianceCache.h"
+#include "TextureCache.h"
+#include "Environment.h"
+#include "RenderStats.h"
+#include "Heatmap.h"
+#include "Trace.h"
+#include "ProcessRenderer.h"
+#include "Progressive.h"
+#include "Checkpoint.h"
 
 // Specify that we want the OpenGL core profile before including GLFW headers
 #ifndef LAB_LINUX
@@ -100,66 +120,56 @@ struct MyGeometry
 	{}
 };
 
-struct ray
+// create the point buffers once: one vertex per pixel at a fixed position,
+// and a colour buffer that is overwritten with every rendered frame
+bool InitializeGeometry(MyGeometry *geometry, const vector<GLfloat> &vertices)
 {
-	vector<float> position;
-	vector<float> direction;
-	vector<float> intersection;
-};
-
-void GeneratePoint(MyGeometry *geometry, MyShader *shader, vector <vector<GLfloat>> & coordinates, vector<vector <GLfloat>> & colour)
-{
-		GLfloat vertices[409600][2];
-		for (int i = 0; i < 409600; i++) {
-			vertices[i][0] = coordinates.at(i).at(0);
-			vertices[i][1] = coordinates.at(i).at(1);
-		}
-
-		GLfloat colours[409600][3];
-		for (int i = 0; i < 409600; i++) {
-			colours[i][0] = colour.at(i).at(0);
-			colours[i][1] = colour.at(i).at(1);
-			colours[i][2] = colour.at(i).at(2);
-		}
+	geometry->elementCount = vertices.size() / 2;
 
-    geometry->elementCount = 409600;
+	// these vertex attribute indices correspond to those specified for the
+	// input variables in the vertex shader
+	const GLuint VERTEX_INDEX = 0;
+	const GLuint COLOUR_INDEX = 1;
 
-    // these vertex attribute indices correspond to those specified for the
-    // input variables in the vertex shader
+	// create an array buffer object for storing our vertices
+	glGenBuffers(1, &geometry->vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
 
-    const GLuint VERTEX_INDEX = 0;
-    const GLuint COLOUR_INDEX = 1;
+	// create another one for storing our colours, filled in by UpdateColours
+	glGenBuffers(1, &geometry->colourBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+	glBufferData(GL_ARRAY_BUFFER, geometry->elementCount * 3 * sizeof(GLfloat), 0, GL_DYNAMIC_DRAW);
 
-    // create an array buffer object for storing our vertices
-    glGenBuffers(1, &geometry->vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // create another one for storing our colours
-    glGenBuffers(1, &geometry->colourBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(colours), colours, GL_STATIC_DRAW);
+	// create a vertex array object encapsulating all our vertex attributes
+	glGenVertexArrays(1, &geometry->vertexArray);
+	glBindVertexArray(geometry->vertexArray);
 
-    // create a vertex array object encapsulating all our vertex attributes
-    glGenVertexArrays(1, &geometry->vertexArray);
-    glBindVertexArray(geometry->vertexArray);
+	// associate the position array with the vertex array object
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+	glVertexAttribPointer(VERTEX_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(VERTEX_INDEX);
 
-    // associate the position array with the vertex array object
-    glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
-    glVertexAttribPointer(VERTEX_INDEX, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(VERTEX_INDEX);
+	// assocaite the colour array with the vertex array object
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+	glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glEnableVertexAttribArray(COLOUR_INDEX);
 
-    // assocaite the colour array with the vertex array object
-    glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
-    glVertexAttribPointer(COLOUR_INDEX, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(COLOUR_INDEX);
+	// unbind our buffers, resetting to default state
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
 
-    // unbind our buffers, resetting to default state
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+	// check for OpenGL errors and return false if error occurred
+	return !CheckGLErrors();
+}
 
-    // check for OpenGL errors and return false if error occurred
-    CheckGLErrors();
+// copy a frame's pixel colours into the existing colour buffer
+void UpdateColours(MyGeometry *geometry, const vector<GLfloat> &colours)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, geometry->colourBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, colours.size() * sizeof(GLfloat), colours.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	CheckGLErrors();
 }
 
 // deallocate geometry-related objects
@@ -260,41 +270,245 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	// call function to create and fill buffers with geometry data
 	MyGeometry geometry;
-//	if (!InitializeGeometry(&geometry))
-	//	cout << "Program failed to intialize geometry!" << endl;
-	ImageBuffer Image;
-	Image.Initialize();
 
-		vector<vector<GLfloat>> vertices;
-		vertices.resize(409600, vector<GLfloat>(2, 0.0));
+		// one point per pixel: x,y positions and r,g,b colours, kept for the
+		// whole session so a frame only overwrites them
+		vector<GLfloat> vertices(409600 * 2, 0.0);
+		vector<GLfloat> colours(409600 * 3, 0.0);
 
-		vector<vector<GLfloat>> colours;
-		colours.resize(409600, vector<GLfloat>(3, 0.0));
+		// the scene being rendered, the colours the workers trace into, and
+		// those colours in row-major order, bottom row first
+		Scene sceneData;
+		Framebuffer framebuffer;
+		FramebufferLayout framebufferLayout = RowMajorLayout;
+		vector<glm::vec3> pixels;
 
-		vector<ray> rays (409600);
-		vector<float> position (2, 0);
-		vector<float> direction (3, 0);
-		vector<float> intersection (4, 0.0);
+		int width = 640.0;
+		int height = 640.0;
 
-		vector<float> camera (3, 0);
-		camera[2] = -640.0;
+		int scene = 1;
 
-		vector<vector<float>> lights;
-		lights.resize(50, vector<float>(3, 0.0));
-		vector<vector<float>> spheres;
-		spheres.resize(50, vector<float>(4, 0.0));
-		vector<vector<float>> planes;
-		planes.resize(50, vector<float>(6, 0.0));
-		vector<vector<float>> triangles;
-		triangles.resize(50, vector<float>(9, 0.0));
+		// how the hierarchy over the scene triangles is built and kept up
+		bool useWideBVH = false;
+		BVHBuildMethod bvhMethod = BuildBinnedSAH;
+		int threadCount = 0;
+		int processCount = 0;
+		double timeBudget = 0.0;
+		float rebuildThreshold = 1.3f;
+		int pngLevel = DefaultPngLevel;
+		FloatOutput floatOutput = NoFloatOutput;
+		int aovs = 0;
+		vector<string> aovNames;
+		vector<float> aovValues;
+
+		// Monte Carlo path tracing instead of the fixed shading, with --path
+		bool pathTrace = false;
+		PathSettings pathSettings;
+		IrradianceCache irradianceCache;
+		RenderStats fillStats;
+		int textureMemory = 64;
+		unique_ptr<TextureCache> textureCache;
+		Environment environment;
+
+		// edge-aware filtering of the colours, guided by depth, normal and albedo
+		bool denoise = false;
+		Denoiser denoiser;
+		vector<float> denoiseGuides;
+
+		// timing and counts of each frame, written as JSON at the end
+		string statsFile;
+		vector<FrameStats> frameStats;
+		FrameStats frameStat;
+
+		// per-pixel cost image, a debugging aid
+		bool heatmap = false;
+		CostMetric heatmapMetric = TestsCost;
+		vector<PixelCost> pixelCosts;
+
+		// finished tiles saved as they come, with --checkpoint, so that an
+		// interrupted render can be resumed; each frame of a sequence has
+		// its own file, and all are kept until the last image is saved
+		string checkpointFile;
+		double checkpointInterval = 30.0;
+		bool resume = false;
+		TileCheckpoint checkpoint;
+		vector<string> checkpointFiles;
+		vector<bool> tilesDone;
+		vector<float> tileValues;
+		mutex checkpointMutex;
+		chrono::steady_clock::time_point lastCheckpointSync;
+
+		// timeline of every thread, written as Chrome trace-event JSON
+		string traceFile;
+		int previousTriangleCount = -1;
+
+		// scene chosen on the command line, and the files of a frame sequence
+		int sceneOption = 0;
+		vector<string> frameFiles;
+		int frame = 0;
+
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			if (arg == "--bvh8")
+				useWideBVH = true;
+			else if (arg == "--lbvh")
+				bvhMethod = BuildMorton;
+			else if (arg == "--tiled-framebuffer")
+				framebufferLayout = TiledLayout;
+			else if (arg == "--threads" && i + 1 < argc)
+				threadCount = atoi(argv[++i]);
+			else if (arg == "--processes" && i + 1 < argc)
+				processCount = atoi(argv[++i]);
+			else if (arg == "--time-budget" && i + 1 < argc)
+				timeBudget = atof(argv[++i]);
+			else if (arg == "--scene" && i + 1 < argc)
+				sceneOption = atoi(argv[++i]);
+			else if (arg == "--sequence" && i + 1 < argc) {
+				// one scene file per line, blank lines and # comments skipped
+				ifstream list(argv[++i]);
+				string line;
+				while (getline(list, line))
+					if (!line.empty() && line[0] != '#')
+						frameFiles.push_back(line);
+				if (frameFiles.empty())
+					cout << "No frames found in sequence " << argv[i] << endl;
+			}
+			else if (arg == "--png-level" && i + 1 < argc)
+				pngLevel = atoi(argv[++i]);
+			else if (arg == "--float-output" && i + 1 < argc) {
+				string format = argv[++i];
+				if (format == "pfm")
+					floatOutput = PfmOutput;
+				else if (format == "tiled")
+					floatOutput = TiledFloatOutput;
+				else
+					cout << "Unknown float output format " << format << " (use pfm or tiled)" << endl;
+			}
+			else if (arg == "--aov" && i + 1 < argc) {
+				// comma separated, e.g. depth,normal,id,position,albedo or all
+				stringstream list(argv[++i]);
+				string name;
+				while (getline(list, name, ',')) {
+					if (name == "depth")
+						aovs |= AovDepth;
+					else if (name == "normal")
+						aovs |= AovNormal;
+					else if (name == "id")
+						aovs |= AovObjectId;
+					else if (name == "position")
+						aovs |= AovPosition;
+					else if (name == "albedo")
+						aovs |= AovAlbedo;
+					else if (name == "all")
+						aovs |= AllAovs;
+					else
+						cout << "Unknown AOV " << name << " (use depth, normal, id, position, albedo or all)" << endl;
+				}
+			}
+			else if (arg == "--path" && i + 1 < argc) {
+				pathTrace = true;
+				pathSettings.samples = atoi(argv[++i]);
+			}
+			else if (arg == "--irradiance-cache")
+				pathSettings.irradianceCache = &irradianceCache;
+			else if (arg == "--light-intensity" && i + 1 < argc)
+				pathSettings.lightIntensity = (float)atof(argv[++i]);
+			else if (arg == "--texture-memory" && i + 1 < argc)
+				textureMemory = max(atoi(argv[++i]), 1);
+			else if (arg == "--denoise")
+				denoise = true;
+			else if (arg == "--heatmap" && i + 1 < argc) {
+				string metric = argv[++i];
+				heatmap = true;
+				if (metric == "tests")
+					heatmapMetric = TestsCost;
+				else if (metric == "steps")
+					heatmapMetric = StepsCost;
+				else if (metric == "time")
+					heatmapMetric = TimeCost;
+				else {
+					cout << "Unknown heatmap metric " << metric << " (use tests, steps or time)" << endl;
+					heatmap = false;
+				}
+			}
+			else if (arg == "--stats" && i + 1 < argc)
+				statsFile = argv[++i];
+			else if (arg == "--trace" && i + 1 < argc)
+				traceFile = argv[++i];
+			else if (arg == "--rebuild-threshold" && i + 1 < argc)
+				rebuildThreshold = (float)atof(argv[++i]);
+			else if (arg == "--checkpoint" && i + 1 < argc)
+				checkpointFile = argv[++i];
+			else if (arg == "--checkpoint-interval" && i + 1 < argc)
+				checkpointInterval = atof(argv[++i]);
+			else if (arg == "--resume")
+				resume = true;
+			else
+				cout << "Ignoring unknown option " << arg << endl;
+		}
+		if ((processCount > 0 || timeBudget > 0.0) && (aovs || heatmap || denoise)) {
+			cout << "--processes and --time-budget render colours only, ignoring --aov, --heatmap and --denoise" << endl;
+			aovs = 0;
+			heatmap = false;
+			denoise = false;
+		}
+		if ((processCount > 0 || timeBudget > 0.0) && pathTrace) {
+			cout << "--processes and --time-budget use the fixed shading, ignoring --path" << endl;
+			pathTrace = false;
+		}
 
+		// texture tiles shared by every thread of the path tracer
+		if (pathTrace) {
+			textureCache.reset(new TextureCache((size_t)textureMemory << 20));
+			pathSettings.textures = textureCache.get();
+		}
+		if (processCount > 0 && timeBudget > 0.0) {
+			cout << "--time-budget renders on threads, ignoring --processes" << endl;
+			processCount = 0;
+		}
+		if (resume && checkpointFile.empty())
+			checkpointFile = "image.checkpoint";
+		if ((processCount > 0 || timeBudget > 0.0) && !checkpointFile.empty()) {
+			cout << "--processes and --time-budget do not save tiles, ignoring --checkpoint and --resume" << endl;
+			checkpointFile.clear();
+		}
 
-		int width = 640.0;
-		int height = 640.0;
+		// recording starts before the pool so its workers are named in order
+		SetTraceThreadName("main");
+		EnableTracing(!traceFile.empty());
+
+		// worker threads shared by the hierarchy builder and the renderer
+		ThreadPool pool(threadCount);
+		cout << "using " << pool.ThreadCount() << " threads" << endl;
+
+		// saves finished frames in the background, at most two waiting, and
+		// compresses them on the pool
+		ImageWriter writer(2, &pool, pngLevel);
+
+		// forked render processes, used instead of the pool when asked for
+		ProcessRenderer processRenderer(processCount);
+
+		// refines each frame until its time is up, with --time-budget
+		ProgressiveRenderer progressiveRenderer;
+		writer.SetFloatOutput(floatOutput);
+		framebuffer.Resize(width, height, framebufferLayout);
+		framebuffer.KeepAovs(aovs != 0 || denoise);
+		framebuffer.KeepCosts(heatmap);
+		AovChannelNames(aovs, aovNames);
+
+		// call function to create and fill buffers with geometry data
+		Camera camera(width, height);
+		for (int i = 0, count = 0; i < height; i++)
+			for (int j = 0; j < width; j++, count++) {
+				vertices[2*count] = camera.ImageX(j);
+				vertices[2*count+1] = camera.ImageY(i);
+			}
+		if (!InitializeGeometry(&geometry, vertices))
+			cout << "Program failed to intialize geometry!" << endl;
 
-		int scene = 1;
+		// triangle boxes for the hierarchy, reused from frame to frame
+		vector<AABB> triangleBoxes;
 
 	// run an event-triggered main loop
 	while (!glfwWindowShouldClose(window))
@@ -302,46 +516,23 @@ int main(int argc, char *argv[])
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 
-		cout << "Choose a scene(1,2,3): ";
-		cin >> scene;
-		cout << "rendering..." << endl;
-
-
-		//ray generation
-
-		float row = -1;
-		float col = -1;
-		int PixelCount = 0;
-
-		for (float i = 0; i < height; i++) {
-			for (float j = 0; j < width; j++) {
-				row = (2*(j/width))-1;
-
-				//rays[PixelCount] = new struct <ray>;
-				rays.push_back(ray());
-
-				position[0] = row; position[1] = col;
-				rays[PixelCount].position = position;
-
-				direction[0] = row; direction[1] = col; direction[2] = -2;
-				rays[PixelCount].direction = direction;
-
-				intersection[0] = -1.0;
-				rays[PixelCount].intersection = intersection;
-
-				vertices.at(PixelCount).at(0) = row;
-				vertices.at(PixelCount).at(1) = col;
-				PixelCount++;
-			}
-			col = (2*(i/height))-1;
+		// a scene given on the command line (or a frame sequence) is rendered
+		// without prompting, and the program exits once it is done
+		bool lastFrame = false;
+		if (sceneOption > 0 || !frameFiles.empty()) {
+			scene = sceneOption > 0 ? sceneOption : 1;
+			lastFrame = frameFiles.empty() || frame + 1 == (int)frameFiles.size();
+		} else {
+			cout << "Choose a scene(1,2,3): ";
+			cin >> scene;
 		}
+		if (!frameFiles.empty())
+			cout << "rendering frame " << frame << " (" << frameFiles[frame] << ")..." << endl;
+		else
+			cout << "rendering..." << endl;
 
-		//read from file
 
-		int lightCount = 0;
-		int sphereCount = 0;
-		int planeCount = 0;
-		int triangleCount = 0;
+		//read from file
 
 		string s;
 		switch (scene) {
@@ -355,508 +546,217 @@ int main(int argc, char *argv[])
 			s = "scene3.txt";
 			break;
 		}
-
-				ifstream File;
-				File.open(s);
-				if (File.is_open()){
-		    string word;
-		    while (File >> word)
-		    {
-						if (word == "light") {
-							File >> word;
-							if (word == "{"){
-							File >> word;
-							if (word != "x"){
-								lights.at(lightCount).at(0) = (float)atof(word.c_str());
-								File >> word; lights.at(lightCount).at(1) = (float)atof(word.c_str());
-								File >> word; lights.at(lightCount).at(2) = (float)atof(word.c_str());
-								lightCount++;}}
-						} else if (word == "sphere") {
-							File >> word;
-							if (word == "{"){
-							File >> word;
-							if (word != "x"){
-								spheres.at(sphereCount).at(0) = (float)atof(word.c_str());
-								File >> word; spheres.at(sphereCount).at(1) = (float)atof(word.c_str());
-								File >> word; spheres.at(sphereCount).at(2) = (float)atof(word.c_str());
-								File >> word; spheres.at(sphereCount).at(3) = (float)atof(word.c_str());
-								sphereCount++;}}
-						} else if (word == "plane"){
-							File >> word;
-							if (word == "{"){
-							File >> word;
-							if (word != "xn"){
-								planes.at(planeCount).at(0) = (float)atof(word.c_str());
-								File >> word; planes.at(planeCount).at(1) = (float)atof(word.c_str());
-								File >> word; planes.at(planeCount).at(2) = (float)atof(word.c_str());
-								File >> word; planes.at(planeCount).at(3) = (float)atof(word.c_str());
-								File >> word; planes.at(planeCount).at(4) = (float)atof(word.c_str());
-								File >> word; planes.at(planeCount).at(5) = (float)atof(word.c_str());
-								planeCount++;}}
-						}else if (word == "triangle"){
-							File >> word;
-							if (word == "{"){
-							File >> word;
-							if (word != "x1"){
-								triangles.at(triangleCount).at(0) = (float)atof(word.c_str());
-								File >> word; triangles.at(triangleCount).at(1) = (float)atof(word.c_str());
-								File >> word; triangles.at(triangleCount).at(2) = (float)atof(word.c_str());
-								File >> word; triangles.at(triangleCount).at(3) = (float)atof(word.c_str());
-								File >> word; triangles.at(triangleCount).at(4) = (float)atof(word.c_str());
-								File >> word; triangles.at(triangleCount).at(5) = (float)atof(word.c_str());
-								File >> word; triangles.at(triangleCount).at(6) = (float)atof(word.c_str());
-								File >> word; triangles.at(triangleCount).at(7) = (float)atof(word.c_str());
-								File >> word; triangles.at(triangleCount).at(8) = (float)atof(word.c_str());
-								triangleCount++;}}
-						}
-		    }}
+		if (!frameFiles.empty())
+			s = frameFiles[frame];
+		chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+		chrono::steady_clock::time_point phaseStart = frameStart;
+		LoadScene(s, sceneData);
+		frameStat.frame = frame;
+		frameStat.sceneFile = s;
+		frameStat.width = width;
+		frameStat.height = height;
+		frameStat.parseTime = chrono::duration<double, milli>(chrono::steady_clock::now() - phaseStart).count();
+		RecordTraceEvent("parse scene", frame, TraceTime(phaseStart), TraceClock());
+		int triangleCount = (int)sceneData.triangles.size();
+
+				// build the triangle hierarchy; frames of a sequence that keep the
+				// same triangles only refit it, unless that degraded it too much
+				TriangleBounds(sceneData, triangleBoxes);
+				chrono::steady_clock::time_point buildStart = chrono::steady_clock::now();
+				bool rebuilt = true;
+				if (frame > 0 && triangleCount == previousTriangleCount) {
+					rebuilt = sceneData.bvh.Update(triangleBoxes, rebuildThreshold, &pool, bvhMethod);
+				} else {
+					sceneData.bvh.Build(triangleBoxes, &pool, bvhMethod);
+					if (useWideBVH)
+						sceneData.bvh.Compress();
+				}
+				previousTriangleCount = triangleCount;
+				double buildTime = chrono::duration<double, milli>(chrono::steady_clock::now() - buildStart).count();
+				frameStat.buildTime = buildTime;
+				RecordTraceEvent(rebuilt ? "build bvh" : "refit bvh", frame, TraceTime(buildStart), TraceClock());
+				cout << "bvh: " << sceneData.bvh.NodeCount() << " nodes, "
+					<< sceneData.bvh.MemoryUsage() / 1024 << " KB, " << (rebuilt ? "built" : "refit")
+					<< " in " << buildTime << " ms, SAH cost " << sceneData.bvh.SAHCost() << endl;
 
 				//intersection
 
-				//sphere intersection
-				cout << "spheres" << endl;
-
-				float normalx = 0.0; float normaly = 0.0; float normalz = 0.0;
-				float nx = 0.0; float ny = 0.0; float nz = 0.0;
-				float ix = 0.0; float iy = 0.0; float iz = 0.0;
-				float nix = 0.0; float niy = 0.0; float niz = 0.0;
-				float hx = 0.0; float hy = 0.0; float hz = 0.0;
-
-				float scale = 0.0;
-				float dot = 0.0;
-				float dot2 = 0.0;
-
-				float proj = 0;
-				vector<float> projecton (3,0);
-				for (int i = 0; i < sphereCount; i++) {
-					for (int j = 0; j < 409600; j++){
-
-						proj = ( (spheres.at(i).at(0) * rays[j].direction[0])
-						+ (spheres.at(i).at(1) * rays[j].direction[1])
-						+ (spheres.at(i).at(2) * rays[j].direction[2]) )/
-						(pow((pow(rays[j].direction[0], 2.0)+pow(rays[j].direction[1], 2.0)+pow(rays[j].direction[2], 2.0)), 2.0 ));
-
-						projecton[0] = proj*rays[j].direction[0];
-						projecton[1] = proj*rays[j].direction[1];
-						projecton[2] = proj*rays[j].direction[2];
-						proj = sqrt(pow(rays[j].direction[0]-projecton[0], 2.0)+pow(rays[j].direction[1]-projecton[1], 2.0)+pow(rays[j].direction[2]-projecton[2], 2.0));
-
-						//unflatten sphere attempt
-						//proj = proj - sqrt( pow(spheres.at(i).at(3),2.0) - pow(sqrt(pow((projecton[0] - spheres.at(i).at(0)),2.0) + pow((projecton[1] - spheres.at(i).at(1)),2.0) + pow((projecton[2] - spheres.at(i).at(2)),2.0)), 2.0) );
-
-						if (proj < 0) {proj = proj * -1;}
-
-						scale = sqrt(pow(rays[j].direction[0],2) + pow(rays[j].direction[1],2) + pow(rays[j].direction[2],2)) - proj;
-						ix = rays[j].direction[0] - scale; iy = rays[j].direction[1] - scale; iz = rays[j].direction[2] - scale;
-
-						normalx = ix - spheres.at(i).at(0);
-						normaly	=	iy - spheres.at(i).at(1);
-						normalz	= iz - spheres.at(i).at(2);
-
-						nx = normalx/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
-						ny = normaly/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
-						nz = normalz/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
-
-						ix = lights.at(0).at(0) - ix; iy = lights.at(0).at(1) - iy; iz = lights.at(0).at(2) - iz;
-
-						nix = ix/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-						niy = iy/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-						niz = iz/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-
-						dot = -((nx * nix) + (ny * niy) + (nz * niz));
-
-						hx = (lights.at(0).at(0))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-						hy = (lights.at(0).at(1))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-						hz = (lights.at(0).at(2))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-
-						dot2 = -((nx * hx) + (ny * hy) + (nz * hz));
-
-						if (proj <= (float)spheres.at(i).at(3)) {
-							if (rays[j].intersection[0] == -1.0){
-								rays[j].intersection[0] = proj;
-								rays[j].intersection[1] = ix+lights.at(0).at(0);
-								rays[j].intersection[2] = iy+lights.at(0).at(1);
-								rays[j].intersection[3] = iz+lights.at(0).at(2);
-							} else if(rays[j].intersection[0] > proj){
-								rays[j].intersection[0] = proj;
-								rays[j].intersection[1] = ix+lights.at(0).at(0);
-								rays[j].intersection[2] = iy+lights.at(0).at(1);
-								rays[j].intersection[3] = iz+lights.at(0).at(2);
-							}
-
-							if(rays[j].intersection[0] == proj){
-								if(scene == 1){
-									colours.at(j).at(0) = 0.3*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.3*pow(dot2,10000);
-									colours.at(j).at(1) = 0.3*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.3*pow(dot2,10000);
-									colours.at(j).at(2) = 0.3*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.3*pow(dot2,10000);
-								} else if(scene == 2){
-									if (i == 0){
-										colours.at(j).at(0) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-										colours.at(j).at(1) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-										colours.at(j).at(2) = 0.0;
-									} else if (i == 1){
-										colours.at(j).at(0) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-										colours.at(j).at(1) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-										colours.at(j).at(2) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-									} else if (i == 2){
-										colours.at(j).at(0) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-										colours.at(j).at(1) = 0.0;
-										colours.at(j).at(2) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-									}
-								} else if(scene == 3){
-									colours.at(j).at(0) = 0.0;
-									colours.at(j).at(1) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,10000);
-									colours.at(j).at(2) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,10000);
-								}
-							}
-						}
-					}
+				// primary rays are made from pixel coordinates inside the tile
+				// workers and traced straight away, so no ray array is kept
+				// the time budget counts from the start of the frame, before the
+				// scene was parsed
+				chrono::steady_clock::time_point deadline = frameStart +
+					chrono::microseconds((long long)(timeBudget * 1e6));
+				phaseStart = chrono::steady_clock::now();
+				// the progressive and process renderers fill pixels themselves;
+				// if the processes cannot have their shared memory, the frame is
+				// rendered on the threads instead
+				bool inPixels = false;
+				if (timeBudget > 0.0) {
+					ProgressiveStats progress = progressiveRenderer.Render(sceneData, scene, camera, deadline, pixels, &pool);
+					cout << "time budget: " << progress.blockSize << "x" << progress.blockSize << " blocks, "
+						<< progress.samples << " samples per pixel, last pass " << (int)(100 * progress.lastPass)
+						<< "% done" << endl;
+					inPixels = true;
 				}
-
-
-				//triangle intersection
-				cout << "triangles" << endl;
-
-				float t = 0.0;
-				float u = 0.0;
-				float v = 0.0;
-
-				float a = 0.0; float b = 0.0; float c = 0.0;
-				float d = 0.0; float e = 0.0; float f = 0.0;
-				float g = 0.0; float h = 0.0; float k = 0.0;
-
-				 normalx = 0.0;  normaly = 0.0;  normalz = 0.0;
-				 nx = 0.0;  ny = 0.0;  nz = 0.0;
-				 ix = 0.0;  iy = 0.0;  iz = 0.0;
-				 nix = 0.0;  niy = 0.0;  niz = 0.0;
-				 hx = 0.0;  hy = 0.0;  hz = 0.0;
-
-				 scale = 0.0;
-				 dot = 0.0;
-				 dot2 = 0.0;
-
-				for (int i = 0; i < triangleCount; i++) {
-					for (int j = 0; j < 409600; j++){
-						//p + t * d = (1-u-v) * p0 + u * p1 + v * p2
-						a = -triangles.at(i).at(0); b = triangles.at(i).at(3) - triangles.at(i).at(0); c = triangles.at(i).at(6) - triangles.at(i).at(0);
-						d = -triangles.at(i).at(1); e = triangles.at(i).at(4) - triangles.at(i).at(1); f = triangles.at(i).at(7) - triangles.at(i).at(1);
-						g = -triangles.at(i).at(2); h = triangles.at(i).at(5) - triangles.at(i).at(2); k = triangles.at(i).at(8) - triangles.at(i).at(2);
-
-						t = a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g));
-
-						a = -rays[j].direction[0]; b = triangles.at(i).at(3) - triangles.at(i).at(0); c = triangles.at(i).at(6) - triangles.at(i).at(0);
-						d = -rays[j].direction[1]; e = triangles.at(i).at(4) - triangles.at(i).at(1); f = triangles.at(i).at(7) - triangles.at(i).at(1);
-						g = -rays[j].direction[2]; h = triangles.at(i).at(5) - triangles.at(i).at(2); k = triangles.at(i).at(8) - triangles.at(i).at(2);
-
-						t = t/(a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g)));
-
-
-						a = -rays[j].direction[0]; b = -triangles.at(i).at(0); c = triangles.at(i).at(6) - triangles.at(i).at(0);
-						d = -rays[j].direction[1]; e = -triangles.at(i).at(1); f = triangles.at(i).at(7) - triangles.at(i).at(1);
-						g = -rays[j].direction[2]; h = -triangles.at(i).at(2); k = triangles.at(i).at(8) - triangles.at(i).at(2);
-						u = a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g));
-
-						a = -rays[j].direction[0]; b = triangles.at(i).at(3) - triangles.at(i).at(0); c = triangles.at(i).at(6) - triangles.at(i).at(0);
-						d = -rays[j].direction[1]; e = triangles.at(i).at(4) - triangles.at(i).at(1); f = triangles.at(i).at(7) - triangles.at(i).at(1);
-						g = -rays[j].direction[2]; h = triangles.at(i).at(5) - triangles.at(i).at(2); k = triangles.at(i).at(8) - triangles.at(i).at(2);
-
-						u = u/(a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g)));
-
-
-						a = -rays[j].direction[0]; b = triangles.at(i).at(3) - triangles.at(i).at(0); c = -triangles.at(i).at(0);
-						d = -rays[j].direction[1]; e = triangles.at(i).at(4) - triangles.at(i).at(1); f = -triangles.at(i).at(1);
-						g = -rays[j].direction[2]; h = triangles.at(i).at(5) - triangles.at(i).at(2); k = -triangles.at(i).at(2);
-						v = a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g));
-
-						a = -rays[j].direction[0]; b = triangles.at(i).at(3) - triangles.at(i).at(0); c = triangles.at(i).at(6) - triangles.at(i).at(0);
-						d = -rays[j].direction[1]; e = triangles.at(i).at(4) - triangles.at(i).at(1); f = triangles.at(i).at(7) - triangles.at(i).at(1);
-						g = -rays[j].direction[2]; h = triangles.at(i).at(5) - triangles.at(i).at(2); k = triangles.at(i).at(8) - triangles.at(i).at(2);
-
-						v = v/(a*((e*k) - (f*h)) - b*((d*k) - (f*g)) + c*((d*h) - (e*g)));
-
-						normalx = (triangles.at(i).at(4) - triangles.at(i).at(1)) * (triangles.at(i).at(8) - triangles.at(i).at(2)) - (triangles.at(i).at(5) - triangles.at(i).at(2)) * (triangles.at(i).at(7) - triangles.at(i).at(1));
-						normaly	=	(triangles.at(i).at(5) - triangles.at(i).at(2)) * (triangles.at(i).at(6) - triangles.at(i).at(0)) - (triangles.at(i).at(3) - triangles.at(i).at(0)) * (triangles.at(i).at(8) - triangles.at(i).at(2));
-						normalz	= (triangles.at(i).at(3) - triangles.at(i).at(0)) * (triangles.at(i).at(7) - triangles.at(i).at(1)) - (triangles.at(i).at(4) - triangles.at(i).at(1)) * (triangles.at(i).at(6) - triangles.at(i).at(0));
-
-						nx = normalx/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
-						ny = normaly/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
-						nz = normalz/sqrt(pow(normalx,2) + pow(normaly,2) + pow(normalz,2));
-
-						scale = sqrt(pow(rays[j].direction[0],2) + pow(rays[j].direction[1],2) + pow(rays[j].direction[2],2)) - t;
-						ix = rays[j].direction[0] - scale; iy = rays[j].direction[1] - scale; iz = rays[j].direction[2] - scale;
-						ix = lights.at(0).at(0) - ix; iy = lights.at(0).at(1) - iy; iz = lights.at(0).at(2) - iz;
-
-						nix = ix/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-						niy = iy/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-						niz = iz/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-
-						dot = -((nx * nix) + (ny * niy) + (nz * niz));
-
-						hx = (lights.at(0).at(0))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-						hy = (lights.at(0).at(1))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-						hz = (lights.at(0).at(2))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-
-						dot2 = -((nx * hx) + (ny * hy) + (nz * hz));
-
-						if(u >= 0){
-							if(v >= 0){
-								if(u+v <= 1.0){
-
-									if (rays[j].intersection[0] == -1.0){
-										rays[j].intersection[0] = t;
-										rays[j].intersection[1] = ix;
-										rays[j].intersection[2] = iy;
-										rays[j].intersection[3] = iz;
-									} else if(rays[j].intersection[0] > t){
-										rays[j].intersection[0] = t;
-										rays[j].intersection[1] = ix;
-										rays[j].intersection[2] = iy;
-										rays[j].intersection[3] = iz;
-									}
-
-
-									if (scene == 1){
-									if(i >= 0){
-										if(i < 4){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 0.0;
-												colours.at(j).at(1) = 0.0;
-												colours.at(j).at(2) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,10);
-											}
-										} else if(i < 6){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(1) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(2) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-											}
-										} else if(i < 8){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 0.0;
-												colours.at(j).at(1) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(2) = 0.0;
-											}
-										} else if(i < 10){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(1) = 0.0;
-												colours.at(j).at(2) = 0.0;
-											}
-										} else if(i < 12){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 0.5*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.5*pow(dot2,1000);
-												colours.at(j).at(1) = 0.5*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.5*pow(dot2,1000);
-												colours.at(j).at(2) = 0.5*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.5*pow(dot2,1000);
-											}
-										}
-									}
-								} else if(scene == 2){
-									if(i >= 0){
-										if(i < 12){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 0.0;
-												colours.at(j).at(1) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(2) = 0.0;
-											}
-										} else if(i < 32){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(1) = 0.0;
-												colours.at(j).at(2) = 0.0;
-											}
-										}
-									}
-								} else if(scene == 3){
-									if(i >= 0){
-										if(i < 4){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 0.0;
-												colours.at(j).at(1) = 0.0;
-												colours.at(j).at(2) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,10);
-											}
-										} else if(i < 6){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(1) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(2) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-											}
-										} else if(i < 8){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 0.0;
-												colours.at(j).at(1) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(2) = 0.0;
-											}
-										} else if(i < 10){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 1.0*(0.5+(0.5*max(0.0f,dot))) + 0.5*1.0*pow(dot2,1000);
-												colours.at(j).at(1) = 0.0;
-												colours.at(j).at(2) = 0.0;
-											}
-										} else if(i < 12){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 0.5*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.5*pow(dot2,1000);
-												colours.at(j).at(1) = 0.5*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.5*pow(dot2,1000);
-												colours.at(j).at(2) = 0.5*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.5*pow(dot2,1000);
-											}
-										} else if(i < 32){
-											if(rays[j].intersection[0] == t){
-												colours.at(j).at(0) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-												colours.at(j).at(1) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-												colours.at(j).at(2) = 0.0;
-										}
-									}
-								}
-
-
+				else if (processCount > 0) {
+					inPixels = processRenderer.Render(sceneData, scene, camera, pixels, &pool);
+					if (!inPixels)
+						cout << "rendering frame " << frame << " on threads instead" << endl;
+				}
+				if (!inPixels) {
+					if (pathTrace) {
+						textureCache->LoadSceneTextures(sceneData);
+						environment.Load(sceneData.environment);
+						pathSettings.environment = environment.Loaded() ? &environment : 0;
+					}
+					// the irradiance cache starts every frame empty, as the
+					// scene may have moved
+					if (pathTrace && pathSettings.irradianceCache) {
+						irradianceCache.Clear();
+						irradianceCache.Fill(sceneData, scene, camera, pathSettings, &pool,
+							statsFile.empty() ? 0 : &fillStats);
+					}
+					// tiles saved by an earlier run of this same frame are put
+					// back and not rendered again; the pixel seeds of the path
+					// tracer make a tile's values all there is to its state
+					TileProgress progress;
+					bool checkpointed = false;
+					string checkpointName = checkpointFile;
+					if (!checkpointFile.empty()) {
+						if (!frameFiles.empty()) {
+							char suffix[16];
+							snprintf(suffix, sizeof(suffix), "_%04d", frame);
+							checkpointName += suffix;
+						}
+						ifstream sceneText(s.c_str(), ios::binary);
+						string text((istreambuf_iterator<char>(sceneText)), istreambuf_iterator<char>());
+						int settings[] = { frame, width, height, scene, pathTrace, pathSettings.samples,
+							pathSettings.maxBounces, pathSettings.rouletteBounces,
+							pathSettings.irradianceCache != 0, framebuffer.HasAovs(), framebuffer.HasCosts() };
+						float lighting[] = { pathSettings.lightIntensity, pathSettings.maxIndirect };
+						uint64_t signature = HashBytes(text.data(), text.size());
+						signature = HashBytes(settings, sizeof(settings), signature);
+						signature = HashBytes(lighting, sizeof(lighting), signature);
+
+						framebuffer.Resize(width, height, framebuffer.Layout());
+						tilesDone.assign(framebuffer.TileCount(), false);
+						checkpointed = checkpoint.Open(checkpointName, signature, resume,
+							[&](int t, const float *values, size_t count) {
+								if (t < 0 || t >= (int)tilesDone.size() || count != framebuffer.TileValueCount(t))
+									return false;
+								framebuffer.RestoreTile(t, values);
+								tilesDone[t] = true;
+								return true;
+							});
+						if (checkpointed) {
+							if (find(checkpointFiles.begin(), checkpointFiles.end(), checkpointName) == checkpointFiles.end())
+								checkpointFiles.push_back(checkpointName);
+							lastCheckpointSync = chrono::steady_clock::now();
+							progress.done = &tilesDone;
+							progress.save = [&](int t) {
+								lock_guard<mutex> lock(checkpointMutex);
+								tileValues.resize(framebuffer.TileValueCount(t));
+								framebuffer.SaveTile(t, tileValues.data());
+								checkpoint.Append(t, tileValues.data(), tileValues.size());
+								chrono::steady_clock::time_point now = chrono::steady_clock::now();
+								if (chrono::duration<double>(now - lastCheckpointSync).count() >= checkpointInterval) {
+									if (!checkpoint.Sync())
+										cout << "could not save checkpoint " << checkpointName << endl;
+									lastCheckpointSync = now;
 								}
-							}
+							};
 						}
-
 					}
-				}
-			}
-
-				//plane intersection
-				cout << "planes" << endl;
-
-				ix = 0.0; iy = 0.0; iz = 0.0;
-				nix = 0.0; niy = 0.0; niz = 0.0;
-				hx = 0.0; hy = 0.0; hz = 0.0;
-
-				scale = 0.0;
-				dot = 0.0;
-				dot2 = 0.0;
-
-
-				t = 0.0;
-				for (int i = 0; i < planeCount; i++) {
-					for (int j = 0; j < 409600; j++){
-						t = ((planes.at(i).at(3) * planes.at(i).at(0)) + (planes.at(i).at(4) * planes.at(i).at(1)) + (planes.at(i).at(5) * planes.at(i).at(2)))/
-						((rays[j].direction[0] * planes.at(i).at(0)) + (rays[j].direction[1] * planes.at(i).at(1)) + (rays[j].direction[2] * planes.at(i).at(2)));
-
-						scale = sqrt(pow(rays[j].direction[0],2) + pow(rays[j].direction[1],2) + pow(rays[j].direction[2],2)) - t;
-						ix = rays[j].direction[0] - scale; iy = rays[j].direction[1] - scale; iz = rays[j].direction[2] - scale;
-						ix = lights.at(0).at(0) - ix; iy = lights.at(0).at(1) - iy; iz = lights.at(0).at(2) - iz;
-
-						nix = ix/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-						niy = iy/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-						niz = iz/sqrt(pow(ix,2) + pow(iy,2) + pow(iz,2));
-
-						dot = -((planes.at(i).at(0) * nix) + (planes.at(i).at(1) * niy) + (planes.at(i).at(2) * niz));
-
-						hx = (lights.at(0).at(0))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-						hy = (lights.at(0).at(1))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-						hz = (lights.at(0).at(2))/sqrt(pow(lights.at(0).at(0),2) + pow(lights.at(0).at(1),2) + pow((lights.at(0).at(2)),2));
-
-						dot2 = -((planes.at(i).at(0) * hx) + (planes.at(i).at(1) * hy) + (planes.at(i).at(2) * hz));
-
-						if (scene == 1){
-							if (rays[j].intersection[0] == -1.0){
-								rays[j].intersection[0] = t;
-								rays[j].intersection[1] = ix;
-								rays[j].intersection[2] = iy;
-								rays[j].intersection[3] = iz;
-							} else if(rays[j].intersection[0] > t){
-								rays[j].intersection[0] = t;
-								rays[j].intersection[1] = ix;
-								rays[j].intersection[2] = iy;
-								rays[j].intersection[3] = iz;
-							}
-
-							if(rays[j].intersection[0] == t){
-								colours.at(j).at(0) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-								colours.at(j).at(1) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-								colours.at(j).at(2) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-							}
-
-						} else if(scene == 2){
-
-							if (rays[j].intersection[0] == -1.0){
-								rays[j].intersection[0] = t;
-								rays[j].intersection[1] = ix;
-								rays[j].intersection[2] = iy;
-								rays[j].intersection[3] = iz;
-							} else if(rays[j].intersection[0] > t){
-								//rays[j].intersection[0] = t;
-							}
-
-							if(rays[j].intersection[0] == t){
-								colours.at(j).at(0) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-								colours.at(j).at(1) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-								colours.at(j).at(2) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-							}
-						} else if(scene == 3) {
-							if (rays[j].intersection[0] == -1.0){
-								rays[j].intersection[0] = t;
-								rays[j].intersection[1] = ix;
-								rays[j].intersection[2] = iy;
-								rays[j].intersection[3] = iz;
-							} else if(rays[j].intersection[0] > t){
-								rays[j].intersection[0] = t;
-								rays[j].intersection[1] = ix;
-								rays[j].intersection[2] = iy;
-								rays[j].intersection[3] = iz;
-							}
-
-							if(rays[j].intersection[0] == t){
-								colours.at(j).at(0) = 0.0;
-								colours.at(j).at(1) = 0.0;
-								colours.at(j).at(2) = 0.7*(0.5+(0.5*max(0.0f,dot))) + 0.5*0.7*pow(dot2,1000);
-							}
-
-						}
-
+					RenderTiles(sceneData, scene, camera, framebuffer, &pool,
+						statsFile.empty() ? 0 : &frameStat.render, pathTrace ? &pathSettings : 0,
+						checkpointed ? &progress : 0);
+					if (checkpointed && !checkpoint.Sync())
+						cout << "could not save checkpoint " << checkpointName << endl;
+					// the fill pass's rays count towards the frame as well
+					if (pathTrace && pathSettings.irradianceCache && !statsFile.empty())
+						frameStat.render.Add(fillStats);
+					if (pathTrace && pathSettings.irradianceCache)
+						cout << "irradiance cache: " << irradianceCache.RecordCount() << " records" << endl;
+					if (pathTrace && !sceneData.textures.empty()) {
+						TextureCacheStats textureStats = textureCache->Stats();
+						uint64_t lookups = textureStats.hits + textureStats.misses;
+						cout << "texture cache: " << textureStats.residentTiles << " tiles, "
+							<< (lookups ? 100.0 * textureStats.hits / lookups : 0.0) << "% hits" << endl;
 					}
 				}
-
-				//shadows
-				cout << "shadows" << endl;
-				// attempt at evaluating shadow rays
-/*
-				float dista = 0.0; float distb = 0.0;
-
-				for (int i = 0; i < 409600; i++){
-					for (int j = 0; j < 409600; j++){
-						dista = sqrt(pow((rays[i].intersection[1] - rays[j].intersection[1]),2) + pow((rays[i].intersection[2] - rays[j].intersection[2]),2) + pow((rays[i].intersection[3] - rays[j].intersection[3]),2)) +
-						sqrt(pow((rays[j].intersection[1] - lights.at(0).at(0)),2) + pow((rays[j].intersection[2] - lights.at(0).at(1)),2) + pow((rays[j].intersection[3] - lights.at(0).at(2)),2));
-						distb = sqrt(pow((rays[i].intersection[1] - lights.at(0).at(0)),2) + pow((rays[i].intersection[2] - lights.at(0).at(1)),2) + pow((rays[i].intersection[3] - lights.at(0).at(2)),2));
-						if (dista == distb) {
-							if (colours.at(i).at(0) > 0.0) {colours.at(i).at(0) = 0.5;}
-							if (colours.at(i).at(1) > 0.0) {colours.at(i).at(1) = 0.5;}
-							if (colours.at(i).at(2) > 0.0) {colours.at(i).at(2) = 0.5;}
-							break;
-						}
-					}
-					std::cout << i << std::endl;
-					i = i + 1000;
+				chrono::steady_clock::time_point traced = chrono::steady_clock::now();
+				if (!inPixels)
+					framebuffer.CopyRowMajor(pixels);
+				if (aovs)
+					framebuffer.CopyAovsRowMajor(aovs, aovValues);
+				chrono::steady_clock::time_point copied = chrono::steady_clock::now();
+				frameStat.traceTime = chrono::duration<double, milli>(traced - phaseStart).count();
+				frameStat.copyTime = chrono::duration<double, milli>(copied - traced).count();
+				RecordTraceEvent("render tiles", frame, TraceTime(phaseStart), TraceTime(traced));
+				RecordTraceEvent("copy framebuffer", frame, TraceTime(traced), TraceTime(copied));
+				if (denoise) {
+					TraceScope denoiseScope("denoise", frame);
+					framebuffer.CopyAovsRowMajor(DenoiseAovs, denoiseGuides);
+					denoiser.Run(width, height, &pixels[0], &denoiseGuides[0], DenoiseSettings(), &pixels[0], &pool);
+					frameStat.denoiseTime = chrono::duration<double, milli>(chrono::steady_clock::now() - copied).count();
+					copied = chrono::steady_clock::now();
 				}
-*/
-	//render
-				GeneratePoint(&geometry, &shader, vertices, colours);
-				RenderScene(&geometry, &shader);
 
+	//render
 				int count = 0;
-				glm::vec3 colors= glm::vec3 (0.0f,0.0f,0.0f);
-				for (float i = 0; i < height; i++) {
-					for (float j = 0; j < width; j++) {
-						colors.x = colours.at(count).at(0);
-						colors.y = colours.at(count).at(1);
-						colors.z = colours.at(count).at(2);
-						Image.SetPixel(j, i, colors);
+				for (int i = 0; i < height; i++) {
+					for (int j = 0; j < width; j++) {
+						colours[3*count] = pixels[count].x;
+						colours[3*count+1] = pixels[count].y;
+						colours[3*count+2] = pixels[count].z;
 						count++;
 					}
 				}
+				UpdateColours(&geometry, colours);
+				RenderScene(&geometry, &shader);
+				phaseStart = chrono::steady_clock::now();
+				frameStat.displayTime = chrono::duration<double, milli>(phaseStart - copied).count();
+				RecordTraceEvent("display", frame, TraceTime(copied), TraceTime(phaseStart));
+
+		// encoding and writing happen on the writer thread while the next
+		// frame renders, the AOV channels of each pixel going into its .rtf file
+		char frameName[32];
+		if (frameFiles.empty())
+			snprintf(frameName, sizeof(frameName), "image");
+		else
+			snprintf(frameName, sizeof(frameName), "image_%04d", frame);
+		writer.Submit(frameName, width, height, pixels, aovNames, aovValues);
+		frameStat.saveTime = chrono::duration<double, milli>(chrono::steady_clock::now() - phaseStart).count();
+		RecordTraceEvent("submit image", frame, TraceTime(phaseStart), TraceClock());
+		if (heatmap) {
+			TraceScope heatmapScope("write heatmap", frame);
+			framebuffer.CopyCostsRowMajor(pixelCosts);
+			WriteHeatmap(frameName, width, height, pixelCosts, heatmapMetric);
+		}
+		if (!statsFile.empty())
+			frameStats.push_back(frameStat);
 
-		    Image.SaveToFile("image");
-
-		File.close();
+		frame++;
+		if (lastFrame)
+			glfwSetWindowShouldClose(window, GL_TRUE);
 	}
 
-	// clean up allocated resources before exit
+	// let the last frames reach the disk, then clean up allocated resources;
+	// the checkpoints go only once every image is saved
+	writer.Flush();
+	checkpoint.Remove();
+	for (size_t i = 0; i < checkpointFiles.size(); i++)
+		remove(checkpointFiles[i].c_str());
+	if (!statsFile.empty() && WriteStatsReport(statsFile, pool.ThreadCount(), frameStats, writer.WriteTime()))
+		cout << "statistics written to " << statsFile << endl;
+	EnableTracing(false);
+	if (!traceFile.empty() && WriteTrace(traceFile))
+		cout << "trace written to " << traceFile << endl;
 	DestroyGeometry(&geometry);
 	DestroyShaders(&shader);
 	glfwDestroyWindow(window);
 	glfwTerminate();
-	Image.Destroy();
 
 	cout << "Goodbye!" << endl;
 	return 0;
@@ -0,0 +1,172 @@
+// ==========================================================================
+// Render Farm Tool
+//
+// Renders one still across several processes and machines. The coordinator
+// loads the scene, waits for workers on a TCP port and hands them tiles;
+// every worker renders its tiles on all of its cores and sends the float
+// pixels back. The finished image is saved as PNG, and as PFM if asked.
+// Workers can join at any time; the tiles of one that dies or stalls are
+// given to the others. With a checkpoint file the finished tiles are saved
+// every few seconds, and a coordinator started again with --resume after
+// being stopped only renders the tiles still missing.
+//
+// Usage: farm coordinator <scene.txt> <output.png> [--port P] [--width W]
+//                [--height H] [--palette N] [--tile N] [--in-flight N]
+//                [--timeout S] [--pfm] [--bvh8] [--lbvh] [--threads N]
+//                [--checkpoint FILE] [--checkpoint-interval S] [--resume]
+//        farm worker <host> [--port P] [--threads N] [--connect-timeout S]
+//                [--fail-after N] [--trace trace.json]
+// ==========================================================================
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "Raytracer.h"
+#include "RenderFarm.h"
+#include "ThreadPool.h"
+#include "ToneMap.h"
+#include "PngEncoder.h"
+#include "FloatImage.h"
+#include "Trace.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    int Coordinator(int argc, char *argv[])
+    {
+        CoordinatorSettings settings;
+        int threadCount = 0;
+        bool pfm = false;
+        for (int i = 4; i < argc; i++)
+        {
+            string arg = argv[i];
+            if (arg == "--port" && i + 1 < argc)
+                settings.port = atoi(argv[++i]);
+            else if (arg == "--width" && i + 1 < argc)
+                settings.width = atoi(argv[++i]);
+            else if (arg == "--height" && i + 1 < argc)
+                settings.height = atoi(argv[++i]);
+            else if (arg == "--palette" && i + 1 < argc)
+                settings.palette = atoi(argv[++i]);
+            else if (arg == "--tile" && i + 1 < argc)
+                settings.tileSize = atoi(argv[++i]);
+            else if (arg == "--in-flight" && i + 1 < argc)
+                settings.tilesInFlight = atoi(argv[++i]);
+            else if (arg == "--timeout" && i + 1 < argc)
+                settings.tileTimeout = atof(argv[++i]);
+            else if (arg == "--pfm")
+                pfm = true;
+            else if (arg == "--bvh8")
+                settings.wideBVH = true;
+            else if (arg == "--lbvh")
+                settings.bvhMethod = BuildMorton;
+            else if (arg == "--threads" && i + 1 < argc)
+                threadCount = atoi(argv[++i]);
+            else if (arg == "--checkpoint" && i + 1 < argc)
+                settings.checkpointFile = argv[++i];
+            else if (arg == "--checkpoint-interval" && i + 1 < argc)
+                settings.checkpointInterval = atof(argv[++i]);
+            else if (arg == "--resume")
+                settings.resume = true;
+            else
+                cout << "Ignoring unknown option " << arg << endl;
+        }
+        if (settings.resume && settings.checkpointFile.empty())
+            settings.checkpointFile = string(argv[3]) + ".checkpoint";
+        if (settings.width <= 0 || settings.height <= 0)
+        {
+            cout << "ERROR: Invalid image size " << settings.width << "x" << settings.height << endl;
+            return -1;
+        }
+
+        Scene scene;
+        if (!LoadScene(argv[2], scene))
+            return -1;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<glm::vec3> pixels;
+        if (!RunCoordinator(scene, settings, pixels))
+            return -1;
+        chrono::steady_clock::time_point rendered = chrono::steady_clock::now();
+
+        // the pool only speeds up tone mapping and compression here
+        ThreadPool pool(threadCount);
+        string output = argv[3];
+        vector<unsigned char> bytes(pixels.size() * 3);
+        ToneMapImage(&pixels[0].x, settings.width, settings.height, ToneMapSettings(), &bytes[0], &pool);
+        if (!WritePng(output, settings.width, settings.height, &bytes[0], DefaultPngLevel, &pool))
+        {
+            cout << "ERROR: Could not write " << output << endl;
+            return -1;
+        }
+        if (pfm && !WritePfm(output + ".pfm", settings.width, settings.height, pixels))
+            return -1;
+
+        // the image is safe, the checkpoint is no longer needed
+        if (!settings.checkpointFile.empty())
+            remove(settings.checkpointFile.c_str());
+
+        cout << settings.width << "x" << settings.height << " rendered in "
+             << chrono::duration<double>(rendered - start).count() << " s, saved to " << output << endl;
+        return 0;
+    }
+
+    int Worker(int argc, char *argv[])
+    {
+        WorkerSettings settings;
+        settings.host = argv[2];
+        int threadCount = 0;
+        string traceFile;
+        for (int i = 3; i < argc; i++)
+        {
+            string arg = argv[i];
+            if (arg == "--port" && i + 1 < argc)
+                settings.port = atoi(argv[++i]);
+            else if (arg == "--threads" && i + 1 < argc)
+                threadCount = atoi(argv[++i]);
+            else if (arg == "--connect-timeout" && i + 1 < argc)
+                settings.connectTimeout = atof(argv[++i]);
+            else if (arg == "--fail-after" && i + 1 < argc)
+                settings.failAfter = atoi(argv[++i]);
+            else if (arg == "--trace" && i + 1 < argc)
+                traceFile = argv[++i];
+            else
+                cout << "Ignoring unknown option " << arg << endl;
+        }
+
+        SetTraceThreadName("main");
+        EnableTracing(!traceFile.empty());
+        ThreadPool pool(threadCount);
+        bool done = RunWorker(settings, pool);
+        EnableTracing(false);
+        if (!traceFile.empty())
+            WriteTrace(traceFile);
+        return done ? 0 : 1;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    string mode = argc > 1 ? argv[1] : "";
+    if (mode == "coordinator" && argc >= 4)
+        return Coordinator(argc, argv);
+    if (mode == "worker" && argc >= 3)
+        return Worker(argc, argv);
+
+    cout << "Usage: farm coordinator <scene.txt> <output.png> [--port P] [--width W]" << endl
+         << "              [--height H] [--palette N] [--tile N] [--in-flight N]" << endl
+         << "              [--timeout S] [--pfm] [--bvh8] [--lbvh] [--threads N]" << endl
+         << "              [--checkpoint FILE] [--checkpoint-interval S] [--resume]" << endl
+         << "       farm worker <host> [--port P] [--threads N] [--connect-timeout S]" << endl
+         << "              [--fail-after N] [--trace trace.json]" << endl;
+    return -1;
+}
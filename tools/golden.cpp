@@ -0,0 +1,267 @@
+// ==========================================================================
+// Golden Image Check
+//
+// Renders scenes 1-3 without a window, exactly as the program saves them,
+// and compares each with its reference render (image1, image2, image3).
+// A scene passes when no channel is off by more than the maximum error and
+// the PSNR is at least the minimum; otherwise an amplified difference image
+// is written next to the report and the exit code is 1.
+//
+// Usage: golden [--scenes 1,2,3] [--golden-dir DIR] [--diff-dir DIR]
+//               [--max-error N] [--min-psnr DB] [--threads N]
+//               [--bvh8] [--lbvh] [--tiled-framebuffer]
+//        golden --compare a.png b.png [--max-error N] [--min-psnr DB]
+// ==========================================================================
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "Raytracer.h"
+#include "ThreadPool.h"
+#include "ToneMap.h"
+#include "PngEncoder.h"
+
+#include "stb_image.h"     // implemented in ImageFile.cpp
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    struct Difference
+    {
+        int    maxError;        // largest difference of any channel
+        size_t pixels;          // pixels with any channel different
+        double psnr;            // in dB, infinite for identical images
+    };
+
+    // compares count bytes; the squared errors are summed in 32-bit lanes,
+    // flushed to 64 bits every block so they cannot overflow
+    Difference Compare(const unsigned char *a, const unsigned char *b, size_t count,
+                       vector<unsigned char> &diff)
+    {
+        diff.resize(count);
+        uint64_t squares = 0;
+        int maxError = 0;
+        size_t i = 0;
+
+#if defined(__SSE2__)
+        const size_t block = 16 * 1024;
+        __m128i zero = _mm_setzero_si128();
+        __m128i maxv = zero;
+        while (i + 16 <= count) {
+            size_t end = min(count - (count - i) % 16, i + block);
+            __m128i sum = zero;
+            for (; i < end; i += 16) {
+                __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+                __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+                __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+                _mm_storeu_si128((__m128i *)(&diff[i]), d);
+                maxv = _mm_max_epu8(maxv, d);
+                __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+                sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+            }
+            uint32_t lanes[4];
+            _mm_storeu_si128((__m128i *)lanes, sum);
+            squares += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+        unsigned char bytes[16];
+        _mm_storeu_si128((__m128i *)bytes, maxv);
+        for (int k = 0; k < 16; k++)
+            maxError = max(maxError, (int)bytes[k]);
+#endif
+
+        for (; i < count; i++) {
+            int d = abs((int)a[i] - (int)b[i]);
+            diff[i] = (unsigned char)d;
+            maxError = max(maxError, d);
+            squares += d * d;
+        }
+
+        Difference result;
+        result.maxError = maxError;
+        result.pixels = 0;
+        for (size_t p = 0; p + 2 < count; p += 3)
+            if (diff[p] | diff[p + 1] | diff[p + 2])
+                result.pixels++;
+        double mse = (double)squares / max<size_t>(count, 1);
+        result.psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+        return result;
+    }
+
+    // scales the differences up so single steps are visible, and writes them
+    bool WriteDiffImage(const string &fileName, int width, int height,
+                        const vector<unsigned char> &diff)
+    {
+        vector<unsigned char> scaled(diff.size());
+        for (size_t i = 0; i < diff.size(); i++)
+            scaled[i] = (unsigned char)min(255, diff[i] * 16);
+        return WritePng(fileName, width, height, &scaled[0], DefaultPngLevel, 0);
+    }
+
+    bool Check(const string &label, const unsigned char *rendered, const unsigned char *golden,
+               int width, int height, int maxError, double minPsnr, const string &diffFile)
+    {
+        vector<unsigned char> diff;
+        Difference d = Compare(rendered, golden, (size_t)width * height * 3, diff);
+        bool pass = d.maxError <= maxError && d.psnr >= minPsnr;
+
+        printf("%-12s %s  max error %3d, %zu pixels differ, PSNR ", label.c_str(),
+               pass ? "PASS" : "FAIL", d.maxError, d.pixels);
+        if (std::isinf(d.psnr))
+            printf("inf (identical)\n");
+        else
+            printf("%.2f dB\n", d.psnr);
+
+        if (!pass && !diffFile.empty() && WriteDiffImage(diffFile, width, height, diff))
+            cout << "             difference image written to " << diffFile << endl;
+        return pass;
+    }
+
+    // renders a scene file the way the program does and tone maps it to
+    // the bytes its PNG holds, top row first
+    bool RenderScene(int sceneNumber, ThreadPool &pool, bool wide, BVHBuildMethod method,
+                     FramebufferLayout layout, int width, int height, vector<unsigned char> &bytes)
+    {
+        char sceneFile[32];
+        snprintf(sceneFile, sizeof(sceneFile), "scene%d.txt", sceneNumber);
+        Scene scene;
+        if (!LoadScene(sceneFile, scene))
+            return false;
+
+        vector<AABB> boxes;
+        TriangleBounds(scene, boxes);
+        scene.bvh.Build(boxes, &pool, method);
+        if (wide)
+            scene.bvh.Compress();
+
+        Camera camera(width, height);
+        Framebuffer framebuffer;
+        framebuffer.Resize(width, height, layout);
+        RenderTiles(scene, sceneNumber, camera, framebuffer, &pool);
+
+        vector<glm::vec3> pixels;
+        framebuffer.CopyRowMajor(pixels);
+        bytes.resize((size_t)width * height * 3);
+        ToneMapImage(&pixels[0].x, width, height, ToneMapSettings(), &bytes[0], &pool);
+        return true;
+    }
+
+    unsigned char *LoadImage(const string &fileName, int &width, int &height)
+    {
+        int channels = 0;
+        unsigned char *data = stbi_load(fileName.c_str(), &width, &height, &channels, 3);
+        if (!data)
+            cout << "ERROR: Could not read image " << fileName << endl;
+        return data;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    vector<int> scenes;
+    string goldenDir = ".", diffDir = ".";
+    int maxError = 1;
+    double minPsnr = 50.0;
+    int threadCount = 0;
+    bool wide = false;
+    BVHBuildMethod method = BuildBinnedSAH;
+    FramebufferLayout layout = RowMajorLayout;
+    string compareA, compareB;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--scenes" && i + 1 < argc) {
+            stringstream list(argv[++i]);
+            string item;
+            while (getline(list, item, ','))
+                scenes.push_back(atoi(item.c_str()));
+        }
+        else if (arg == "--golden-dir" && i + 1 < argc)
+            goldenDir = argv[++i];
+        else if (arg == "--diff-dir" && i + 1 < argc)
+            diffDir = argv[++i];
+        else if (arg == "--max-error" && i + 1 < argc)
+            maxError = atoi(argv[++i]);
+        else if (arg == "--min-psnr" && i + 1 < argc)
+            minPsnr = atof(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            threadCount = atoi(argv[++i]);
+        else if (arg == "--bvh8")
+            wide = true;
+        else if (arg == "--lbvh")
+            method = BuildMorton;
+        else if (arg == "--tiled-framebuffer")
+            layout = TiledLayout;
+        else if (arg == "--compare" && i + 2 < argc) {
+            compareA = argv[++i];
+            compareB = argv[++i];
+        }
+        else
+            cout << "Ignoring unknown option " << arg << endl;
+    }
+
+    // two images given: compare just those
+    if (!compareA.empty()) {
+        int wa = 0, ha = 0, wb = 0, hb = 0;
+        unsigned char *a = LoadImage(compareA, wa, ha);
+        unsigned char *b = LoadImage(compareB, wb, hb);
+        bool pass = false;
+        if (a && b && (wa != wb || ha != hb))
+            cout << "FAIL: " << compareA << " is " << wa << "x" << ha << ", "
+                 << compareB << " is " << wb << "x" << hb << endl;
+        else if (a && b)
+            pass = Check("compare", a, b, wa, ha, maxError, minPsnr, diffDir + "/diff.png");
+        stbi_image_free(a);
+        stbi_image_free(b);
+        return pass ? 0 : 1;
+    }
+
+    if (scenes.empty())
+        for (int n = 1; n <= 3; n++)
+            scenes.push_back(n);
+
+    ThreadPool pool(threadCount);
+    cout << "max error " << maxError << ", min PSNR " << minPsnr << " dB" << endl;
+    int failures = 0;
+    for (size_t s = 0; s < scenes.size(); s++) {
+        char name[32];
+        snprintf(name, sizeof(name), "image%d", scenes[s]);
+        int width = 0, height = 0;
+        unsigned char *golden = LoadImage(goldenDir + "/" + name, width, height);
+        vector<unsigned char> rendered;
+        if (!golden || !RenderScene(scenes[s], pool, wide, method, layout, width, height, rendered)) {
+            stbi_image_free(golden);
+            failures++;
+            continue;
+        }
+
+        char diffName[32];
+        snprintf(diffName, sizeof(diffName), "diff_scene%d.png", scenes[s]);
+        char label[32];
+        snprintf(label, sizeof(label), "scene%d.txt", scenes[s]);
+        if (!Check(label, &rendered[0], golden, width, height, maxError, minPsnr, diffDir + "/" + diffName))
+            failures++;
+        stbi_image_free(golden);
+    }
+
+    if (failures > 0) {
+        cout << "FAILED: " << failures << " of " << scenes.size() << " scenes" << endl;
+        return 1;
+    }
+    cout << "OK: every scene matches its golden image" << endl;
+    return 0;
+}
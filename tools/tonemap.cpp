@@ -0,0 +1,128 @@
+// ==========================================================================
+// Tone Mapping Tool
+//
+// Makes an 8-bit PNG from a float image saved with --float-output, so
+// exposure and tone curve can be changed without rendering again.
+//
+// Usage: tonemap <input.pfm|input.rtf> <output.png> [--exposure E]
+//                [--curve clamp|reinhard|filmic] [--srgb] [--png-level N]
+//                [--threads N]
+// ==========================================================================
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "FloatImage.h"
+#include "ToneMap.h"
+#include "PngEncoder.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    bool EndsWith(const string &s, const string &suffix)
+    {
+        return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // reads the colour channels of either float format into rgb
+    bool LoadFloatImage(const string &fileName, int &width, int &height, vector<float> &rgb)
+    {
+        if (EndsWith(fileName, ".pfm"))
+        {
+            vector<glm::vec3> pixels;
+            if (!ReadPfm(fileName, width, height, pixels))
+                return false;
+            rgb.assign(&pixels[0].x, &pixels[0].x + pixels.size() * 3);
+            return true;
+        }
+
+        TiledFloatImage image;
+        if (!image.Open(fileName))
+            return false;
+        int red = image.FindChannel("R");
+        if (red < 0 || red + 3 > image.Channels())
+        {
+            cout << "ERROR: " << fileName << " has no R, G, B channels" << endl;
+            return false;
+        }
+        width = image.Width();
+        height = image.Height();
+        image.ReadChannels(red, 3, rgb);
+        return true;
+    }
+}
+
+// --------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        cout << "Usage: tonemap <input.pfm|input.rtf> <output.png> [--exposure E]" << endl
+             << "               [--curve clamp|reinhard|filmic] [--srgb] [--png-level N]" << endl
+             << "               [--threads N]" << endl;
+        return -1;
+    }
+
+    ToneMapSettings settings;
+    int level = DefaultPngLevel;
+    int threadCount = 0;
+    for (int i = 3; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--exposure" && i + 1 < argc)
+            settings.exposure = (float)atof(argv[++i]);
+        else if (arg == "--curve" && i + 1 < argc)
+        {
+            string curve = argv[++i];
+            if (curve == "clamp")
+                settings.curve = ClampCurve;
+            else if (curve == "reinhard")
+                settings.curve = ReinhardCurve;
+            else if (curve == "filmic")
+                settings.curve = FilmicCurve;
+            else
+                cout << "Unknown curve " << curve << ", using clamp" << endl;
+        }
+        else if (arg == "--srgb")
+            settings.srgb = true;
+        else if (arg == "--png-level" && i + 1 < argc)
+            level = atoi(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            threadCount = atoi(argv[++i]);
+        else
+            cout << "Ignoring unknown option " << arg << endl;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int width = 0, height = 0;
+    vector<float> rgb;
+    if (!LoadFloatImage(argv[1], width, height, rgb))
+        return -1;
+    chrono::steady_clock::time_point loaded = chrono::steady_clock::now();
+
+    ThreadPool pool(threadCount);
+    vector<unsigned char> bytes((size_t)width * height * 3);
+    ToneMapImage(&rgb[0], width, height, settings, &bytes[0], &pool);
+    chrono::steady_clock::time_point mapped = chrono::steady_clock::now();
+
+    if (!WritePng(argv[2], width, height, &bytes[0], level, &pool))
+    {
+        cout << "ERROR: Could not write " << argv[2] << endl;
+        return -1;
+    }
+    chrono::steady_clock::time_point written = chrono::steady_clock::now();
+
+    cout << width << "x" << height << ": load "
+         << chrono::duration<double, milli>(loaded - start).count() << " ms, tone map "
+         << chrono::duration<double, milli>(mapped - loaded).count() << " ms, png "
+         << chrono::duration<double, milli>(written - mapped).count() << " ms" << endl;
+    return 0;
+}